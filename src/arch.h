@@ -9,3 +9,4 @@
 
 #define ILKA_CACHE_LINE 64UL  // bytes
 #define ILKA_PAGE_SIZE 4096UL // bytes
+#define ILKA_HUGE_PAGE_SIZE (1UL << 21) // bytes
@@ -15,6 +15,11 @@
 
 /* #define ILKA_MCHECK 1 */
 
+// Release flavor: elides the bounds and offset checks of the hot paths
+// (ilka_debug_assert) while keeping the validation of the cold paths. Usually
+// set through the build system's ilka_ndebug target rather than here.
+/* #define ILKA_NDEBUG 1 */
+
 /* #define ILKA_ALLOC_ZERO 1 */
 /* #define ILKA_ALLOC_FILL_ON_FREE 1 */
 /* #define ILKA_ALLOC_FILL_ON_ALLOC 1 */
@@ -69,6 +69,15 @@ void ilka_vfail_errno(const char *file, int line, const char *fmt, ...)
         ilka_abort();                           \
     } while (0)
 
+// Hot path checks which are compiled out of the ILKA_NDEBUG flavor. The
+// predicate is still type-checked but never evaluated.
+#ifdef ILKA_NDEBUG
+# define ilka_debug_assert(p, ...)              \
+    do { (void) sizeof(p); } while (0)
+#else
+# define ilka_debug_assert(p, ...) ilka_assert(p, __VA_ARGS__)
+#endif
+
 #define ilka_todo(msg)                          \
     do {                                        \
         ilka_fail("TODO: " msg);                \
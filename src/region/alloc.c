@@ -11,12 +11,26 @@
 struct ilka_alloc
 {
     struct ilka_region * region;
-    ilka_slock lock;
+
+    // multi-process regions use the lock stored in the region.
+    ilka_slock *lock;
+    ilka_slock local;
 
     ilka_off_t pages_off;
+    ilka_off_t lock_off;
+    ilka_off_t claim_off;
     ilka_off_t blocks_off;
 
     size_t areas;
+    size_t area_base;
+
+    // area i belongs to the numa node of index i % nodes; 0 if numa is
+    // disabled.
+    size_t nodes;
+
+    struct alloc_punch *punch;
+    size_t punch_len;
+    size_t punch_cap;
 };
 
 
@@ -24,7 +38,7 @@ struct ilka_alloc
 // implementation
 // -----------------------------------------------------------------------------
 
-static ilka_off_t alloc_new(struct ilka_alloc *alloc, size_t len, size_t area);
+static ilka_off_t alloc_pages(struct ilka_alloc *alloc, size_t len, size_t area);
 
 #include "alloc_page.c"
 #include "alloc_block.c"
@@ -49,10 +63,13 @@ static bool alloc_init(
     memset(alloc, 0, sizeof(struct ilka_alloc));
 
     alloc->region = region;
-    slock_init(&alloc->lock);
+    slock_init(&alloc->local);
+    alloc->lock = &alloc->local;
 
     alloc->pages_off = off + sizeof(uint64_t);
-    alloc->blocks_off = alloc->pages_off + sizeof(uint64_t);
+    alloc->lock_off = alloc->pages_off + sizeof(uint64_t);
+    alloc->claim_off = alloc->lock_off + sizeof(ilka_slock);
+    alloc->blocks_off = alloc->claim_off + sizeof(uint64_t);
     alloc->blocks_off = ceil_div(alloc->blocks_off, ILKA_CACHE_LINE) * ILKA_CACHE_LINE;
 
     if (options->alloc_areas && !options->create) {
@@ -61,6 +78,26 @@ static bool alloc_init(
     }
     alloc->areas = options->alloc_areas ? options->alloc_areas : ilka_cpus();
 
+    // Falls back to the regular areas if the kernel doesn't expose more than
+    // one node as there's nothing to bind to.
+    if (options->numa) {
+        alloc->nodes = ilka_numa_nodes();
+        if (alloc->nodes == 1) alloc->nodes = 0;
+        if (alloc->nodes)
+            alloc->areas = ceil_div(alloc->areas, alloc->nodes) * alloc->nodes;
+    }
+
+    if (options->punch_len && (options->huge_tlb || options->huge_pages)) {
+        ilka_fail("punch_len option is not supported with huge pages");
+        return false;
+    }
+
+    // Runs are only tracked for the allocations of the current process.
+    if (options->punch_len && options->multi_process) {
+        ilka_fail("punch_len option is not supported by multi-process regions");
+        return false;
+    }
+
     const uint64_t *areas = ilka_read_sys(region, off, sizeof(uint64_t));
     if (*areas) alloc->areas = *areas;
     else {
@@ -69,36 +106,113 @@ static bool alloc_init(
     }
 
     ilka_off_t end_off = alloc_end(alloc);
-    if (end_off > ILKA_PAGE_SIZE) {
-        ilka_off_t off = ilka_grow(region, end_off - ILKA_PAGE_SIZE);
+    size_t len = ilka_len(region);
+    if (end_off > len) {
+        ilka_off_t off = ilka_grow(region, end_off - len);
         if (!off) return false;
-        ilka_assert(off == ILKA_PAGE_SIZE,
-                "disjointed allocator region detected: %lu != 4096", off);
+        ilka_assert(off == len,
+                "disjointed allocator region detected: %lu != %lu", off, len);
+    }
+
+    // Every process claims an offset into the areas which spreads the threads
+    // of different processes over different block lists.
+    if (options->multi_process) {
+        alloc->lock = ilka_write_sys(region, alloc->lock_off, sizeof(ilka_slock));
+
+        uint64_t *claim = ilka_write_sys(region, alloc->claim_off, sizeof(uint64_t));
+        alloc->area_base = ilka_atomic_fetch_add(claim, 1, morder_relaxed);
+
+        // Keeps the areas on their node as long as the node count divides
+        // the area count which is the case if the region was created with
+        // the numa option on this machine.
+        if (alloc->nodes) alloc->area_base *= alloc->nodes;
     }
 
     return true;
 }
 
+// Picks an area of the calling thread's numa node.
+static size_t alloc_area(struct ilka_alloc *alloc)
+{
+    size_t tid = ilka_tid();
+    if (!alloc->nodes) return tid;
+
+    size_t per_node = alloc->areas / alloc->nodes;
+    if (!per_node) per_node = 1;
+
+    return ilka_numa_node() + (tid % per_node) * alloc->nodes;
+}
+
+// Page runs are shared by all the areas so they're bound to the node of the
+// area every time they're handed out.
+static ilka_off_t alloc_pages(struct ilka_alloc *alloc, size_t len, size_t area)
+{
+    slock_lock(alloc->lock);
+    ilka_off_t result = alloc_page_new(alloc, alloc->pages_off, len);
+    slock_unlock(alloc->lock);
+
+    if (result && alloc->nodes)
+        ilka_bind(alloc->region, result, len, ilka_numa_node_id(area % alloc->nodes));
+
+    return result;
+}
+
 static ilka_off_t alloc_new(struct ilka_alloc *alloc, size_t len, size_t area)
 {
+    area = (area + alloc->area_base) % alloc->areas;
+
     if (ilka_likely(len <= alloc_block_max_len))
         return alloc_block_new(alloc, len, area);
 
-    slock_lock(&alloc->lock);
-    ilka_off_t result = alloc_page_new(alloc, alloc->pages_off, len);
-    slock_unlock(&alloc->lock);
-    return result;
+    return alloc_pages(alloc, len, area);
+}
+
+static bool alloc_shrink(struct ilka_alloc *alloc, size_t min_len)
+{
+    slock_lock(alloc->lock);
+    bool ret = alloc_page_shrink(alloc, alloc->pages_off, min_len);
+    slock_unlock(alloc->lock);
+    return ret;
+}
+
+// Collects the free page runs that will have their holes punched once the
+// current save completes.
+static bool alloc_punch_prepare(struct ilka_alloc *alloc, size_t min_len)
+{
+    slock_lock(alloc->lock);
+    bool ret = alloc_page_punch_prepare(alloc, alloc->pages_off, min_len);
+    slock_unlock(alloc->lock);
+    return ret;
+}
+
+static bool alloc_punch(struct ilka_alloc *alloc, bool saved)
+{
+    slock_lock(alloc->lock);
+    bool ret = saved ? alloc_page_punch(alloc) : true;
+    alloc_page_punch_reset(alloc);
+    slock_unlock(alloc->lock);
+    return ret;
+}
+
+// Hands a range of pages that was never allocated to the page allocator.
+static void alloc_release(struct ilka_alloc *alloc, ilka_off_t off, size_t len)
+{
+    slock_lock(alloc->lock);
+    alloc_page_free(alloc, alloc->pages_off, off, len);
+    slock_unlock(alloc->lock);
 }
 
 static void alloc_free(
         struct ilka_alloc *alloc, ilka_off_t off, size_t len, size_t area)
 {
+    area = (area + alloc->area_base) % alloc->areas;
+
     if (ilka_likely(len <= alloc_block_max_len)) {
         alloc_block_free(alloc, off, len, area);
         return;
     }
 
-    slock_lock(&alloc->lock);
+    slock_lock(alloc->lock);
     alloc_page_free(alloc, alloc->pages_off, off, len);
-    slock_unlock(&alloc->lock);
+    slock_unlock(alloc->lock);
 }
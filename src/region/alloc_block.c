@@ -120,7 +120,7 @@ static ilka_off_t alloc_block_fill(
     const size_t nodes = page_size / len;
     ilka_assert(nodes >= 2, "inssuficient nodes in page: %lu < 2", nodes);
 
-    ilka_off_t page = alloc_new(alloc, page_size, area);
+    ilka_off_t page = alloc_pages(alloc, page_size, area);
     if (!page) return 0;
 
     ilka_off_t start = page;
@@ -149,7 +149,6 @@ static ilka_off_t alloc_block_fill(
 static ilka_off_t alloc_block_new(
         struct ilka_alloc *alloc, size_t len, size_t area)
 {
-    area %= alloc->areas;
     size_t class = alloc_block_class(&len);
     struct alloc_blocks *blocks = alloc_block_write(alloc, area, class);
 
@@ -178,7 +177,6 @@ static ilka_off_t alloc_block_new(
 static void alloc_block_free(
         struct ilka_alloc *alloc, ilka_off_t off, size_t len, size_t area)
 {
-    area %= alloc->areas;
     size_t class = alloc_block_class(&len);
     struct alloc_blocks *blocks = alloc_block_write(alloc, area, class);
     ilka_off_t *node = ilka_write_sys(alloc->region, off, sizeof(ilka_off_t));
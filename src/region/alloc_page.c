@@ -4,7 +4,7 @@
 */
 
 // -----------------------------------------------------------------------------
-// allocator
+// structs
 // -----------------------------------------------------------------------------
 
 struct alloc_page_node
@@ -14,6 +14,96 @@ struct alloc_page_node
     size_t len;
 };
 
+struct alloc_punch
+{
+    ilka_off_t off;
+    size_t len;
+};
+
+
+// -----------------------------------------------------------------------------
+// punch
+// -----------------------------------------------------------------------------
+
+// The saved state of a run that is reallocated before its hole is punched
+// might reference its content so it can no longer be punched. Pages are always
+// carved from the end of a node so only the head of the run remains free.
+static void alloc_page_punch_cancel(
+        struct ilka_alloc *alloc, ilka_off_t off, size_t len)
+{
+    for (size_t i = 0; i < alloc->punch_len; ++i) {
+        struct alloc_punch *punch = &alloc->punch[i];
+        if (off >= punch->off + punch->len || off + len <= punch->off) continue;
+        punch->len = off > punch->off ? off - punch->off : 0;
+    }
+}
+
+// The first page of a run holds its free list node and is left alone.
+static bool alloc_page_punch_prepare(
+        struct ilka_alloc *alloc,
+        ilka_off_t prev_off,
+        size_t min_len)
+{
+    const ilka_off_t *prev =
+        ilka_read_sys(alloc->region, prev_off, sizeof(ilka_off_t));
+    ilka_off_t node_off = *prev;
+
+    while (node_off) {
+        const struct alloc_page_node *node =
+            ilka_read_sys(alloc->region, node_off, sizeof(struct alloc_page_node));
+        node_off = node->next;
+
+        if (node->len - ILKA_PAGE_SIZE < min_len) continue;
+
+        if (alloc->punch_len == alloc->punch_cap) {
+            size_t cap = alloc->punch_cap ? alloc->punch_cap * 2 : 8;
+            struct alloc_punch *punch =
+                realloc(alloc->punch, cap * sizeof(struct alloc_punch));
+            if (!punch) {
+                ilka_fail("out-of-memory for punch list: %lu",
+                        cap * sizeof(struct alloc_punch));
+                return false;
+            }
+
+            alloc->punch = punch;
+            alloc->punch_cap = cap;
+        }
+
+        alloc->punch[alloc->punch_len++] = (struct alloc_punch) {
+            .off = node->off + ILKA_PAGE_SIZE,
+            .len = node->len - ILKA_PAGE_SIZE,
+        };
+    }
+
+    return true;
+}
+
+static bool alloc_page_punch(struct ilka_alloc *alloc)
+{
+    for (size_t i = 0; i < alloc->punch_len; ++i) {
+        struct alloc_punch *punch = &alloc->punch[i];
+        if (!punch->len) continue;
+        if (!ilka_punch(alloc->region, punch->off, punch->len)) return false;
+    }
+
+    return true;
+}
+
+static void alloc_page_punch_reset(struct ilka_alloc *alloc)
+{
+    if (alloc->punch) free(alloc->punch);
+    alloc->punch = NULL;
+    alloc->punch_len = alloc->punch_cap = 0;
+}
+
+
+// -----------------------------------------------------------------------------
+// allocator
+// -----------------------------------------------------------------------------
+
+static void alloc_page_free(
+        struct ilka_alloc *alloc, ilka_off_t prev_off, ilka_off_t off, size_t len);
+
 static ilka_off_t alloc_page_new(
         struct ilka_alloc *alloc,
         ilka_off_t prev_off,
@@ -39,6 +129,8 @@ static ilka_off_t alloc_page_new(
             ilka_off_t *wprev =
                 ilka_write_sys(alloc->region, prev_off, sizeof(ilka_off_t));
             *wprev = node->next;
+
+            alloc_page_punch_cancel(alloc, node->off, len);
             return node->off;
         }
 
@@ -46,13 +138,55 @@ static ilka_off_t alloc_page_new(
             struct alloc_page_node *wnode =
                 ilka_write_sys(alloc->region, node_off, sizeof(struct alloc_page_node));
             wnode->len -= len;
+
+            alloc_page_punch_cancel(alloc, wnode->off + wnode->len, len);
             return wnode->off + wnode->len;
         }
 
         ilka_unreachable();
     }
 
-    return ilka_grow(alloc->region, len);
+    ilka_off_t slack;
+    ilka_off_t off = ilka_grow_slack(alloc->region, len, &slack);
+    if (off && slack < off) alloc_page_free(alloc, alloc->pages_off, slack, off - slack);
+    return off;
+}
+
+// Detaches the run of free pages at the end of the region if it's at least
+// min_len bytes long. Returns false if there was nothing to detach.
+static bool alloc_page_shrink(
+        struct ilka_alloc *alloc,
+        ilka_off_t prev_off,
+        size_t min_len)
+{
+    const ilka_off_t *prev =
+        ilka_read_sys(alloc->region, prev_off, sizeof(ilka_off_t));
+    ilka_off_t node_off = *prev;
+
+    ilka_off_t run_prev = prev_off;
+    ilka_off_t run_start = 0, run_end = 0;
+
+    while (node_off) {
+        const struct alloc_page_node *node =
+            ilka_read_sys(alloc->region, node_off, sizeof(struct alloc_page_node));
+
+        if (node->off != run_end) {
+            run_start = node->off;
+            run_prev = prev_off;
+        }
+        run_end = node->off + node->len;
+
+        prev_off = node_off;
+        node_off = node->next;
+    }
+
+    if (!run_start || run_end - run_start < min_len) return false;
+    if (!ilka_shrink_len(alloc->region, run_start, run_end)) return false;
+
+    ilka_off_t *wprev = ilka_write_sys(alloc->region, run_prev, sizeof(ilka_off_t));
+    *wprev = 0;
+
+    return true;
 }
 
 static void alloc_page_free(
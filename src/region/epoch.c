@@ -17,14 +17,41 @@ struct epoch_defer
     size_t len;
     size_t area;
 
+    size_t epoch;
     struct epoch_defer *next;
 };
 
+// Multi-process regions stamp the epochs of the threads of every process in
+// slots stored in the region so that deferred work waits on all of them.
+enum { epoch_slots = 255 };
+
+struct ilka_align(ILKA_CACHE_LINE) epoch_slot
+{
+    uint64_t owner;
+    size_t epoch;
+};
+
+struct ilka_align(ILKA_CACHE_LINE) epoch_shared
+{
+    size_t epoch;
+    struct epoch_slot slots[epoch_slots];
+};
+
+// The slots are part of the region's layout so every process must agree on it.
+_Static_assert(sizeof(struct epoch_slot) == ILKA_CACHE_LINE,
+        "unexpected epoch slot layout");
+_Static_assert(offsetof(struct epoch_shared, slots) == ILKA_CACHE_LINE &&
+        sizeof(struct epoch_shared) == (epoch_slots + 1) * ILKA_CACHE_LINE,
+        "unexpected epoch shared layout");
+
 struct epoch_thread
 {
     struct ilka_epoch *ep;
 
-    size_t epoch;
+    size_t *epoch;
+    size_t local;
+    struct epoch_slot *slot;
+
     struct epoch_defer *defers[2];
 
     struct epoch_thread *next;
@@ -36,7 +63,10 @@ struct ilka_epoch
     struct ilka_region *region;
     pthread_key_t key;
 
-    size_t epoch;
+    size_t *epoch;
+    size_t local;
+    struct epoch_shared *shared;
+
     size_t world_lock;
 
     ilka_slock lock;
@@ -48,6 +78,71 @@ struct ilka_epoch
 };
 
 
+// -----------------------------------------------------------------------------
+// slots
+// -----------------------------------------------------------------------------
+
+static bool epoch_slot_dead(uint64_t owner)
+{
+    return owner && owner != (uint64_t) getpid() && kill(owner, 0) == -1 && errno == ESRCH;
+}
+
+// The slot of a process that died without releasing it is stuck with whatever
+// epoch it held so it gets reset and reclaimed.
+static struct epoch_slot * epoch_slot_claim(struct ilka_epoch *ep)
+{
+    uint64_t pid = getpid();
+
+    for (size_t i = 0; i < epoch_slots; ++i) {
+        struct epoch_slot *slot = &ep->shared->slots[i];
+
+        // morder_relaxed: the slot's epoch is only read once we own it.
+        uint64_t owner = ilka_atomic_load(&slot->owner, morder_relaxed);
+        if (owner && !epoch_slot_dead(owner)) continue;
+
+        if (!ilka_atomic_cmp_xchg(&slot->owner, &owner, pid, morder_relaxed))
+            continue;
+
+        ilka_atomic_store(&slot->epoch, 0, morder_relaxed);
+        return slot;
+    }
+
+    ilka_fail("no free epoch slots: %d", epoch_slots);
+    return NULL;
+}
+
+static void epoch_slot_release(struct epoch_slot *slot)
+{
+    ilka_atomic_store(&slot->epoch, 0, morder_relaxed);
+
+    // morder_release: the slot must be reset before it can be claimed again.
+    ilka_atomic_store(&slot->owner, 0, morder_release);
+}
+
+// Returns the smallest epoch that a thread of any process is in or 0 if no
+// threads are in the region. The slot of a process that died within an epoch
+// would otherwise hold back the deferred work until it's claimed again. It's
+// skipped instead of reset as it can be claimed concurrently.
+static size_t epoch_slot_min(struct ilka_epoch *ep)
+{
+    size_t min = 0;
+
+    for (size_t i = 0; i < epoch_slots; ++i) {
+        struct epoch_slot *slot = &ep->shared->slots[i];
+
+        size_t epoch = ilka_atomic_load(&slot->epoch, morder_relaxed);
+        if (!epoch || (min && epoch >= min)) continue;
+
+        // morder_relaxed: a slot claimed concurrently starts out of any epoch.
+        if (epoch_slot_dead(ilka_atomic_load(&slot->owner, morder_relaxed))) continue;
+
+        min = epoch;
+    }
+
+    return min;
+}
+
+
 // -----------------------------------------------------------------------------
 // thread
 // -----------------------------------------------------------------------------
@@ -64,6 +159,16 @@ struct epoch_thread * epoch_thread_get(struct ilka_epoch *ep)
     }
 
     thread->ep = ep;
+    thread->epoch = &thread->local;
+
+    if (ep->shared) {
+        if (!(thread->slot = epoch_slot_claim(ep))) {
+            free(thread);
+            return NULL;
+        }
+        thread->epoch = &thread->slot->epoch;
+    }
+
     pthread_setspecific(ep->key, thread);
 
     {
@@ -84,7 +189,7 @@ void epoch_thread_remove(void *data)
     struct epoch_thread *thread = data;
     struct ilka_epoch *ep = thread->ep;
 
-    ilka_assert(!thread->epoch, "thread exiting while in epoch");
+    ilka_assert(!*thread->epoch, "thread exiting while in epoch");
 
     slock_lock(&ep->lock);
 
@@ -101,6 +206,8 @@ void epoch_thread_remove(void *data)
     if (thread->next) thread->next->prev = thread->prev;
     if (thread->prev) thread->prev->next = thread->next;
     else ep->threads = thread->next;
+
+    if (thread->slot) epoch_slot_release(thread->slot);
     free(thread);
 
     slock_unlock(&ep->lock);
@@ -111,6 +218,19 @@ void epoch_thread_remove(void *data)
 // defer
 // -----------------------------------------------------------------------------
 
+// Pushes the list of nodes from first to last on the defer list head.
+static void epoch_defer_push(
+        struct epoch_defer **head, struct epoch_defer *first, struct epoch_defer *last)
+{
+    struct epoch_defer *old_head = ilka_atomic_load(head, morder_acquire);
+    do {
+        last->next = old_head;
+
+        // morder_release: synchronizes with epoch_defer_run to ensure that our
+        // nodes have been fully written before they're read.
+    } while (!ilka_atomic_cmp_xchg(head, &old_head, first, morder_release));
+}
+
 static void epoch_defer_run(struct ilka_epoch *ep)
 {
     ilka_assert(!slock_try_lock(&ep->lock), "lock is required for defer run");
@@ -118,18 +238,23 @@ static void epoch_defer_run(struct ilka_epoch *ep)
 
     // morder_relaxed: doesn't synchronize with anyone since any increment is
     // done while holding the lock that we're currently holding.
-    size_t current_epoch = ilka_atomic_load(&ep->epoch, morder_relaxed);
+    size_t current_epoch = ilka_atomic_load(ep->epoch, morder_relaxed);
 
     struct epoch_thread *thread = ep->threads;
-    while (thread) {
+    while (!ep->shared && thread) {
 
         //  morder_relaxed: only written when entering the region and there's
         //  therefore no prior operations that we need to synchronize.
-        size_t epoch = ilka_atomic_load(&thread->epoch, morder_relaxed);
+        size_t epoch = ilka_atomic_load(thread->epoch, morder_relaxed);
         if (epoch && epoch < current_epoch) return;
         thread = thread->next;
     }
 
+    if (ep->shared) {
+        size_t epoch = epoch_slot_min(ep);
+        if (epoch && epoch < current_epoch) return;
+    }
+
     thread = ep->threads;
     size_t i = (current_epoch - 1) % 2;
     while (thread) {
@@ -138,27 +263,47 @@ static void epoch_defer_run(struct ilka_epoch *ep)
         // defer nodes have been fully written before we read it.
         struct epoch_defer *defers = ilka_atomic_xchg(&thread->defers[i], 0, morder_consume);
 
-        while (defers) {
-            if (defers->fn) defers->fn(defers->data);
-            else ilka_free_in(ep->region, defers->off, defers->len, defers->area);
+        // The epoch of a multi-process region can be moved forward by another
+        // process once we've checked the slots in which case the list is
+        // refilled with the nodes of the new epoch. These are put back until
+        // their epoch is over.
+        struct epoch_defer *keep = NULL, *last = NULL;
 
+        while (defers) {
             struct epoch_defer *next = defers->next;
-            free(defers);
+
+            if (defers->epoch >= current_epoch) {
+                if (!last) last = defers;
+                defers->next = keep;
+                keep = defers;
+            }
+            else {
+                if (defers->fn) defers->fn(defers->data);
+                else ilka_free_in(ep->region, defers->off, defers->len, defers->area);
+                free(defers);
+            }
+
             defers = next;
         }
 
-        // morder_relaxed: only epoch_world_stop requires that all defers be
-        // completed before proceeding but we do that syncrhonization through
-        // the lock.
-        ilka_atomic_store(&thread->defers[i], 0, morder_relaxed);
+        if (keep) epoch_defer_push(&thread->defers[i], keep, last);
 
         thread = thread->next;
     }
 
     // morder_release: synchronizes epoch_world_stop and ensures that all the
     // defer lists have been fully cleared before allowing them to be filled up
-    // again.
-    ilka_atomic_fetch_add(&ep->epoch, 1, morder_release);
+    // again. The epoch of a multi-process region can be moved forward by
+    // another process in which case it's left alone.
+    ilka_atomic_cmp_xchg(ep->epoch, &current_epoch, current_epoch + 1, morder_release);
+}
+
+static bool epoch_defer_pending(struct ilka_epoch *ep)
+{
+    for (struct epoch_thread *thread = ep->threads; thread; thread = thread->next) {
+        if (thread->defers[0] || thread->defers[1]) return true;
+    }
+    return false;
 }
 
 static void * epoch_defer_thread(void *data)
@@ -185,16 +330,8 @@ static bool epoch_defer_impl(struct ilka_epoch *ep, struct epoch_defer *node)
     // morder_relaxed: pushing to a stale epoch is fine because it just means
     // that our node is already obsolete and can therefore be executed
     // right-away.
-    size_t epoch = ilka_atomic_load(&ep->epoch, morder_relaxed);
-    struct epoch_defer **head = &thread->defers[epoch % 2];
-
-    struct epoch_defer *old_head = ilka_atomic_load(head, morder_acquire);
-    do {
-        node->next = old_head;
-
-        // morder_release: synchronizes with epoch_defer_run to ensure that our
-        // node has been fully written before it's read.
-    } while (!ilka_atomic_cmp_xchg(head, &old_head, node, morder_release));
+    node->epoch = ilka_atomic_load(ep->epoch, morder_relaxed);
+    epoch_defer_push(&thread->defers[node->epoch % 2], node, node);
 
     return true;
 }
@@ -268,8 +405,8 @@ static bool epoch_enter(struct ilka_epoch *ep)
 
   restart: (void) 0;
 
-    size_t epoch = ilka_atomic_load(&ep->epoch, morder_relaxed);
-    ilka_atomic_store(&thread->epoch, epoch, morder_relaxed);
+    size_t epoch = ilka_atomic_load(ep->epoch, morder_relaxed);
+    ilka_atomic_store(thread->epoch, epoch, morder_relaxed);
 
     // morder_acq_rel: ensures that our thread is stamped with an epoch
     // before we read world_lock. Otherwise, if the we check world_lock
@@ -284,14 +421,14 @@ static bool epoch_enter(struct ilka_epoch *ep)
 
     // it's possible for the global epoch to have switched between our load
     // and our store so make sure we have the latest version.
-    if (ilka_unlikely(epoch != ilka_atomic_load(&ep->epoch, morder_relaxed))) {
-        ilka_atomic_store(&thread->epoch, 0, morder_relaxed);
+    if (ilka_unlikely(epoch != ilka_atomic_load(ep->epoch, morder_relaxed))) {
+        ilka_atomic_store(thread->epoch, 0, morder_relaxed);
         goto restart;
     }
 
     // the world lock is on so spin until we resume.
     if (ilka_unlikely(ilka_atomic_load(&ep->world_lock, morder_acquire))) {
-        ilka_atomic_store(&thread->epoch, 0, morder_relaxed);
+        ilka_atomic_store(thread->epoch, 0, morder_relaxed);
         while (ilka_atomic_load(&ep->world_lock, morder_acquire));
         goto restart;
     }
@@ -303,7 +440,7 @@ static void epoch_exit(struct ilka_epoch *ep)
 {
     struct epoch_thread *thread = epoch_thread_get(ep);
     ilka_assert(!!thread, "unexpected nil epoch thread");
-    ilka_assert(thread->epoch, "exiting while not in epoch");
+    ilka_assert(*thread->epoch, "exiting while not in epoch");
 
     // morder_release: synchronizes with epoch_world_stop to ensure that all ops
     // in the region are properly commited before indicating that the world has
@@ -311,7 +448,7 @@ static void epoch_exit(struct ilka_epoch *ep)
     //
     // We also require that epoch_exit is an overall release op so that no reads
     // from within the region are sunk below the region.
-    ilka_atomic_store(&thread->epoch, 0, morder_release);
+    ilka_atomic_store(thread->epoch, 0, morder_release);
 }
 
 
@@ -330,7 +467,7 @@ static void epoch_world_stop(struct ilka_epoch *ep)
     while (thread) {
         // morder_acquire: synchronizes with epoch_exit to ensure that all ops
         // within the enter/exit region are completed before we can continue.
-        while (ilka_atomic_load(&thread->epoch, morder_acquire));
+        while (ilka_atomic_load(thread->epoch, morder_acquire));
         thread = thread->next;
     }
 
@@ -356,12 +493,22 @@ static void epoch_world_resume(struct ilka_epoch *ep)
 bool epoch_init(
         struct ilka_epoch *ep,
         struct ilka_region *region,
-        struct ilka_options *options)
+        struct ilka_options *options,
+        ilka_off_t shared)
 {
     memset(ep, 0, sizeof(struct ilka_epoch));
 
     ep->region = region;
-    ep->epoch = 2;
+    ep->local = 2;
+    ep->epoch = &ep->local;
+
+    if (shared) {
+        ep->shared = ilka_write_sys(region, shared, sizeof(struct epoch_shared));
+        ep->epoch = &ep->shared->epoch;
+
+        size_t epoch = 0;
+        ilka_atomic_cmp_xchg(ep->epoch, &epoch, 2, morder_relaxed);
+    }
 
     ep->gc_freq_usec = options->epoch_gc_freq_usec;
     if (!ep->gc_freq_usec) ep->gc_freq_usec = 1UL * 1000;
@@ -377,6 +524,7 @@ bool epoch_init(
         goto fail_sentinel;
     }
     ep->sentinel->ep = ep;
+    ep->sentinel->epoch = &ep->sentinel->local;
     ep->threads = ep->sentinel;
 
     int err = pthread_create(&ep->gc_thread, NULL, epoch_defer_thread, ep);
@@ -415,21 +563,35 @@ void epoch_close(struct ilka_epoch *ep)
     }
 
     ilka_assert(!ep->world_lock, "closing with world stopped");
+
+    // The threads of other processes can hold back the deferred work of a
+    // multi-process region which must be completed before closing.
+    while (ep->shared) {
+        slock_lock(&ep->lock);
+        epoch_defer_run(ep);
+        bool pending = epoch_defer_pending(ep);
+        slock_unlock(&ep->lock);
+
+        if (!pending) break;
+        ilka_nsleep(ep->gc_freq_usec * 1000);
+    }
+
     ilka_assert(slock_try_lock(&ep->lock), "closing with lock held");
 
     while (ep->threads) {
         struct epoch_thread *thread = ep->threads;
         ep->threads = thread->next;
 
-        ilka_assert(!thread->epoch,
+        ilka_assert(!*thread->epoch,
                 "closing with thread in region: thread=%p, epoch=%lu",
-                (void *) thread, thread->epoch);
+                (void *) thread, *thread->epoch);
 
         for (size_t i = 0; i < 2; ++i) {
             ilka_assert(!thread->defers[i],
                     "closing with pending defer work: thread=%p", (void *) thread);
         }
 
+        if (thread->slot) epoch_slot_release(thread->slot);
         free(thread);
     }
 
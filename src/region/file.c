@@ -32,6 +32,24 @@ static int file_open(const char *file, struct ilka_options *options)
     return fd;
 }
 
+// Volatile regions live in an anonymous file which vanishes with its last
+// reference.
+static int file_memfd(const char *file, struct ilka_options *options)
+{
+    if (options->read_only) {
+        ilka_fail("in-memory region '%s' can't be read-only", file);
+        return -1;
+    }
+
+    int fd = memfd_create(file, MFD_CLOEXEC);
+    if (fd == -1) {
+        ilka_fail_errno("unable to create memfd '%s'", file);
+        return -1;
+    }
+
+    return fd;
+}
+
 static bool file_close(int fd)
 {
     if (close(fd) != -1) return true;
@@ -61,6 +79,39 @@ static ssize_t file_len(int fd)
     return stat.st_size;
 }
 
+static bool file_truncate(int fd, size_t len)
+{
+    if (!ftruncate(fd, len)) return true;
+
+    ilka_fail_errno("unable to truncate fd '%d'", fd);
+    return false;
+}
+
+// Reserves the blocks on disk which avoids fragmenting the file as it grows.
+// Filesystems that don't support fallocate fall back to a sparse truncate.
+static bool file_alloc(int fd, size_t off, size_t len)
+{
+    if (!fallocate(fd, 0, off, len)) return true;
+    if (errno == EOPNOTSUPP) return file_truncate(fd, off + len);
+
+    ilka_fail_errno("unable to fallocate fd '%d' at '%p' for length '%p'",
+            fd, (void *) off, (void *) len);
+    return false;
+}
+
+// Filesystems that don't support hole punching keep the blocks around which is
+// harmless as the range is free.
+static bool file_punch(int fd, size_t off, size_t len)
+{
+    int mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+    if (!fallocate(fd, mode, off, len)) return true;
+    if (errno == EOPNOTSUPP) return true;
+
+    ilka_fail_errno("unable to punch hole in fd '%d' at '%p' for length '%p'",
+            fd, (void *) off, (void *) len);
+    return false;
+}
+
 static ssize_t file_grow(int fd, size_t len)
 {
     ssize_t old = file_len(fd);
@@ -75,3 +126,195 @@ static ssize_t file_grow(int fd, size_t len)
 
     return len;
 }
+
+
+// -----------------------------------------------------------------------------
+// stripes
+// -----------------------------------------------------------------------------
+//
+// A striped region spreads its offsets over multiple files in chunks of len
+// bytes: chunk i lives in stripe i % n at offset (i / n) * len. The region file
+// is always the first stripe which means that it holds the meta page.
+
+static const size_t stripes_default_len = 64UL * 1024 * 1024;
+
+struct ilka_stripes
+{
+    size_t n;
+    size_t len;
+
+    const char *file;
+    const char * const *files;
+
+    int *fds;
+};
+
+static bool stripes_init(
+        struct ilka_stripes *s, const char *file, struct ilka_options *options)
+{
+    memset(s, 0, sizeof(struct ilka_stripes));
+
+    s->n = 1 + options->stripe_files_len;
+    s->len = options->stripe_len ? options->stripe_len : stripes_default_len;
+    s->file = file;
+    s->files = options->stripe_files;
+
+    if (s->n > 1 && !s->files) {
+        ilka_fail("invalid nil stripe_files for '%s'", file);
+        return false;
+    }
+
+    if (s->len % ILKA_HUGE_PAGE_SIZE) {
+        ilka_fail("stripe_len must be a multiple of the huge page size: %p",
+                (void *) s->len);
+        return false;
+    }
+
+    return true;
+}
+
+static const char * stripes_file(const struct ilka_stripes *s, size_t i)
+{
+    return i ? s->files[i - 1] : s->file;
+}
+
+// Opens every stripe but the first which is the region file opened by the
+// caller.
+static bool stripes_open(
+        struct ilka_stripes *s, int fd, struct ilka_options *options)
+{
+    s->fds = calloc(s->n, sizeof(int));
+    if (!s->fds) {
+        ilka_fail("out-of-memory for stripe fds: %lu", s->n);
+        return false;
+    }
+
+    s->fds[0] = fd;
+    for (size_t i = 1; i < s->n; ++i) {
+        if ((s->fds[i] = file_open(stripes_file(s, i), options)) != -1) continue;
+
+        while (--i) file_close(s->fds[i]);
+        free(s->fds);
+        return false;
+    }
+
+    return true;
+}
+
+static bool stripes_close(struct ilka_stripes *s)
+{
+    bool ret = true;
+    for (size_t i = 1; i < s->n; ++i) ret = file_close(s->fds[i]) && ret;
+    free(s->fds);
+    return ret;
+}
+
+// Returns the stripe and the file offset of off along with the number of bytes
+// left in its chunk.
+static size_t stripes_locate(
+        const struct ilka_stripes *s, ilka_off_t off, size_t *i, ilka_off_t *file_off)
+{
+    if (s->n == 1) {
+        *i = 0;
+        *file_off = off;
+        return -1UL - off;
+    }
+
+    size_t chunk = off / s->len;
+    size_t rem = off % s->len;
+
+    *i = chunk % s->n;
+    *file_off = (chunk / s->n) * s->len + rem;
+    return s->len - rem;
+}
+
+// Length of stripe i when the region is len bytes long.
+static size_t stripes_file_len(const struct ilka_stripes *s, size_t i, size_t len)
+{
+    if (s->n == 1) return len;
+
+    size_t chunks = len / s->len;
+    size_t file_len = (chunks / s->n) * s->len;
+
+    size_t rem = chunks % s->n;
+    if (i < rem) file_len += s->len;
+    else if (i == rem) file_len += len % s->len;
+
+    return file_len;
+}
+
+// Length of the region covered by stripe i when it's file_len bytes long.
+static size_t stripes_region_len(
+        const struct ilka_stripes *s, size_t i, size_t file_len)
+{
+    if (s->n == 1 || !file_len) return file_len;
+
+    size_t last = file_len - 1;
+    size_t chunk = (last / s->len) * s->n + i;
+    return chunk * s->len + (last % s->len) + 1;
+}
+
+// Grows the stripes to cover at least len bytes and returns the length of the
+// region which can be longer if the stripes already cover more.
+static ssize_t stripes_grow(struct ilka_stripes *s, size_t len)
+{
+    if (s->n == 1) return file_grow(s->fds[0], len);
+
+    size_t region_len = len;
+    for (size_t i = 0; i < s->n; ++i) {
+        ssize_t flen = file_len(s->fds[i]);
+        if (flen == -1) return -1;
+
+        size_t end = stripes_region_len(s, i, flen);
+        if (end > region_len) region_len = end;
+    }
+
+    for (size_t i = 0; i < s->n; ++i) {
+        if (file_grow(s->fds[i], stripes_file_len(s, i, region_len)) == -1)
+            return -1;
+    }
+
+    return region_len;
+}
+
+static bool stripes_truncate(struct ilka_stripes *s, size_t len)
+{
+    for (size_t i = 0; i < s->n; ++i) {
+        if (!file_truncate(s->fds[i], stripes_file_len(s, i, len))) return false;
+    }
+    return true;
+}
+
+static bool stripes_alloc(struct ilka_stripes *s, size_t old_len, size_t len)
+{
+    for (size_t i = 0; i < s->n; ++i) {
+        size_t start = stripes_file_len(s, i, old_len);
+        size_t end = stripes_file_len(s, i, len);
+        if (end > start && !file_alloc(s->fds[i], start, end - start)) return false;
+    }
+    return true;
+}
+
+static bool stripes_punch(struct ilka_stripes *s, ilka_off_t off, size_t len)
+{
+    while (len) {
+        size_t i;
+        ilka_off_t file_off;
+        size_t n = stripes_locate(s, off, &i, &file_off);
+        if (n > len) n = len;
+
+        if (!file_punch(s->fds[i], file_off, n)) return false;
+
+        off += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+static bool stripes_rm(const struct ilka_stripes *s)
+{
+    bool ret = true;
+    for (size_t i = 1; i < s->n; ++i) ret = file_rm(stripes_file(s, i)) && ret;
+    return ret;
+}
@@ -25,7 +25,7 @@ struct journal_node
 struct ilka_journal
 {
     struct ilka_region *region;
-    const char *file;
+    const struct ilka_stripes *stripes;
     char *journal_file;
 
     struct journal_node *nodes;
@@ -53,20 +53,91 @@ static char * journal_get_file(const char* file)
 }
 
 
+// -----------------------------------------------------------------------------
+// stripes
+// -----------------------------------------------------------------------------
+
+// Stripes are usually spread over multiple devices so each stripe is written
+// by its own thread. Errors are carried back to the calling thread.
+struct journal_task
+{
+    const struct ilka_stripes *stripes;
+    size_t stripe;
+    void *data;
+
+    bool ret;
+    struct ilka_error err;
+};
+
+static bool journal_parallel(
+        const struct ilka_stripes *s, void * (*fn) (void *), void *data)
+{
+    struct journal_task *tasks = calloc(s->n, sizeof(struct journal_task));
+    if (!tasks) {
+        ilka_fail("out-of-memory for journal tasks: %lu", s->n);
+        return false;
+    }
+
+    for (size_t i = 0; i < s->n; ++i)
+        tasks[i] = (struct journal_task) { .stripes = s, .stripe = i, .data = data };
+
+    bool ret = true;
+    size_t started = 0;
+    pthread_t *threads = NULL;
+
+    if (s->n == 1) {
+        fn(&tasks[0]);
+        started = 1;
+        goto done;
+    }
+
+    threads = calloc(s->n, sizeof(pthread_t));
+    if (!threads) {
+        ilka_fail("out-of-memory for journal threads: %lu", s->n);
+        ret = false;
+        goto done;
+    }
+
+    for (; started < s->n; ++started) {
+        int err = pthread_create(&threads[started], NULL, fn, &tasks[started]);
+        if (err) {
+            ilka_fail_ierrno(err, "unable to pthread_create journal thread");
+            ret = false;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+    free(threads);
+
+  done:
+    for (size_t i = 0; ret && i < started; ++i) {
+        if (tasks[i].ret) continue;
+        ilka_err = tasks[i].err;
+        ret = false;
+    }
+
+    free(tasks);
+    return ret;
+}
+
+
 // -----------------------------------------------------------------------------
 // basics
 // -----------------------------------------------------------------------------
 
 static bool journal_init(
-        struct ilka_journal *j, struct ilka_region *r, const char* file)
+        struct ilka_journal *j,
+        struct ilka_region *r,
+        const struct ilka_stripes *stripes)
 {
     memset(j, 0, sizeof(struct ilka_journal));
 
     j->region = r;
-    j->file = file;
+    j->stripes = stripes;
     j->cap = journal_min_size;
 
-    j->journal_file = journal_get_file(file);
+    j->journal_file = journal_get_file(stripes->file);
     if (!j->journal_file) goto fail_journal;
 
     j->nodes = calloc(j->cap, sizeof(struct journal_node));
@@ -101,9 +172,9 @@ static bool journal_add(struct ilka_journal *j, ilka_off_t off, size_t len)
         j->nodes = new;
     }
 
-    struct journal_node *prev = &j->nodes[j->len - 1];
+    struct journal_node *prev = j->len ? &j->nodes[j->len - 1] : NULL;
 
-    if (prev->off + prev->len == off)
+    if (prev && prev->off + prev->len == off)
         prev->len += len;
     else {
         j->nodes[j->len] = (struct journal_node) { off, len };
@@ -180,45 +251,71 @@ static bool journal_write_log(struct ilka_journal *j)
     return false;
 }
 
-static bool journal_write_region(struct ilka_journal *j)
+// Writes the pieces of the journaled ranges that live in the task's stripe.
+static void * journal_write_stripe(void *data)
 {
-    int fd = open(j->file, O_WRONLY);
+    struct journal_task *task = data;
+    struct ilka_journal *j = task->data;
+    const struct ilka_stripes *s = task->stripes;
+    const char *file = stripes_file(s, task->stripe);
+
+    int fd = open(file, O_WRONLY);
     if (fd == -1) {
-        ilka_fail_errno("unable to open region: %s", j->file);
-        return false;
+        ilka_fail_errno("unable to open region: %s", file);
+        goto fail_open;
     }
 
     for (size_t i = 0; i < j->len; ++i) {
         struct journal_node *node = &j->nodes[i];
-        const void *ptr = ilka_read_sys(j->region, node->off, node->len);
 
-        ssize_t ret = pwrite(fd, ptr, node->len, node->off);
-        if (ret == -1) {
-            ilka_fail_errno("unable to write to region");
-            goto fail;
-        }
+        for (size_t pos = 0; pos < node->len;) {
+            size_t stripe;
+            ilka_off_t file_off;
+            size_t len = stripes_locate(s, node->off + pos, &stripe, &file_off);
+            if (len > node->len - pos) len = node->len - pos;
+
+            if (stripe == task->stripe) {
+                const void *ptr = ilka_read_sys(j->region, node->off + pos, len);
+
+                ssize_t ret = pwrite(fd, ptr, len, file_off);
+                if (ret == -1) {
+                    ilka_fail_errno("unable to write to region: %s", file);
+                    goto fail;
+                }
+
+                if ((size_t) ret != len) {
+                    ilka_fail("incomplete write to region: %lu != %lu", ret, len);
+                    goto fail;
+                }
+            }
 
-        if ((size_t) ret != node->len) {
-            ilka_fail("incomplete write to region: %lu != %lu", ret, node->len);
-            goto fail;
+            pos += len;
         }
     }
 
     if (fdatasync(fd) == -1) {
-        ilka_fail_errno("unable to fsync region: %s", j->file);
+        ilka_fail_errno("unable to fsync region: %s", file);
         goto fail;
     }
 
     if (close(fd) == -1) {
-        ilka_fail_errno("unable to close region: %s", j->file);
-        return false;
+        ilka_fail_errno("unable to close region: %s", file);
+        goto fail_open;
     }
 
-    return true;
+    task->ret = true;
+    return NULL;
 
   fail:
     close(fd);
-    return false;
+  fail_open:
+    task->err = ilka_err;
+    return NULL;
+}
+
+static bool journal_write_region(struct ilka_journal *j)
+{
+    return journal_parallel(j->stripes, journal_write_stripe, j);
 }
 
 static bool journal_finish(struct ilka_journal *j)
@@ -265,18 +362,13 @@ static int journal_check(const char *file)
         ilka_fail_errno("unable to read from journal");
         goto fail;
     }
-    else if ((size_t) ret != len) {
+    else if ((size_t) ret != sizeof(magic)) {
         ilka_fail("incomplete read from journal: %lu != %lu", ret, sizeof(magic));
         goto fail;
     }
 
     if (magic != journal_magic) goto bad_file;
 
-    if (lseek(fd, 0, SEEK_SET) == -1) {
-        ilka_fail_errno("unable to seek journal: %s", file);
-        goto fail;
-    }
-
     return fd;
 
   bad_file:
@@ -289,9 +381,11 @@ static int journal_check(const char *file)
     return -1;
 }
 
-static bool journal_read(int fd, void *ptr, size_t len)
+// The journal is shared by the stripe threads so it's read at an explicit
+// offset.
+static bool journal_read(int fd, void *ptr, size_t len, off_t off)
 {
-    ssize_t ret = read(fd, ptr, len);
+    ssize_t ret = pread(fd, ptr, len, off);
     if (ret == -1) {
         ilka_fail_errno("unable to read from journal");
         return false;
@@ -303,55 +397,73 @@ static bool journal_read(int fd, void *ptr, size_t len)
     return true;
 }
 
-static bool journal_recover(const char *file)
+// Replays the pieces of the journal that live in the task's stripe while
+// skipping over the others.
+static void * journal_recover_stripe(void *data)
 {
-    void *buf = NULL;
-
-    char *journal_file = journal_get_file(file);
-    int journal_fd = journal_check(journal_file);
-    if (journal_fd == -1) goto fail;
-    if (!journal_fd) goto done;
+    struct journal_task *task = data;
+    int journal_fd = *((int *) task->data);
+    const struct ilka_stripes *s = task->stripes;
+    const char *file = stripes_file(s, task->stripe);
 
     int region_fd = open(file, O_WRONLY);
     if (region_fd == -1) {
         ilka_fail_errno("unable to open region: %s", file);
-        goto fail;
+        goto fail_open;
     }
 
-    struct journal_node node = {0, 0};
-
     size_t cap = ILKA_PAGE_SIZE;
-    buf = malloc(cap);
+    void *buf = malloc(cap);
     if (!buf) {
         ilka_fail("out-of-memory recover buffer: %lu", cap);
-        goto fail;
+        goto fail_buf;
     }
 
+    off_t journal_off = 0;
+    struct journal_node node = {0, 0};
+
     while (true) {
-        if (!journal_read(journal_fd, &node, sizeof(node))) goto fail;
+        if (!journal_read(journal_fd, &node, sizeof(node), journal_off)) goto fail;
+        journal_off += sizeof(node);
         if (node.off == 0 && node.len == 0) break;
 
-        if (cap < node.len) {
-            free(buf);
-            cap = node.len;
-            buf = malloc(cap);
-            if (!buf) {
-                ilka_fail("out-of-memory recover buffer: %lu", cap);
-                goto fail;
+        for (size_t pos = 0; pos < node.len;) {
+            size_t stripe;
+            ilka_off_t file_off;
+            size_t len = stripes_locate(s, node.off + pos, &stripe, &file_off);
+            if (len > node.len - pos) len = node.len - pos;
+
+            if (stripe != task->stripe) {
+                pos += len;
+                continue;
             }
-        }
 
-        if (!journal_read(journal_fd, buf, node.len)) goto fail;
+            if (cap < len) {
+                free(buf);
+                cap = len;
+                buf = malloc(cap);
+                if (!buf) {
+                    ilka_fail("out-of-memory recover buffer: %lu", cap);
+                    goto fail_buf;
+                }
+            }
 
-        ssize_t ret = pwrite(region_fd, buf, node.len, node.off);
-        if (ret == -1) {
-            ilka_fail_errno("unable to write to region: %s", file);
-            goto fail;
-        }
-        if ((size_t) ret != node.len) {
-            ilka_fail("incomplete write to region: %lu != %lu", ret, node.len);
-            goto fail;
+            if (!journal_read(journal_fd, buf, len, journal_off + pos)) goto fail;
+
+            ssize_t ret = pwrite(region_fd, buf, len, file_off);
+            if (ret == -1) {
+                ilka_fail_errno("unable to write to region: %s", file);
+                goto fail;
+            }
+            if ((size_t) ret != len) {
+                ilka_fail("incomplete write to region: %lu != %lu", ret, len);
+                goto fail;
+            }
+
+            pos += len;
         }
+
+        journal_off += node.len;
     }
 
     free(buf);
@@ -359,16 +471,43 @@ static bool journal_recover(const char *file)
     if (fdatasync(region_fd) == -1) ilka_fail_errno("unable to fsync region: %s", file);
     if (close(region_fd) == -1) ilka_fail_errno("unable to close region: %s", file);
 
+    task->ret = true;
+    return NULL;
+
+  fail:
+    free(buf);
+  fail_buf:
+    close(region_fd);
+  fail_open:
+    task->err = ilka_err;
+    return NULL;
+}
+
+static bool journal_recover(const char *file, struct ilka_options *options)
+{
+    struct ilka_stripes stripes;
+    if (!stripes_init(&stripes, file, options)) return false;
+
+    char *journal_file = journal_get_file(file);
+    if (!journal_file) return false;
+
+    int journal_fd = journal_check(journal_file);
+    if (journal_fd == -1) goto fail;
+    if (!journal_fd) goto done;
+
+    if (!journal_parallel(&stripes, journal_recover_stripe, &journal_fd)) {
+        close(journal_fd);
+        goto fail;
+    }
+
     if (close(journal_fd) == -1) ilka_fail_errno("unable to close journal: %s", journal_file);
     if (unlink(journal_file) == -1) ilka_fail_errno("unable to unlink journal: %s", journal_file);
 
   done:
-    if (buf) free(buf);
     free(journal_file);
     return true;
 
   fail:
-    if (buf) free(buf);
     free(journal_file);
     return false;
 }
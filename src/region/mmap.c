@@ -3,6 +3,22 @@
    FreeBSD-style copyright and disclaimer apply
 */
 
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+// Every vma is mapped in multiples of a slot and always starts on a slot
+// boundary which means that a slot can never straddle two vmas. The offset to
+// pointer translation is then a single lookup in a flat directory of slots.
+//
+// Slots are also the size of a huge page so that every vma is aligned to
+// a huge page boundary.
+static const size_t mmap_slot_bits = 21;
+static const size_t mmap_slot_len = ILKA_HUGE_PAGE_SIZE;
+
+static const size_t mmap_dir_min_cap = 64;
+
+
 // -----------------------------------------------------------------------------
 // structs
 // -----------------------------------------------------------------------------
@@ -15,26 +31,243 @@ struct mmap_node
     struct mmap_node *next;
 };
 
+struct mmap_pin
+{
+    ilka_off_t off;
+    size_t len;
+    struct mmap_pin *next;
+};
+
+struct mmap_dir
+{
+    size_t cap;
+    struct mmap_dir *prev;
+
+    uint8_t *slots[];
+};
+
 struct ilka_mmap
 {
-    int fd;
+    struct ilka_stripes *stripes;
     int prot, flags;
     size_t reserved;
 
+    bool load;
+    bool thp;
+
     void *anon;
     size_t anon_len;
 
-    struct mmap_node head;
+    size_t len;
+    size_t cap;
+
+    uint8_t *base;
+    size_t base_len;
+
+    struct mmap_dir *dir;
 
     struct mmap_node *vmas;
     struct mmap_node *last_vma;
+
+    ilka_slock pin_lock;
+    struct mmap_pin *pins;
 };
 
 
+// -----------------------------------------------------------------------------
+// dir
+// -----------------------------------------------------------------------------
+
+static inline size_t mmap_slot_ceil(size_t len)
+{
+    return ceil_div(len, mmap_slot_len) * mmap_slot_len;
+}
+
+static struct mmap_dir * mmap_dir_alloc(size_t cap)
+{
+    size_t len = sizeof(struct mmap_dir) + cap * sizeof(uint8_t *);
+
+    struct mmap_dir *dir = calloc(1, len);
+    if (!dir) {
+        ilka_fail("out-of-memory for mmap dir: %lu", len);
+        return NULL;
+    }
+
+    dir->cap = cap;
+    return dir;
+}
+
+static void mmap_dir_free(struct mmap_dir *dir)
+{
+    while (dir) {
+        struct mmap_dir *prev = dir->prev;
+        free(dir);
+        dir = prev;
+    }
+}
+
+// Readers can still be holding on to the old directory so it's only retired
+// and gets reclaimed on the next coalesce which happens while the world is
+// stopped.
+static bool mmap_dir_reserve(struct ilka_mmap *m, size_t slots)
+{
+    struct mmap_dir *old = m->dir;
+    if (old && slots <= old->cap) return true;
+
+    size_t cap = old ? old->cap : mmap_dir_min_cap;
+    while (cap < slots) cap *= 2;
+
+    struct mmap_dir *dir = mmap_dir_alloc(cap);
+    if (!dir) return false;
+
+    if (old) {
+        size_t n = m->cap >> mmap_slot_bits;
+        memcpy(dir->slots, old->slots, n * sizeof(uint8_t *));
+        dir->prev = old;
+    }
+
+    // morder_release: make sure the directory is fully copied before it's
+    // published.
+    ilka_atomic_store(&m->dir, dir, morder_release);
+    return true;
+}
+
+static void mmap_dir_set(struct ilka_mmap *m, size_t off, uint8_t *ptr, size_t len)
+{
+    for (size_t i = 0; i < len; i += mmap_slot_len)
+        m->dir->slots[(off + i) >> mmap_slot_bits] = ptr + i;
+}
+
+static bool mmap_dir_is_contiguous(
+        struct mmap_dir *dir, ilka_off_t first, ilka_off_t last)
+{
+    for (size_t i = first; i < last; ++i) {
+        if (dir->slots[i] + mmap_slot_len != dir->slots[i + 1]) return false;
+    }
+    return true;
+}
+
+
 // -----------------------------------------------------------------------------
 // utils
 // -----------------------------------------------------------------------------
 
+// Anonymous mapping aligned on a slot boundary which is required for the
+// kernel to back the vmas with huge pages.
+static void * mmap_reserve(size_t len, int prot)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    uint8_t *ptr = mmap(NULL, len + mmap_slot_len, prot, flags, -1, 0);
+    if (ptr == MAP_FAILED) {
+        ilka_fail_errno("unable to reserve '%p' bytes", (void *) len);
+        return NULL;
+    }
+
+    uint8_t *start = (uint8_t *) mmap_slot_ceil((uintptr_t) ptr);
+    uint8_t *end = ptr + len + mmap_slot_len;
+
+    if (start != ptr) munmap(ptr, start - ptr);
+    if (end != start + len) munmap(start + len, end - (start + len));
+
+    return start;
+}
+
+// Loaded regions are never striped.
+static bool mmap_load(struct ilka_mmap *m, uint8_t *ptr, ilka_off_t off, size_t len)
+{
+    int fd = m->stripes->fds[0];
+
+    ssize_t file = file_len(fd);
+    if (file == -1) return false;
+    if ((size_t) file <= off) return true;
+    if ((size_t) file < off + len) len = file - off;
+
+    while (len) {
+        ssize_t ret = pread(fd, ptr, len, off);
+        if (ret == -1) {
+            if (errno == EINTR) continue;
+            ilka_fail_errno("unable to load region at '%p' for length '%p'",
+                    (void *) off, (void *) len);
+            return false;
+        }
+        if (!ret) {
+            ilka_fail("unexpected eof loading region at '%p'", (void *) off);
+            return false;
+        }
+
+        ptr += ret;
+        off += ret;
+        len -= ret;
+    }
+
+    return true;
+}
+
+// Maps every stripe chunk of the range in place.
+static void * mmap_stripes(struct ilka_mmap *m, uint8_t *addr, ilka_off_t off, size_t len)
+{
+    int flags = m->flags | MAP_FIXED;
+
+    for (size_t i = 0; i < len;) {
+        size_t stripe;
+        ilka_off_t file_off;
+        size_t n = stripes_locate(m->stripes, off + i, &stripe, &file_off);
+        if (n > len - i) n = len - i;
+
+        int fd = m->stripes->fds[stripe];
+        if (mmap(addr + i, n, m->prot, flags, fd, file_off) == MAP_FAILED) {
+            ilka_fail_errno("unable to mmap stripe '%lu' at '%p' for length '%p'",
+                    stripe, (void *) file_off, (void *) n);
+            return NULL;
+        }
+
+        i += n;
+    }
+
+    return addr;
+}
+
+// Either maps the file directly or, when the region is loaded, copies its
+// content into anonymous memory which allows the kernel to back it with huge
+// pages.
+static void * mmap_file(struct ilka_mmap *m, void *addr, ilka_off_t off, size_t len)
+{
+    int flags = m->flags | MAP_FIXED;
+    if (!m->load) {
+        void *ptr = mmap_stripes(m, addr, off, len);
+        if (!ptr) return NULL;
+
+        if (m->thp && madvise(ptr, len, MADV_HUGEPAGE) == -1)
+            ilka_fail_errno("unable to madvise huge pages: %p", ptr);
+
+        return ptr;
+    }
+
+    void *ptr = mmap(addr, len, PROT_READ | PROT_WRITE, flags | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) goto fail;
+
+    if (m->thp && madvise(ptr, len, MADV_HUGEPAGE) == -1)
+        ilka_fail_errno("unable to madvise huge pages: %p", ptr);
+
+    if (!mmap_load(m, ptr, off, len)) goto fail_load;
+
+    if (m->prot != (PROT_READ | PROT_WRITE) && mprotect(ptr, len, m->prot) == -1) {
+        ilka_fail_errno("unable to mprotect '%p'", ptr);
+        goto fail_load;
+    }
+
+    return ptr;
+
+  fail_load:
+    munmap(ptr, len);
+    return NULL;
+
+  fail:
+    ilka_fail_errno("unable to mmap '%p' at '%p' for length '%p'",
+            addr, (void *) off, (void *) len);
+    return NULL;
+}
+
 static void * mmap_map(struct ilka_mmap *m, ilka_off_t off, size_t len)
 {
     if (m->anon && munmap(m->anon, m->anon_len) == -1) {
@@ -43,18 +276,11 @@ static void * mmap_map(struct ilka_mmap *m, ilka_off_t off, size_t len)
     }
 
     m->anon_len = len + m->reserved;
-    m->anon = mmap(NULL, m->anon_len, m->prot, MAP_ANON | MAP_PRIVATE, -1, 0);
-    if (m->anon == MAP_FAILED) {
-        ilka_fail_errno("unable to mmap anon: %p", ((void *) m->anon_len));
-        return NULL;
-    }
+    m->anon = mmap_reserve(m->anon_len, m->prot);
+    if (!m->anon) return NULL;
 
-    void *ptr = mmap(m->anon, len, m->prot, m->flags | MAP_FIXED, m->fd, off);
-    if (ptr == MAP_FAILED) {
-        ilka_fail_errno("unable to mmap '%p' at '%p' for length '%p'",
-                ptr, (void *) off, (void *) len);
-        return NULL;
-    }
+    void *ptr = mmap_file(m, m->anon, off, len);
+    if (!ptr) return NULL;
 
     struct mmap_node *vma = calloc(1, sizeof(struct mmap_node));
     *vma = (struct mmap_node) { .ptr = ptr, .len = len };
@@ -68,12 +294,13 @@ static void * mmap_map(struct ilka_mmap *m, ilka_off_t off, size_t len)
     return ptr;
 }
 
-static int mmap_expand(
-        struct ilka_mmap *m, void *ptr, size_t old_len, size_t new_len)
+static int mmap_expand(struct ilka_mmap *m, size_t diff)
 {
-    size_t diff = new_len - old_len;
     if (diff > m->anon_len) return false;
 
+    // hugetlb vmas can't be resized.
+    if (m->flags & MAP_HUGETLB) return false;
+
     // This has a potential race condition where a mapping takes the freed-up
     // anon slot before we can remap. Sadly you can't MREMAP_FIXED without
     // moving the region so there's no good alternative that aren't racy as
@@ -89,52 +316,150 @@ static int mmap_expand(
     m->anon_len -= diff;
     m->anon = m->anon_len ? ((uint8_t *) m->anon) + diff : NULL;
 
-    // Since our current node might be a composite of multiple vmas, we only
-    // specify the last page of the node and the let the kernel figure out which
+    // Since our last vma might be a composite of multiple kernel vmas, we only
+    // specify the last page of the vma and the let the kernel figure out which
     // vma it belongs to and adjust the values accordingly.
-    void *last_page = ((uint8_t *) ptr ) + old_len - ILKA_PAGE_SIZE;
+    struct mmap_node *vma = m->last_vma;
+    void *last_page = ((uint8_t *) vma->ptr ) + vma->len - ILKA_PAGE_SIZE;
     size_t adj_old_len = ILKA_PAGE_SIZE;
     size_t adj_new_len = diff + ILKA_PAGE_SIZE;
 
     if (mremap(last_page, adj_old_len, adj_new_len, 0) != MAP_FAILED) {
-        m->last_vma->len += diff;
+        vma->len += diff;
         return 1;
     }
     if (errno == ENOMEM) return 0;
 
     ilka_fail_errno("unable to remap '%p' from '%p' to '%p'",
-            ptr, (void*) old_len, (void*) new_len);
+            vma->ptr, (void*) vma->len, (void*) (vma->len + diff));
     return -1;
 }
 
 
+// -----------------------------------------------------------------------------
+// fixed
+// -----------------------------------------------------------------------------
+
+// When a max_len is provided, the entire address range is reserved up-front
+// and the file is mapped in place as the region grows. The region never moves
+// and there's never anything to coalesce.
+
+static bool mmap_fixed_map(struct ilka_mmap *m, ilka_off_t off, size_t len)
+{
+    if (off + len > m->base_len) {
+        ilka_fail("region exceeds max_len: %p + %p > %p",
+                (void *) off, (void *) len, (void *) m->base_len);
+        return false;
+    }
+
+    return mmap_file(m, m->base + off, off, len) != NULL;
+}
+
+static bool mmap_fixed_init(struct ilka_mmap *m, size_t len, size_t max_len)
+{
+    m->base_len = mmap_slot_ceil(max_len);
+
+    m->base = mmap_reserve(m->base_len, PROT_NONE);
+    if (!m->base) return false;
+
+    size_t cap = mmap_slot_ceil(len);
+    if (!mmap_fixed_map(m, 0, cap)) {
+        munmap(m->base, m->base_len);
+        return false;
+    }
+
+    m->cap = cap;
+    m->len = len;
+    return true;
+}
+
+
 // -----------------------------------------------------------------------------
 // basics
 // -----------------------------------------------------------------------------
 
 static bool mmap_init(
-        struct ilka_mmap *m, int fd, size_t len, struct ilka_options *options)
+        struct ilka_mmap *m,
+        struct ilka_stripes *stripes,
+        size_t len,
+        struct ilka_options *options)
 {
     memset(m, 0, sizeof(struct ilka_mmap));
-    m->fd = fd;
+    m->stripes = stripes;
+    slock_init(&m->pin_lock);
 
     m->reserved = options->vma_reserved ? options->vma_reserved : 1 << (12 + 10);
 
     m->prot = PROT_READ;
     if (!options->read_only) m->prot |= PROT_WRITE;
 
+    bool huge = options->huge_tlb || options->huge_pages;
+    if (options->persist_engine == ilka_persist_shared && !options->in_memory && huge) {
+        ilka_fail("huge pages are not supported by the shared persist engine");
+        return false;
+    }
+
+    // in-memory regions are never saved so there's no point in making private
+    // copies of the memfd pages.
     m->flags = MAP_PRIVATE;
-    if (options->huge_tlb) m->flags |= MAP_HUGETLB;
+    if (options->persist_engine == ilka_persist_shared) m->flags = MAP_SHARED;
+    if (options->multi_process) m->flags = MAP_SHARED;
+    if (options->in_memory && !huge) m->flags = MAP_SHARED;
     if (options->populate) m->flags |= MAP_POPULATE;
 
-    m->head.len = len;
-    m->head.ptr = mmap_map(m, 0, len);
+    // hugetlb pages can't back a file mapping on a regular filesystem and
+    // transparent huge pages are only reliably used for anonymous memory so
+    // in both cases the region is loaded in anonymous memory.
+    if (options->huge_tlb) {
+        m->load = true;
+        m->flags |= MAP_HUGETLB;
+    }
+    else if (options->huge_pages) {
+        m->load = true;
+        m->thp = true;
+    }
+
+    // The region is grown by other processes so the entire reservation is
+    // mapped up-front which is fine as long as nothing past the end of the
+    // file is accessed.
+    if (options->multi_process)
+        return mmap_fixed_init(m, options->max_len, options->max_len);
+
+    if (options->max_len) return mmap_fixed_init(m, len, options->max_len);
+
+    size_t cap = mmap_slot_ceil(len);
+    if (!mmap_dir_reserve(m, cap >> mmap_slot_bits)) return false;
+
+    uint8_t *ptr = mmap_map(m, 0, cap);
+    if (!ptr) {
+        mmap_dir_free(m->dir);
+        return false;
+    }
 
-    return m->head.ptr != NULL;
+    mmap_dir_set(m, 0, ptr, cap);
+    m->cap = cap;
+    m->len = len;
+
+    return true;
 }
 
 static bool mmap_close(struct ilka_mmap *m)
 {
+    struct mmap_pin *pin = m->pins;
+    while (pin) {
+        struct mmap_pin *next = pin->next;
+        free(pin);
+        pin = next;
+    }
+
+    if (m->base) {
+        if (munmap(m->base, m->base_len) != -1) return true;
+
+        ilka_fail_errno("unable to unmap '%p' with length '%p'",
+                m->base, (void *) m->base_len);
+        return false;
+    }
+
     struct mmap_node *node = m->vmas;
     while (node) {
         if (munmap(node->ptr, node->len) == -1) {
@@ -143,85 +468,196 @@ static bool mmap_close(struct ilka_mmap *m)
             return false;
         }
 
-        struct mmap_node *next = node->next;
-        if (node != &m->head) free(node);
-        node = next;
-    } while (node);
-
-    node = m->head.next;
-    while (node) {
         struct mmap_node *next = node->next;
         free(node);
         node = next;
     }
 
+    mmap_dir_free(m->dir);
     return true;
 }
 
 
 // -----------------------------------------------------------------------------
-// interface
+// span
 // -----------------------------------------------------------------------------
 
-static bool mmap_remap(struct ilka_mmap *m, size_t old, size_t new)
+// Translates the longest prefix of the range that is contiguous in memory.
+static uint8_t * mmap_span(
+        struct ilka_mmap *m, ilka_off_t off, size_t len, size_t *span)
 {
-    size_t off = 0;
-    struct mmap_node *node = &m->head;
-
-    while (node->next) {
-        off += node->len;
-        node = node->next;
+    if (m->base) {
+        *span = len;
+        return m->base + off;
     }
-    ilka_assert(off + node->len == old, "inconsistent size: %p + %p != %p",
-            (void *) off, (void *) node->len, (void *) old);
 
-    int ret = mmap_expand(m, node->ptr, node->len, new - off);
-    if (ret == -1) return false;
-    if (ret) {
-        node->len = new - off;
-        return true;
-    }
+    size_t slot_end = (off | (mmap_slot_len - 1)) + 1;
+    *span = off + len > slot_end ? slot_end - off : len;
 
-    off += node->len;
+    struct mmap_dir *dir = ilka_atomic_load(&m->dir, morder_relaxed);
+    return dir->slots[off >> mmap_slot_bits] + (off & (mmap_slot_len - 1));
+}
 
-    struct mmap_node *tail = calloc(1, sizeof(struct mmap_node));
-    if (!tail) {
-        ilka_fail("out-of-memory for new remap node");
+static bool mmap_madvise(struct ilka_mmap *m, ilka_off_t off, size_t len, int advice)
+{
+    // morder_acquire: synchronizes with mmap_commit to ensure that the
+    // directory covers the range before we index into it.
+    size_t end = ilka_atomic_load(&m->len, morder_acquire);
+    if (off + len > end) {
+        ilka_fail("out-of-bounds madvise: %p + %p", (void *) off, (void *) len);
         return false;
     }
 
-    tail->len = new - off;
-    tail->ptr = mmap_map(m, off, tail->len);
-    if (!tail->ptr) goto fail;
+    len += off & (ILKA_PAGE_SIZE - 1);
+    off &= ~(ILKA_PAGE_SIZE - 1);
+
+    while (len) {
+        size_t n;
+        uint8_t *ptr = mmap_span(m, off, len, &n);
+
+        if (madvise(ptr, n, advice) == -1) {
+            ilka_fail_errno("unable to madvise '%p' for length '%p'",
+                    ptr, (void *) n);
+            return false;
+        }
 
-    ilka_atomic_store(&node->next, tail, morder_release);
+        off += n;
+        len -= n;
+    }
 
     return true;
+}
 
-  fail:
-    free(tail);
-    return false;
+static bool mmap_mlock(struct ilka_mmap *m, ilka_off_t off, size_t len)
+{
+    len += off & (ILKA_PAGE_SIZE - 1);
+    off &= ~(ILKA_PAGE_SIZE - 1);
+
+    while (len) {
+        size_t n;
+        uint8_t *ptr = mmap_span(m, off, len, &n);
+
+        if (mlock(ptr, n) == -1) {
+            ilka_fail_errno("unable to mlock '%p' for length '%p'",
+                    ptr, (void *) n);
+            return false;
+        }
+
+        off += n;
+        len -= n;
+    }
+
+    return true;
 }
 
-static bool mmap_coalesce(struct ilka_mmap *m)
+// mremap carries the lock over to the new mapping but the pins are re-applied
+// to guarantee that they're still resident once we resume the world.
+static void mmap_repin(struct ilka_mmap *m)
 {
-    if (!m->head.next) return true;
+    slock_lock(&m->pin_lock);
 
-    size_t len = 0;
-    struct mmap_node *node = &m->head;
+    for (struct mmap_pin *pin = m->pins; pin; pin = pin->next)
+        mmap_mlock(m, pin->off, pin->len);
 
-    do {
-        len += node->len;
-        node = node->next;
-    } while (node);
+    slock_unlock(&m->pin_lock);
+}
 
-    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
-    uint8_t *ptr = mmap(NULL, len + m->reserved, 0, flags, 0, 0);
-    if (ptr == MAP_FAILED) {
-        ilka_fail_errno("unable to create anonymous mapping");
-        return false;
+
+// -----------------------------------------------------------------------------
+// interface
+// -----------------------------------------------------------------------------
+
+// Maps enough of the file to grow the region by len bytes and returns the
+// offset of the grown range or 0 on error. The new length must be committed via
+// mmap_commit.
+static ilka_off_t mmap_remap(struct ilka_mmap *m, size_t len)
+{
+    ilka_off_t off = m->len;
+    if (off + len <= m->cap) return off;
+
+    size_t cap = mmap_slot_ceil(off + len);
+    size_t diff = cap - m->cap;
+
+    if (m->base) {
+        if (!mmap_fixed_map(m, m->cap, diff)) return 0;
+        m->cap = cap;
+        return off;
+    }
+
+    if (!mmap_dir_reserve(m, mmap_slot_ceil(m->cap + len) >> mmap_slot_bits))
+        return 0;
+
+    int ret = mmap_expand(m, diff);
+    if (ret == -1) return 0;
+    if (ret) {
+        uint8_t *ptr = m->dir->slots[(m->cap >> mmap_slot_bits) - 1];
+        mmap_dir_set(m, m->cap, ptr + mmap_slot_len, diff);
+        m->cap = cap;
+        return off;
     }
 
+    // A grown range must be contiguous so it can't straddle two vmas which
+    // means that whatever is left at the end of the last vma is skipped.
+    off = m->cap;
+    cap = mmap_slot_ceil(off + len);
+    diff = cap - m->cap;
+
+    uint8_t *ptr = mmap_map(m, m->cap, diff);
+    if (!ptr) return 0;
+    mmap_dir_set(m, m->cap, ptr, diff);
+    m->cap = cap;
+
+    return off;
+}
+
+static void mmap_commit(struct ilka_mmap *m, size_t len)
+{
+    // morder_release: ensure that the directory is fully updated before
+    // publishing the new length which allows it to be indexed.
+    ilka_atomic_store(&m->len, len, morder_release);
+}
+
+// Extends the mapping to a file that was grown by another process. Unlike
+// mmap_remap, the range can't skip over the end of the last vma as the offsets
+// are dictated by the file.
+static bool mmap_follow(struct ilka_mmap *m, size_t len)
+{
+    if (len > m->cap) {
+        size_t cap = mmap_slot_ceil(len);
+        size_t diff = cap - m->cap;
+
+        if (m->base) {
+            if (!mmap_fixed_map(m, m->cap, diff)) return false;
+        }
+        else {
+            if (!mmap_dir_reserve(m, cap >> mmap_slot_bits)) return false;
+
+            int ret = mmap_expand(m, diff);
+            if (ret == -1) return false;
+
+            uint8_t *ptr;
+            if (ret) ptr = m->dir->slots[(m->cap >> mmap_slot_bits) - 1] + mmap_slot_len;
+            else if (!(ptr = mmap_map(m, m->cap, diff))) return false;
+
+            mmap_dir_set(m, m->cap, ptr, diff);
+        }
+
+        m->cap = cap;
+    }
+
+    mmap_commit(m, len);
+    return true;
+}
+
+static bool mmap_coalesce(struct ilka_mmap *m)
+{
+    if (m->base || m->vmas == m->last_vma) return true;
+
+    size_t len = m->cap;
+
+    uint8_t *ptr = mmap_reserve(len + m->reserved, PROT_NONE);
+    if (!ptr) return false;
+
     if (m->anon && munmap(m->anon, m->anon_len) == -1) {
         ilka_fail_errno("unable to munmap anon");
         goto fail;
@@ -230,7 +666,7 @@ static bool mmap_coalesce(struct ilka_mmap *m)
     m->anon_len = m->reserved;
 
     size_t off = 0;
-    node = m->vmas;
+    struct mmap_node *node = m->vmas;
 
     do {
         int flags = MREMAP_MAYMOVE | MREMAP_FIXED;
@@ -246,13 +682,22 @@ static bool mmap_coalesce(struct ilka_mmap *m)
         node = node->next;
     } while (node);
 
-    node = m->head.next;
+    node = m->vmas->next;
     while (node) {
         struct mmap_node *next = node->next;
         free(node);
         node = next;
     }
-    m->head = (struct mmap_node) { ptr, len, NULL };
+    *m->vmas = (struct mmap_node) { ptr, len, NULL };
+    m->last_vma = m->vmas;
+
+    // The world is stopped so nobody can be holding on to any of the old
+    // directories which means we can safely reclaim them.
+    mmap_dir_free(m->dir->prev);
+    m->dir->prev = NULL;
+    mmap_dir_set(m, 0, ptr, len);
+
+    mmap_repin(m);
 
     return true;
 
@@ -263,43 +708,205 @@ static bool mmap_coalesce(struct ilka_mmap *m)
 
 static void * mmap_access(struct ilka_mmap *m, ilka_off_t off, size_t len)
 {
-    ilka_off_t off_rel = off;
-    struct mmap_node *node = &m->head;
+    // morder_acquire: synchronizes with mmap_remap to ensure that the
+    // directory covers the offset before we index into it.
+    size_t end = ilka_atomic_load(&m->len, morder_acquire);
+    ilka_debug_assert(off + len <= end,
+            "out-of-bounds access: %p + %p", (void *) off, (void *) len);
+
+    if (m->base) return m->base + off;
+
+    struct mmap_dir *dir = ilka_atomic_load(&m->dir, morder_relaxed);
+
+    size_t first = off >> mmap_slot_bits;
+    size_t last = (off + (len ? len - 1 : 0)) >> mmap_slot_bits;
+    ilka_debug_assert(
+            first == last || mmap_dir_is_contiguous(dir, first, last),
+            "invalid cross-map access: %p + %p", (void *) off, (void *) len);
+
+    return dir->slots[first] + (off & (mmap_slot_len - 1));
+}
+
+// Drops the pages of the range that aren't covered by any of the pins starting
+// from pin. MADV_DONTNEED fails on locked pages and pinned pages must stay
+// resident anyway. Must be called with the pin lock held.
+static bool mmap_drop(
+        struct ilka_mmap *m, struct mmap_pin *pin, ilka_off_t off, size_t len)
+{
+    for (; pin; pin = pin->next) {
+        ilka_off_t start = pin->off & ~(ILKA_PAGE_SIZE - 1);
+        ilka_off_t end = ceil_div(pin->off + pin->len, ILKA_PAGE_SIZE) * ILKA_PAGE_SIZE;
+        if (end <= off || start >= off + len) continue;
+
+        bool ret = true;
+        if (start > off) ret = mmap_drop(m, pin->next, off, start - off) && ret;
+        if (end < off + len) ret = mmap_drop(m, pin->next, end, off + len - end) && ret;
+        return ret;
+    }
+
+    return mmap_madvise(m, off, len, MADV_DONTNEED);
+}
+
+static bool mmap_drop_unpinned(struct ilka_mmap *m, ilka_off_t off, size_t len)
+{
+    slock_lock(&m->pin_lock);
+    bool ret = mmap_drop(m, m->pins, off, len);
+    slock_unlock(&m->pin_lock);
+    return ret;
+}
+
+// Drops the private copies of the pages in the range which are then faulted
+// back in from the file. Loaded regions have no file to fall back on.
+static void mmap_reclaim(struct ilka_mmap *m, ilka_off_t off, size_t len)
+{
+    if (m->load) return;
+    mmap_drop_unpinned(m, off, len);
+}
+
+static bool mmap_pin(struct ilka_mmap *m, ilka_off_t off, size_t len)
+{
+    // morder_acquire: synchronizes with mmap_commit to ensure that the
+    // directory covers the range before we index into it.
+    size_t end = ilka_atomic_load(&m->len, morder_acquire);
+    if (off + len > end) {
+        ilka_fail("out-of-bounds pin: %p + %p", (void *) off, (void *) len);
+        return false;
+    }
+
+    struct mmap_pin *pin = calloc(1, sizeof(struct mmap_pin));
+    if (!pin) {
+        ilka_fail("out-of-memory for mmap pin: %lu", sizeof(struct mmap_pin));
+        return false;
+    }
+    *pin = (struct mmap_pin) { .off = off, .len = len };
+
+    slock_lock(&m->pin_lock);
+
+    if (!mmap_mlock(m, off, len)) {
+        slock_unlock(&m->pin_lock);
+        free(pin);
+        return false;
+    }
+
+    pin->next = m->pins;
+    m->pins = pin;
+
+    slock_unlock(&m->pin_lock);
+    return true;
+}
+
+// Prefers node for the pages of the range and migrates the pages that are
+// already faulted in. The policy only applies to the private and anonymous
+// pages of the region; shared file pages are placed by the page cache.
+static bool mmap_bind(struct ilka_mmap *m, ilka_off_t off, size_t len, size_t node)
+{
+    // morder_acquire: synchronizes with mmap_commit to ensure that the
+    // directory covers the range before we index into it.
+    size_t end = ilka_atomic_load(&m->len, morder_acquire);
+    if (off + len > end) {
+        ilka_fail("out-of-bounds bind: %p + %p", (void *) off, (void *) len);
+        return false;
+    }
 
-    while (true) {
-        size_t rlen = ilka_atomic_load(&node->len, morder_relaxed);
+    const size_t mask_bits = sizeof(unsigned long) * 8;
+    unsigned long mask[node / mask_bits + 1];
+    memset(mask, 0, sizeof(mask));
+    mask[node / mask_bits] = 1UL << (node % mask_bits);
 
-        if (ilka_likely(off_rel < rlen)) {
-            ilka_assert(off_rel + len <= rlen,
-                    "invalid cross-map access: %p + %p > %p",
-                    (void *) off_rel, (void *) len, (void *) rlen);
+    len += off & (ILKA_PAGE_SIZE - 1);
+    off &= ~(ILKA_PAGE_SIZE - 1);
 
-            return ((uint8_t*) node->ptr) + off_rel;
+    while (len) {
+        size_t n;
+        uint8_t *ptr = mmap_span(m, off, len, &n);
+
+        // The kernel ignores the last bit of the mask hence the +1.
+        long ret = syscall(SYS_mbind, ptr, n, MPOL_PREFERRED,
+                mask, sizeof(mask) * 8 + 1, MPOL_MF_MOVE);
+        if (ret == -1) {
+            ilka_fail_errno("unable to mbind '%p' for length '%p' to node '%lu'",
+                    ptr, (void *) n, node);
+            return false;
         }
 
-        struct mmap_node *next = ilka_atomic_load(&node->next, morder_relaxed);
-        if (!next) {
-            ilka_fail("out-of-bounds access: %p + %p", (void *) off, (void *) len);
-            ilka_abort();
+        off += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+// Returns true if any page of the range is resident in memory.
+static bool mmap_resident(struct ilka_mmap *m, ilka_off_t off, size_t len)
+{
+    len += off & (ILKA_PAGE_SIZE - 1);
+    off &= ~(ILKA_PAGE_SIZE - 1);
+
+    while (len) {
+        size_t n;
+        uint8_t *ptr = mmap_span(m, off, len, &n);
+
+        unsigned char vec[ceil_div(n, ILKA_PAGE_SIZE)];
+        if (mincore(ptr, n, vec) == -1) {
+            ilka_fail_errno("unable to mincore '%p' for length '%p'",
+                    ptr, (void *) n);
+            return false;
         }
 
-        off_rel -= rlen;
-        node = next;
+        for (size_t i = 0; i < sizeof(vec); ++i) {
+            if (vec[i] & 1) return true;
+        }
+
+        off += n;
+        len -= n;
     }
+
+    return false;
 }
 
-static bool mmap_is_edge(struct ilka_mmap *m, ilka_off_t off)
+// Drops the pages past the new length but leaves the mapping in place such
+// that the region can grow back into it.
+static void mmap_shrink(struct ilka_mmap *m, size_t len)
 {
-    struct mmap_node *node = &m->head;
+    size_t old = m->len;
+    if (!(m->flags & MAP_HUGETLB)) mmap_drop_unpinned(m, len, old - len);
 
-    while (true) {
-        size_t rlen = ilka_atomic_load(&node->len, morder_relaxed);
-        if (off == rlen) return true;
-        if (off <= rlen || !node->next) return false;
+    // morder_release: the pages are dropped before the length is published
+    // which is fine as nobody should be accessing freed pages.
+    ilka_atomic_store(&m->len, len, morder_release);
+}
 
-        off -= rlen;
-        node = ilka_atomic_load(&node->next, morder_relaxed);
+// Prefetching is only a hint so out-of-bounds ranges are clipped.
+static void mmap_prefetch(struct ilka_mmap *m, ilka_off_t off, size_t len)
+{
+    // morder_acquire: synchronizes with mmap_commit to ensure that the
+    // directory covers the range before we index into it.
+    size_t end = ilka_atomic_load(&m->len, morder_acquire);
+    if (off >= end) return;
+    if (off + len > end) len = end - off;
+
+    len += off & (ILKA_CACHE_LINE - 1);
+    off &= ~(ILKA_CACHE_LINE - 1);
+
+    while (len) {
+        size_t n;
+        uint8_t *ptr = mmap_span(m, off, len, &n);
+
+        for (size_t i = 0; i < n; i += ILKA_CACHE_LINE)
+            __builtin_prefetch(ptr + i);
+
+        off += n;
+        len -= n;
     }
+}
+
+static bool mmap_is_edge(struct ilka_mmap *m, ilka_off_t off)
+{
+    if (!off || off & (mmap_slot_len - 1)) return false;
+    if (off >= ilka_atomic_load(&m->cap, morder_relaxed)) return true;
+    if (m->base) return false;
 
-    ilka_unreachable();
+    struct mmap_dir *dir = ilka_atomic_load(&m->dir, morder_relaxed);
+    size_t slot = off >> mmap_slot_bits;
+    return !mmap_dir_is_contiguous(dir, slot - 1, slot);
 }
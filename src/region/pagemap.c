@@ -0,0 +1,168 @@
+/* pagemap.c
+   Rémi Attab (remi.attab@gmail.com), 16 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Soft-dirty page tracking. The kernel sets the soft-dirty bit of a page when
+   it's written to which is reported in /proc/self/pagemap and cleared for the
+   entire process by writing 4 to /proc/self/clear_refs. Clearing the bits
+   write-protects every page so the first write to a page after a clear costs a
+   minor fault while every other write is a plain store.
+
+   Since clearing affects every mapping of the process, only one region per
+   process can rely on the bits.
+*/
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+enum
+{
+    pagemap_soft_dirty_bit = 55,
+    pagemap_batch = 512,
+};
+
+static bool pagemap_claimed = false;
+
+
+// -----------------------------------------------------------------------------
+// pagemap
+// -----------------------------------------------------------------------------
+
+struct ilka_pagemap
+{
+    int fd;
+    int clear_fd;
+};
+
+static bool pagemap_read(int fd, const void *ptr, uint64_t *entries, size_t n)
+{
+    off_t off = ((uintptr_t) ptr / ILKA_PAGE_SIZE) * sizeof(uint64_t);
+    size_t len = n * sizeof(uint64_t);
+
+    ssize_t ret = pread(fd, entries, len, off);
+    if (ret == (ssize_t) len) return true;
+
+    if (ret == -1) ilka_fail_errno("unable to read pagemap for '%p'", ptr);
+    else ilka_fail("short read on pagemap for '%p': %ld != %lu", ptr, ret, len);
+    return false;
+}
+
+// A page that was just written to is always soft-dirty unless the kernel
+// doesn't track the bits in which case they always read as zero. Doesn't clear
+// the bits so it's safe to call while a region relies on them.
+static bool pagemap_supported()
+{
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd == -1) return false;
+
+    bool ret = false;
+    uint8_t *ptr = mmap(NULL, ILKA_PAGE_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) goto fail_mmap;
+
+    *(volatile uint8_t *) ptr = 1;
+
+    uint64_t entry;
+    off_t off = ((uintptr_t) ptr / ILKA_PAGE_SIZE) * sizeof(uint64_t);
+    if (pread(fd, &entry, sizeof(entry), off) != sizeof(entry)) goto fail_read;
+    ret = entry & (1UL << pagemap_soft_dirty_bit);
+
+    if (ret && access("/proc/self/clear_refs", W_OK) == -1) ret = false;
+
+  fail_read:
+    munmap(ptr, ILKA_PAGE_SIZE);
+  fail_mmap:
+    close(fd);
+    return ret;
+}
+
+static bool pagemap_init(struct ilka_pagemap *pm)
+{
+    if (!pagemap_supported()) {
+        ilka_fail("soft-dirty page bits are not supported by the kernel");
+        goto fail_supported;
+    }
+
+    bool claimed = false;
+    if (!ilka_atomic_cmp_xchg(&pagemap_claimed, &claimed, true, morder_relaxed)) {
+        ilka_fail("soft-dirty page bits are already used by another region");
+        goto fail_claim;
+    }
+
+    if ((pm->fd = open("/proc/self/pagemap", O_RDONLY)) == -1) {
+        ilka_fail_errno("unable to open /proc/self/pagemap");
+        goto fail_open;
+    }
+
+    if ((pm->clear_fd = open("/proc/self/clear_refs", O_WRONLY)) == -1) {
+        ilka_fail_errno("unable to open /proc/self/clear_refs");
+        goto fail_open_clear;
+    }
+
+    return true;
+
+  fail_open_clear:
+    close(pm->fd);
+  fail_open:
+    ilka_atomic_store(&pagemap_claimed, false, morder_relaxed);
+  fail_claim:
+  fail_supported:
+    return false;
+}
+
+static void pagemap_close(struct ilka_pagemap *pm)
+{
+    close(pm->clear_fd);
+    close(pm->fd);
+    ilka_atomic_store(&pagemap_claimed, false, morder_relaxed);
+}
+
+// Invokes fn for every run of soft-dirty pages of the region. Mappings created
+// or moved since the last clear are reported as entirely soft-dirty.
+static bool pagemap_scan(
+        struct ilka_pagemap *pm, struct ilka_mmap *m, size_t region_len,
+        void (*fn) (void *, ilka_off_t, size_t), void *data)
+{
+    uint64_t entries[pagemap_batch];
+    ilka_off_t run = 0;
+    size_t run_len = 0;
+
+    ilka_off_t off = 0;
+    size_t len = ceil_div(region_len, ILKA_PAGE_SIZE) * ILKA_PAGE_SIZE;
+
+    while (len) {
+        size_t span;
+        uint8_t *ptr = mmap_span(m, off, len, &span);
+
+        size_t pages = span / ILKA_PAGE_SIZE;
+        if (pages > pagemap_batch) pages = pagemap_batch;
+        if (!pagemap_read(pm->fd, ptr, entries, pages)) return false;
+
+        for (size_t i = 0; i < pages; ++i) {
+            ilka_off_t page = off + i * ILKA_PAGE_SIZE;
+            if (!(entries[i] & (1UL << pagemap_soft_dirty_bit))) continue;
+
+            if (run_len && run + run_len == page) run_len += ILKA_PAGE_SIZE;
+            else {
+                if (run_len) fn(data, run, run_len);
+                run = page;
+                run_len = ILKA_PAGE_SIZE;
+            }
+        }
+
+        off += pages * ILKA_PAGE_SIZE;
+        len -= pages * ILKA_PAGE_SIZE;
+    }
+
+    if (run_len) fn(data, run, run_len);
+    return true;
+}
+
+static bool pagemap_clear(struct ilka_pagemap *pm)
+{
+    if (write(pm->clear_fd, "4", 1) == 1) return true;
+
+    ilka_fail_errno("unable to clear soft-dirty page bits");
+    return false;
+}
@@ -3,119 +3,690 @@
    FreeBSD-style copyright and disclaimer apply
 */
 
+// -----------------------------------------------------------------------------
+// marks
+// -----------------------------------------------------------------------------
+
+// Dirty cache lines are tracked exactly in a sparse radix tree where every
+// node is a page. Leaves hold one bit per cache line and cover 2MB while the
+// root and the two levels of inner nodes fan out 512 ways which covers 48 bits
+// of offsets. Only the nodes on the path of a dirty line are allocated.
+//
+// Every thread marks its own tree under its own lock which is only contended
+// when the trees are merged into the persist marks.
+
+enum
+{
+    marks_line_bits = 6,
+    marks_leaf_words = ILKA_PAGE_SIZE / sizeof(uint64_t),
+    marks_leaf_lines = marks_leaf_words * 64,
+    marks_leaf_bits = marks_line_bits + 15,
+
+    marks_fanout_bits = 9,
+    marks_fanout = 1UL << marks_fanout_bits,
+    marks_depth = 3,
+
+    marks_off_bits = marks_leaf_bits + marks_depth * marks_fanout_bits,
+};
+
+static const size_t marks_lines = 1UL << (marks_off_bits - marks_line_bits);
+static const ilka_off_t marks_nil = -1UL;
+
+struct marks_node
+{
+    void *slots[marks_fanout];
+};
+
+static struct marks_node * marks_alloc()
+{
+    struct marks_node *node = calloc(1, sizeof(struct marks_node));
+    if (!node) ilka_fail("out-of-memory for marks: %lu", sizeof(struct marks_node));
+    return node;
+}
+
+static void marks_free(void *node, size_t level)
+{
+    if (level < marks_depth) {
+        struct marks_node *inner = node;
+        for (size_t i = 0; i < marks_fanout; ++i) {
+            if (inner->slots[i]) marks_free(inner->slots[i], level + 1);
+        }
+    }
+
+    free(node);
+}
+
+static size_t marks_index(size_t line, size_t level)
+{
+    size_t shift = (marks_leaf_bits - marks_line_bits);
+    shift += (marks_depth - 1 - level) * marks_fanout_bits;
+    return (line >> shift) & (marks_fanout - 1);
+}
+
+static void * marks_slot(void **slot)
+{
+    if (*slot) return *slot;
+
+    if (!(*slot = calloc(1, ILKA_PAGE_SIZE))) {
+        ilka_fail("out-of-memory for marks node: %lu", ILKA_PAGE_SIZE);
+        ilka_abort();
+    }
+
+    return *slot;
+}
+
+static void marks_set(struct marks_node *root, ilka_off_t off, size_t len)
+{
+    ilka_assert(off + len <= 1UL << marks_off_bits,
+            "out-of-range mark: %p + %p", (void *) off, (void *) len);
+
+    size_t line = off >> marks_line_bits;
+    size_t end = ceil_div(off + len, 1UL << marks_line_bits);
+
+    while (line < end) {
+        struct marks_node *node = root;
+        for (size_t level = 0; level < marks_depth - 1; ++level)
+            node = marks_slot(&node->slots[marks_index(line, level)]);
+        uint64_t *leaf = marks_slot(&node->slots[marks_index(line, marks_depth - 1)]);
+
+        size_t leaf_end = (line | (marks_leaf_lines - 1)) + 1;
+        if (leaf_end > end) leaf_end = end;
+
+        while (line < leaf_end) {
+            size_t bit = line % 64;
+            size_t n = 64 - bit;
+            if (n > leaf_end - line) n = leaf_end - line;
+
+            uint64_t mask = (n == 64 ? -1UL : (1UL << n) - 1) << bit;
+            size_t word = (line % marks_leaf_lines) / 64;
+            leaf[word] |= mask;
+
+            line += n;
+        }
+    }
+}
+
+// Moves the marks of src into dst. Subtrees that are missing from dst are moved
+// over as is.
+static void marks_merge(void **dst, void *src, size_t level)
+{
+    if (!*dst) {
+        *dst = src;
+        return;
+    }
+
+    if (level == marks_depth) {
+        uint64_t *dst_leaf = *dst;
+        const uint64_t *src_leaf = src;
+        for (size_t i = 0; i < marks_leaf_words; ++i) dst_leaf[i] |= src_leaf[i];
+    }
+    else {
+        struct marks_node *dst_node = *dst;
+        struct marks_node *src_node = src;
+        for (size_t i = 0; i < marks_fanout; ++i) {
+            if (src_node->slots[i])
+                marks_merge(&dst_node->slots[i], src_node->slots[i], level + 1);
+        }
+    }
+
+    free(src);
+}
+
+// Returns the first dirty line of the subtree at or after line along with its
+// leaf or marks_lines if there are none.
+static size_t marks_find(
+        const struct marks_node *node, size_t level, size_t line, const uint64_t **leaf)
+{
+    size_t shift = (marks_leaf_bits - marks_line_bits);
+    shift += (marks_depth - 1 - level) * marks_fanout_bits;
+    size_t base = line & ~((1UL << (shift + marks_fanout_bits)) - 1);
+
+    for (size_t i = marks_index(line, level); i < marks_fanout; ++i) {
+        const void *child = node->slots[i];
+        if (!child) continue;
+
+        size_t first = base + (i << shift);
+        if (first < line) first = line;
+
+        if (level < marks_depth - 1) {
+            size_t ret = marks_find(child, level + 1, first, leaf);
+            if (ret != marks_lines) return ret;
+            continue;
+        }
+
+        size_t bit = bitfields_next(child, first % marks_leaf_lines, marks_leaf_lines);
+        if (bit == marks_leaf_lines) continue;
+
+        *leaf = child;
+        return (first & ~(marks_leaf_lines - 1)) + bit;
+    }
+
+    return marks_lines;
+}
+
+// Iterating over the marks yields the runs of dirty lines in increasing offset
+// order. Runs are split at leaf boundaries.
+static ilka_off_t marks_next(const struct marks_node *root, ilka_off_t off, size_t *len)
+{
+    const uint64_t *leaf = NULL;
+    size_t line = marks_find(root, 0, off >> marks_line_bits, &leaf);
+    if (line == marks_lines) return marks_nil;
+
+    size_t start = line % marks_leaf_lines;
+    size_t end = marks_leaf_lines;
+
+    for (size_t word = start / 64; word < marks_leaf_words; ++word) {
+        uint64_t clear = ~leaf[word];
+        if (word == start / 64) clear &= ~((1UL << (start % 64)) - 1);
+        if (!clear) continue;
+
+        end = word * 64 + ctz(clear);
+        break;
+    }
+
+    *len = (end - start) << marks_line_bits;
+    return line << marks_line_bits;
+}
+
+// Clips a run to the region which can have shrunk since it was marked.
+static bool marks_clip(ilka_off_t off, size_t *len, size_t region_len)
+{
+    if (off >= region_len) return false;
+    if (off + *len > region_len) *len = region_len - off;
+    return true;
+}
+
+
 // -----------------------------------------------------------------------------
 // persist
 // -----------------------------------------------------------------------------
 
-#define marks_min_len   ILKA_CACHE_LINE
-#define marks_block_len ILKA_CACHE_LINE
-#define marks_block_bits (marks_block_len * 8)
+// Threads that exit are flagged as dead and are reclaimed on the next collect
+// which merges whatever they marked before exiting. Aligned so that the locks
+// of two threads never share a cache line.
+struct ilka_align(ILKA_CACHE_LINE) persist_thread
+{
+    struct ilka_persist *p;
 
-#define marks_trunc_bits ctz(marks_min_len)
-#define marks_low_bits   ctz(marks_block_bits)
-#define marks_high_bits  (64 - marks_low_bits - marks_trunc_bits)
+    ilka_slock lock;
+    struct marks_node *marks;
+    bool dead;
 
-#define marks_bits  (marks_high_bits * marks_block_bits)
-#define marks_words (marks_bits / 64)
+    struct persist_thread *next;
+};
+
+// Caller of ilka_save queued up until a save that took its snapshot after the
+// caller arrived is durable. Lives on the stack of the caller.
+struct persist_waiter
+{
+    uint64_t ticket;
+
+    bool done;
+    bool ret;
+    struct ilka_error err;
+
+    struct persist_waiter *next;
+};
+
+// Request of ilka_save_async whose callback is invoked with the outcome of the
+// first save numbered at or after its ticket. Callbacks are only invoked once
+// the persist lock is released such that they're free to start another save.
+struct persist_async
+{
+    uint64_t ticket;
+    void (*cb) (void *, bool);
+    void *data;
+    bool ret;
+
+    struct persist_async *next;
+};
 
 struct ilka_persist
 {
     struct ilka_region *region;
     const char *file;
+    int fd;
+    const struct ilka_stripes *stripes;
+    struct ilka_mmap *mmap;
+
+    bool in_memory;
+    bool multi;
+    bool reclaim;
+    bool reclaiming;
+    bool shared;
+    struct ilka_undo undo;
+    struct ilka_warm *warm;
+
+    bool soft_dirty;
+    struct ilka_pagemap pagemap;
 
-    uint64_t *marks;
+    struct marks_node *marks;
     ilka_slock lock;
+
+    // Protects the persist marks and the thread list. Multiple threads can
+    // have the world stopped at the same time.
+    ilka_slock marks_lock;
+    pthread_key_t key;
+    struct persist_thread *threads;
+
+    size_t saves;
+    size_t saved_len;
+
+    // Save of the fork engine whose persist process is still running. It's
+    // completed by whoever holds the persist lock once the process exits.
+    pid_t pid;
+    uint64_t pending_seq;
+    struct marks_node *pending;
+    size_t pending_len;
+
+    // Saves are numbered as they take their snapshot and queued callers wait
+    // on the first save numbered at or after their ticket. Callers are parked
+    // on waiters_cond while another caller leads a save.
+    pthread_mutex_t waiters_lock;
+    pthread_cond_t waiters_cond;
+    uint64_t started;
+    bool leading;
+    struct persist_waiter *waiters;
+    struct persist_async *asyncs;
+
+    void (*dbg_queued) (void *);
+    void *dbg_queued_data;
 };
 
+
+// -----------------------------------------------------------------------------
+// group
+// -----------------------------------------------------------------------------
+
+// Must be called as the snapshot of a save is taken such that it covers every
+// caller that queued up beforehand.
+static uint64_t persist_begin(struct ilka_persist *p)
+{
+    pthread_mutex_lock(&p->waiters_lock);
+    uint64_t seq = ++p->started;
+    pthread_mutex_unlock(&p->waiters_lock);
+    return seq;
+}
+
+// Wakes the callers covered by the save seq. On failure, they inherit the error
+// of the thread that completed the save. The covered asynchronous requests are
+// moved to done to be notified once the persist lock is released.
+static void persist_wake(
+        struct ilka_persist *p, uint64_t seq, bool ret, struct persist_async **done)
+{
+    pthread_mutex_lock(&p->waiters_lock);
+
+    struct persist_async **async = &p->asyncs;
+    while (*async) {
+        struct persist_async *node = *async;
+        if (node->ticket > seq) {
+            async = &node->next;
+            continue;
+        }
+
+        *async = node->next;
+        node->ret = ret;
+        node->next = *done;
+        *done = node;
+    }
+
+    struct persist_waiter **it = &p->waiters;
+    while (*it) {
+        struct persist_waiter *waiter = *it;
+        if (waiter->ticket > seq) {
+            it = &waiter->next;
+            continue;
+        }
+
+        *it = waiter->next;
+        waiter->ret = ret;
+        if (!ret) waiter->err = ilka_err;
+        waiter->done = true;
+    }
+
+    pthread_cond_broadcast(&p->waiters_cond);
+    pthread_mutex_unlock(&p->waiters_lock);
+}
+
+
+// -----------------------------------------------------------------------------
+// threads
+// -----------------------------------------------------------------------------
+
+static void persist_thread_remove(void *data)
+{
+    struct persist_thread *thread = data;
+    struct ilka_persist *p = thread->p;
+
+    slock_lock(&p->marks_lock);
+    thread->dead = true;
+    slock_unlock(&p->marks_lock);
+}
+
+static struct persist_thread * persist_thread_get(struct ilka_persist *p)
+{
+    struct persist_thread *thread = pthread_getspecific(p->key);
+    if (thread) return thread;
+
+    int err = posix_memalign((void **) &thread, ILKA_CACHE_LINE, sizeof(struct persist_thread));
+    if (err) {
+        ilka_fail_ierrno(err, "unable to allocate persist thread: %lu",
+                sizeof(struct persist_thread));
+        return NULL;
+    }
+    memset(thread, 0, sizeof(struct persist_thread));
+
+    thread->p = p;
+    slock_init(&thread->lock);
+    pthread_setspecific(p->key, thread);
+
+    slock_lock(&p->marks_lock);
+    thread->next = p->threads;
+    p->threads = thread;
+    slock_unlock(&p->marks_lock);
+
+    return thread;
+}
+
+static void persist_soft_dirty(void *data, ilka_off_t off, size_t len)
+{
+    marks_set(data, off, len);
+}
+
+// Merges the marks of every thread into the persist marks which are then
+// swapped with swap if provided. Saves must stop the world to get a snapshot.
+//
+// Soft-dirty pages are added to the persist marks instead and their bits are
+// only cleared when the marks are swapped. Pages that stay soft-dirty are
+// reported again by the next collect which is harmless.
+static struct marks_node * persist_collect(
+        struct ilka_persist *p, struct marks_node *swap)
+{
+    slock_lock(&p->marks_lock);
+
+    if (p->soft_dirty) {
+        size_t region_len = ilka_len(p->region);
+        if (!pagemap_scan(&p->pagemap, p->mmap, region_len, persist_soft_dirty, p->marks))
+            ilka_abort();
+        if (swap && !pagemap_clear(&p->pagemap)) ilka_abort();
+    }
+
+    struct persist_thread **it = &p->threads;
+    while (*it) {
+        struct persist_thread *thread = *it;
+
+        slock_lock(&thread->lock);
+        if (thread->marks) {
+            marks_merge((void **) &p->marks, thread->marks, 0);
+            thread->marks = NULL;
+        }
+        slock_unlock(&thread->lock);
+
+        if (!thread->dead) it = &thread->next;
+        else {
+            *it = thread->next;
+            free(thread);
+        }
+    }
+
+    struct marks_node *marks = p->marks;
+    if (swap) p->marks = swap;
+
+    slock_unlock(&p->marks_lock);
+    return marks;
+}
+
 static bool persist_init(
-        struct ilka_persist *p, struct ilka_region *r, const char *file)
+        struct ilka_persist *p,
+        struct ilka_region *r,
+        const char *file,
+        const struct ilka_stripes *stripes,
+        struct ilka_mmap *mmap,
+        size_t len,
+        struct ilka_warm *warm,
+        struct ilka_options *options)
 {
     memset(p, 0, sizeof(struct ilka_persist));
 
     p->region = r;
     p->file = file;
+    p->fd = stripes->fds[0];
+    p->stripes = stripes;
+    p->mmap = mmap;
+    p->warm = warm;
+    p->in_memory = options->in_memory;
+    p->multi = options->multi_process;
+    p->reclaim = options->persist_reclaim;
     slock_init(&p->lock);
-    p->marks = calloc(marks_words, sizeof(uint64_t));
+    slock_init(&p->marks_lock);
+    p->waiters_lock = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    p->waiters_cond = (pthread_cond_t) PTHREAD_COND_INITIALIZER;
+    if (p->in_memory || p->multi) return true;
+
+    p->shared = options->persist_engine == ilka_persist_shared && !options->read_only;
+    if (p->shared && !undo_init(&p->undo, r, file, len)) goto fail_undo;
+
+    if (!(p->marks = marks_alloc())) goto fail_marks;
+
+    if (pthread_key_create(&p->key, persist_thread_remove)) {
+        ilka_fail_errno("unable to create pthread key");
+        goto fail_key;
+    }
+
+    // Read-only regions are never saved so there's nothing to track. The
+    // mappings are new and would otherwise be entirely soft-dirty.
+    p->soft_dirty = options->persist_track == ilka_track_soft_dirty && !options->read_only;
+    if (p->soft_dirty) {
+        if (!pagemap_init(&p->pagemap)) goto fail_pagemap;
+        if (!pagemap_clear(&p->pagemap)) goto fail_clear;
+    }
 
     return true;
+
+  fail_clear:
+    pagemap_close(&p->pagemap);
+  fail_pagemap:
+    pthread_key_delete(p->key);
+  fail_key:
+    marks_free(p->marks, 0);
+  fail_marks:
+    if (p->shared) undo_close(&p->undo);
+  fail_undo:
+    return false;
 }
 
 static void persist_close(struct ilka_persist *p)
 {
-    if (p->marks) free(p->marks);
+    pthread_cond_destroy(&p->waiters_cond);
+    pthread_mutex_destroy(&p->waiters_lock);
+
+    if (p->in_memory || p->multi) return;
+    if (p->shared) undo_close(&p->undo);
+    if (p->soft_dirty) pagemap_close(&p->pagemap);
+
+    pthread_key_delete(p->key);
+
+    while (p->threads) {
+        struct persist_thread *thread = p->threads;
+        p->threads = thread->next;
+
+        if (thread->marks) marks_free(thread->marks, 0);
+        free(thread);
+    }
+
+    marks_free(p->marks, 0);
+}
+
+static const size_t persist_reclaim_sleep_usec = 10;
+
+// Waits on a reclaim started after the marks of the thread were collected.
+static void persist_reclaim_wait(struct ilka_persist *p)
+{
+    while (ilka_atomic_load(&p->reclaiming, morder_acquire))
+        ilka_nsleep(persist_reclaim_sleep_usec * 1000);
 }
 
 static void persist_mark(struct ilka_persist *p, ilka_off_t off, size_t len)
 {
-    ilka_off_t end = off + len;
-    off >>= marks_trunc_bits;
+    if (p->in_memory || p->multi || p->soft_dirty) return;
+    if (p->shared && !undo_capture(&p->undo, off, len)) ilka_abort();
 
-    do {
-        size_t msb = clz(off);
-        msb = msb < 64 ? 63 - msb : 0;
+    struct persist_thread *thread = persist_thread_get(p);
+    if (!thread) ilka_abort();
 
-        size_t high, low, len;
+    slock_lock(&thread->lock);
+    if (!thread->marks && !(thread->marks = marks_alloc())) ilka_abort();
+    marks_set(thread->marks, off, len);
 
-        if (msb < marks_low_bits) {
-            high = 0;
-            low = off;
-            len = marks_min_len;
-        }
-        else {
-            high = (msb - marks_low_bits) + 1;
-            low = (off >> (high - 1)) & ((1UL << marks_low_bits) - 1);
-            len = marks_min_len << (high - 1);
+    // morder_relaxed: synchronized by the thread lock which the reclaim takes
+    // to collect the marks after setting the flag.
+    bool wait = p->reclaim && ilka_atomic_load(&p->reclaiming, morder_relaxed);
+    slock_unlock(&thread->lock);
 
-            // remove any excess bits to ensure that the off increase will
-            // correctly represent the area marked for saving.
-            off &= ~((1UL << (high - 1)) - 1);
-        }
+    if (ilka_unlikely(wait)) persist_reclaim_wait(p);
+}
+
+// Must be called with the persist lock held.
+static void persist_account(
+        struct ilka_persist *p, const struct marks_node *marks, size_t region_len)
+{
+    size_t saved = 0;
+
+    size_t len;
+    for (ilka_off_t off = marks_next(marks, 0, &len);
+         off != marks_nil && marks_clip(off, &len, region_len);
+         off = marks_next(marks, off + len, &len))
+    {
+        saved += len;
+    }
 
-        size_t i = high * marks_block_bits + low;
-        ilka_atomic_fetch_or(&p->marks[i / 64], 1UL << (i % 64), morder_relaxed);
+    ilka_atomic_store(&p->saves, p->saves + 1, morder_relaxed);
+    ilka_atomic_store(&p->saved_len, p->saved_len + saved, morder_relaxed);
+}
 
-        off += len >> marks_trunc_bits;
-    } while ((off << marks_trunc_bits) < end);
+static bool persist_stats(struct ilka_persist *p, struct ilka_persist_stats *stats)
+{
+    if (p->in_memory || p->multi) return false;
+
+    stats->saves = ilka_atomic_load(&p->saves, morder_relaxed);
+    stats->saved_len = ilka_atomic_load(&p->saved_len, morder_relaxed);
+    return true;
 }
 
 static void persist_save_journal(
-        struct ilka_persist *p, uint64_t *marks, size_t region_len)
+        struct ilka_persist *p, const struct marks_node *marks, size_t region_len)
 {
     struct ilka_journal j;
-    if (!journal_init(&j, p->region, p->file)) ilka_abort();
+    if (!journal_init(&j, p->region, p->stripes)) ilka_abort();
 
-    for (size_t i = bitfields_next(marks, 0, marks_bits);
-         i < marks_bits;
-         i = bitfields_next(marks, i + 1, marks_bits))
+    size_t len;
+    for (ilka_off_t off = marks_next(marks, 0, &len);
+         off != marks_nil && marks_clip(off, &len, region_len);
+         off = marks_next(marks, off + len, &len))
     {
-        size_t len = marks_min_len;
-        size_t off = i % marks_block_bits;
-        size_t high = i / marks_block_bits;
+        if (!journal_add(&j, off, len)) ilka_abort();
+    }
+
+    if (!journal_finish(&j)) ilka_abort();
+}
+
+// Once saved, the private pages that were written to the file are identical
+// to the file and can be dropped to fall back on the shared page cache. Pages
+// that were marked since the snapshot are left alone. Requires the world to be
+// stopped so that no-one writes to a page while it's being dropped.
+//
+// Writes made outside of an epoch aren't stopped so a page marked after the
+// marks were collected could be dropped under the write. These writes wait in
+// persist_mark for the reclaim to complete and land on the page faulted back
+// in from the file. A write that lands long after its mark was collected isn't
+// covered and can be lost which is why racing writes must be within an epoch.
+static void persist_reclaim(struct ilka_persist *p, const struct marks_node *marks)
+{
+    ilka_world_stop(p->region);
+    ilka_atomic_store(&p->reclaiming, true, morder_relaxed);
+
+    const size_t region_len = ilka_len(p->region);
+    const struct marks_node *dirty = persist_collect(p, NULL);
+    slock_lock(&p->marks_lock);
+
+    size_t dirty_len = 0;
+    ilka_off_t dirty_start = marks_next(dirty, 0, &dirty_len);
+    ilka_off_t dirty_end = dirty_start == marks_nil ? 0 : dirty_start + dirty_len;
+
+    size_t len;
+    for (ilka_off_t off = marks_next(marks, 0, &len);
+         off != marks_nil;
+         off = marks_next(marks, off + len, &len))
+    {
+        ilka_off_t start = (off / ILKA_PAGE_SIZE) * ILKA_PAGE_SIZE;
+        ilka_off_t end = ceil_div(off + len, ILKA_PAGE_SIZE) * ILKA_PAGE_SIZE;
+        if (end > region_len) end = region_len;
+
+        while (start < end) {
+            while (dirty_start != marks_nil && dirty_end <= start) {
+                dirty_start = marks_next(dirty, dirty_end, &dirty_len);
+                if (dirty_start == marks_nil) break;
+                dirty_end = dirty_start + dirty_len;
+            }
+
+            ilka_off_t stop = end;
+            if (dirty_start != marks_nil && dirty_start < stop) {
+                stop = (dirty_start / ILKA_PAGE_SIZE) * ILKA_PAGE_SIZE;
+                if (stop < start) stop = start;
+            }
 
-        if (high) {
-            len <<= high - 1;
-            off = (off | (1UL << marks_low_bits)) << (high - 1);
+            if (stop > start) ilka_reclaim(p->region, start, stop - start);
+            if (stop == end) break;
+
+            start = ceil_div(dirty_end, ILKA_PAGE_SIZE) * ILKA_PAGE_SIZE;
         }
+    }
 
-        off <<= marks_trunc_bits;
-        if (off + len > region_len) len = region_len - off;
+    // morder_release: the pages must be dropped before the writers resume.
+    ilka_atomic_store(&p->reclaiming, false, morder_release);
 
-        if (!journal_add(&j, off, len)) ilka_abort();
+    slock_unlock(&p->marks_lock);
+    ilka_world_resume(p->region);
+}
+
+
+// Feeds the saved ranges to the warm-up profile.
+static void persist_heat(
+        struct ilka_persist *p, const struct marks_node *marks, size_t region_len)
+{
+    if (!p->warm->record) return;
+
+    size_t len;
+    for (ilka_off_t off = marks_next(marks, 0, &len);
+         off != marks_nil && marks_clip(off, &len, region_len);
+         off = marks_next(marks, off + len, &len))
+    {
+        if (!warm_record(p->warm, off, len)) return;
     }
 
-    if (!journal_finish(&j)) ilka_abort();
+    warm_save(p->warm);
 }
 
-static bool persist_wait(pid_t pid)
+// Sets done once the persist process has exited which is only waited on if
+// block is set.
+static bool persist_wait(pid_t pid, bool block, bool *done)
 {
+    int options = WUNTRACED | (block ? 0 : WNOHANG);
+    *done = false;
+
     int status;
     do {
-        if (waitpid(pid, &status, WUNTRACED) == -1) {
+        pid_t ret = waitpid(pid, &status, options);
+        if (ret == -1) {
+            *done = true;
             ilka_fail_errno("unable to wait on persist process: %d", pid);
             return false;
         }
+        if (!ret) return true;
     } while (!WIFEXITED(status) && !WIFSIGNALED(status));
 
+    *done = true;
+
     if (WIFEXITED(status)) {
         if (!WEXITSTATUS(status)) return true;
 
@@ -130,41 +701,336 @@ static bool persist_wait(pid_t pid)
     return true;
 }
 
-static bool persist_save(struct ilka_persist *p)
+// Must be called once the persist lock is released.
+static void persist_notify(struct persist_async *done)
+{
+    while (done) {
+        struct persist_async *next = done->next;
+        done->cb(done->data, done->ret);
+        free(done);
+        done = next;
+    }
+}
+
+// Completes the pending save once its persist process has exited which is only
+// waited on if block is set. Returns false if the pending save is still
+// running. Must be called with the persist lock held.
+static bool persist_complete(
+        struct ilka_persist *p, bool block, struct persist_async **done)
 {
-    uint64_t *old_marks;
-    uint64_t *new_marks = calloc(marks_words, sizeof(uint64_t));
+    if (!p->pid) return true;
 
-    slock_lock(&p->lock);
+    bool exited;
+    bool ret = persist_wait(p->pid, block, &exited);
+    if (!exited) return false;
+
+    struct marks_node *marks = p->pending;
+    if (ret) ilka_gen_end(p->region);
+    if (ret) persist_account(p, marks, p->pending_len);
+    if (ret && p->reclaim) persist_reclaim(p, marks);
+    if (ret) persist_heat(p, marks, ilka_len(p->region));
+    marks_free(marks, 0);
+
+    persist_wake(p, p->pending_seq, ret, done);
+
+    p->pid = 0;
+    p->pending = NULL;
+    return true;
+}
+
+// Forks the persist process which is left pending. Saves share the journal so
+// the previous save must be completed beforehand. Must be called with the
+// persist lock held.
+static bool persist_fork(struct ilka_persist *p, struct persist_async **done)
+{
+    persist_complete(p, true, done);
+
+    struct marks_node *old_marks;
+    struct marks_node *new_marks = marks_alloc();
+    if (!new_marks) return false;
 
     pid_t pid;
+    uint64_t seq;
+    size_t region_len;
     {
         ilka_world_stop(p->region);
+        ilka_gen_begin(p->region);
 
+        seq = persist_begin(p);
+        region_len = ilka_len(p->region);
+        old_marks = persist_collect(p, new_marks);
         pid = fork();
 
-        old_marks = p->marks;
-        p->marks = new_marks;
-
         ilka_world_resume(p->region);
     }
 
+    // The marks are merged back so that the next save picks them up.
     if (pid == -1) {
         ilka_fail_errno("unable to fork for persist");
-        slock_unlock(&p->lock);
+
+        slock_lock(&p->marks_lock);
+        marks_merge((void **) &p->marks, old_marks, 0);
+        slock_unlock(&p->marks_lock);
+
         return false;
     }
 
-
     if (!pid) {
-        persist_save_journal(p, old_marks, ilka_len(p->region));
+        persist_save_journal(p, old_marks, region_len);
+        if (!ilka_gen_publish(p->region)) ilka_abort();
         _exit(0);
     }
-    else {
-        free(old_marks);
-        bool ret = persist_wait(pid);
 
+    p->pid = pid;
+    p->pending_seq = seq;
+    p->pending = old_marks;
+    p->pending_len = region_len;
+    return true;
+}
+
+static bool persist_queued(struct ilka_persist *p)
+{
+    pthread_mutex_lock(&p->waiters_lock);
+    bool ret = p->asyncs;
+    pthread_mutex_unlock(&p->waiters_lock);
+    return ret;
+}
+
+// Completes the pending save if its persist process exited and starts a save
+// for the queued asynchronous requests if there's no save in progress. Never
+// waits on a persist process. The queued requests fail along with a save that
+// fails to start. Must be called with the persist lock held.
+static void persist_kick(struct ilka_persist *p, struct persist_async **done)
+{
+    if (!persist_complete(p, false, done)) return;
+    if (persist_queued(p) && !persist_fork(p, done)) persist_wake(p, -1UL, false, done);
+}
+
+// Saves hold the persist lock for as long as they wait on their persist process
+// so the request is left queued if the lock is taken. It's then picked up by
+// the next save, poll or close.
+static bool persist_save_fork_async(
+        struct ilka_persist *p, void (*cb) (void *, bool), void *data)
+{
+    struct persist_async *async = malloc(sizeof(struct persist_async));
+    if (!async) {
+        ilka_fail("out-of-memory for async save: %lu", sizeof(struct persist_async));
+        return false;
+    }
+
+    pthread_mutex_lock(&p->waiters_lock);
+    *async = (struct persist_async) {
+        .ticket = p->started + 1,
+        .cb = cb,
+        .data = data,
+        .next = p->asyncs,
+    };
+    p->asyncs = async;
+    pthread_mutex_unlock(&p->waiters_lock);
+
+    if (!slock_try_lock(&p->lock)) return true;
+
+    struct persist_async *done = NULL;
+    persist_kick(p, &done);
+
+    slock_unlock(&p->lock);
+
+    persist_notify(done);
+    return true;
+}
+
+// Returns true once no save is in progress or queued.
+static bool persist_poll(struct ilka_persist *p)
+{
+    if (!slock_try_lock(&p->lock)) return false;
+
+    struct persist_async *done = NULL;
+    persist_kick(p, &done);
+    bool idle = !p->pid && !persist_queued(p);
+
+    slock_unlock(&p->lock);
+
+    persist_notify(done);
+    return idle;
+}
+
+
+// -----------------------------------------------------------------------------
+// shared
+// -----------------------------------------------------------------------------
+
+static void persist_sync_range(struct ilka_persist *p, ilka_off_t start, ilka_off_t end)
+{
+    if (end <= start) return;
+
+    if (sync_file_range(p->fd, start, end - start, SYNC_FILE_RANGE_WRITE) == -1) {
+        ilka_fail_errno("unable to sync region range: %p, %p",
+                (void *) start, (void *) (end - start));
+        ilka_abort();
+    }
+}
+
+// The region is mapped shared so saving only requires that the dirty ranges be
+// flushed to disk. Writes that happen during the flush are protected by the
+// new undo log. A failure past the rotation leaves the undo logs in a state
+// that only recovery can untangle. Must be called with the persist lock held.
+static bool persist_save_shared(struct ilka_persist *p)
+{
+    struct marks_node *old_marks;
+    struct marks_node *new_marks = marks_alloc();
+    if (!new_marks) return false;
+
+    uint64_t seq;
+    size_t region_len;
+    {
+        ilka_world_stop(p->region);
+        ilka_gen_begin(p->region);
+        seq = persist_begin(p);
+        old_marks = persist_collect(p, new_marks);
+
+        region_len = ilka_len(p->region);
+        if (!undo_rotate(&p->undo, region_len)) ilka_abort();
+
+        ilka_world_resume(p->region);
+    }
+
+    // Writeback is done by page so the runs that share a page are coalesced.
+    ilka_off_t sync_start = 0, sync_end = 0;
+
+    size_t len;
+    for (ilka_off_t off = marks_next(old_marks, 0, &len);
+         off != marks_nil && marks_clip(off, &len, region_len);
+         off = marks_next(old_marks, off + len, &len))
+    {
+        ilka_off_t start = (off / ILKA_PAGE_SIZE) * ILKA_PAGE_SIZE;
+        if (start > sync_end) {
+            persist_sync_range(p, sync_start, sync_end);
+            sync_start = start;
+        }
+        sync_end = ceil_div(off + len, ILKA_PAGE_SIZE) * ILKA_PAGE_SIZE;
+    }
+    persist_sync_range(p, sync_start, sync_end);
+
+    if (fdatasync(p->fd) == -1) {
+        ilka_fail_errno("unable to fsync region: %s", p->file);
+        ilka_abort();
+    }
+
+    if (!undo_commit(&p->undo)) ilka_abort();
+    ilka_gen_end(p->region);
+
+    persist_account(p, old_marks, region_len);
+    persist_heat(p, old_marks, region_len);
+    marks_free(old_marks, 0);
+
+    struct persist_async *done = NULL;
+    persist_wake(p, seq, true, &done);
+    ilka_assert(!done, "unexpected async save with the shared engine");
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// multi
+// -----------------------------------------------------------------------------
+
+// The region is mapped shared by every process that writes to it and none of
+// them can stop the others to take a snapshot. Saving therefore only flushes
+// the file which makes the writes durable but not atomic.
+static bool persist_save_multi(struct ilka_persist *p)
+{
+    if (fdatasync(p->fd) != -1) return true;
+
+    ilka_fail_errno("unable to fsync region: %s", p->file);
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+// save
+// -----------------------------------------------------------------------------
+
+// Returns false if no save could be started. Must be called with the persist
+// lock held.
+static bool persist_lead(
+        struct ilka_persist *p, uint64_t ticket, struct persist_async **done)
+{
+    if (p->shared) return persist_save_shared(p);
+
+    // A pending asynchronous save can already cover the ticket unless
+    // asynchronous requests are queued behind it.
+    if (p->pid && p->pending_seq >= ticket) {
+        persist_complete(p, true, done);
+        if (!persist_queued(p)) return true;
+    }
+
+    if (!persist_fork(p, done)) return false;
+
+    persist_complete(p, true, done);
+    return true;
+}
+
+// Callers queue up and the first to find no one leading leads the next save on
+// behalf of every caller queued before its snapshot while the others are parked
+// until they're woken by a save or the leader steps down. Callers arriving in
+// the meantime are batched into the following save which bounds the number of
+// saves in progress to one regardless of the number of callers. Callers queued
+// while a save fails to start fail along with it.
+static bool persist_save_group(struct ilka_persist *p)
+{
+    struct persist_waiter waiter = {0};
+
+    pthread_mutex_lock(&p->waiters_lock);
+    waiter.ticket = p->started + 1;
+    waiter.next = p->waiters;
+    p->waiters = &waiter;
+    pthread_mutex_unlock(&p->waiters_lock);
+
+    if (p->dbg_queued) p->dbg_queued(p->dbg_queued_data);
+
+    pthread_mutex_lock(&p->waiters_lock);
+
+    while (!waiter.done) {
+        if (p->leading) {
+            pthread_cond_wait(&p->waiters_cond, &p->waiters_lock);
+            continue;
+        }
+
+        p->leading = true;
+        pthread_mutex_unlock(&p->waiters_lock);
+
+        struct persist_async *done = NULL;
+        slock_lock(&p->lock);
+        if (!persist_lead(p, waiter.ticket, &done)) persist_wake(p, -1UL, false, &done);
         slock_unlock(&p->lock);
-        return ret;
+        persist_notify(done);
+
+        pthread_mutex_lock(&p->waiters_lock);
+        p->leading = false;
+        pthread_cond_broadcast(&p->waiters_cond);
     }
+
+    pthread_mutex_unlock(&p->waiters_lock);
+
+    if (!waiter.ret) ilka_err = waiter.err;
+    return waiter.ret;
+}
+
+static bool persist_save(struct ilka_persist *p)
+{
+    if (p->in_memory) return true;
+    if (p->multi) return persist_save_multi(p);
+    return persist_save_group(p);
+}
+
+// Only the fork engine can complete a save in the background.
+static bool persist_save_async(
+        struct ilka_persist *p, void (*cb) (void *, bool), void *data)
+{
+    if (p->in_memory || p->multi || p->shared) {
+        if (!persist_save(p)) return false;
+        cb(data, true);
+        return true;
+    }
+
+    return persist_save_fork_async(p, cb, data);
 }
@@ -14,12 +14,25 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <linux/mempolicy.h>
 
 // Private interface.
 static bool ilka_is_edge(struct ilka_region *r, ilka_off_t off);
+static size_t ilka_file_len(struct ilka_region *r, size_t len);
+static bool ilka_file_grow(struct ilka_region *r, size_t len);
+static ilka_off_t ilka_grow_slack(struct ilka_region *r, size_t len, ilka_off_t *slack);
+static void ilka_reclaim(struct ilka_region *r, ilka_off_t off, size_t len);
+static bool ilka_shrink_len(struct ilka_region *r, size_t len, size_t end);
+static bool ilka_punch(struct ilka_region *r, ilka_off_t off, size_t len);
+static bool ilka_bind(struct ilka_region *r, ilka_off_t off, size_t len, size_t node);
+static void ilka_gen_begin(struct ilka_region *r);
+static void ilka_gen_end(struct ilka_region *r);
+static bool ilka_gen_publish(struct ilka_region *r);
 const void * ilka_read_sys(struct ilka_region *r, ilka_off_t off, size_t len);
 void * ilka_write_sys(struct ilka_region *r, ilka_off_t off, size_t len);
 
@@ -27,8 +40,12 @@ void * ilka_write_sys(struct ilka_region *r, ilka_off_t off, size_t len);
 #include "mmap.c"
 #include "alloc.c"
 #include "journal.c"
+#include "undo.c"
+#include "warm.c"
+#include "pagemap.c"
 #include "persist.c"
 #include "epoch.c"
+#include "tier.c"
 #include "mcheck.c"
 
 
@@ -37,11 +54,7 @@ void * ilka_write_sys(struct ilka_region *r, ilka_off_t off, size_t len);
 // -----------------------------------------------------------------------------
 
 static const uint64_t ilka_magic = 0x31906C0FFC1FC856;
-static const uint64_t ilka_version = 1;
-
-#ifndef ILKA_MCHECK
-# define ILKA_MCHECK 0
-#endif
+static const uint64_t ilka_version = 4;
 
 #ifndef ILKA_ALLOC_ZERO
 # define ILKA_ALLOC_ZERO 0
@@ -66,23 +79,47 @@ struct ilka_packed meta
     uint64_t version;
     ilka_off_t alloc;
     ilka_off_t root;
+
+    // odd while a save is being written to the file.
+    uint64_t generation;
+
+    // multi-process regions share their length and the lock that serializes
+    // their growth. epoch is the offset of the epoch slots of the processes.
+    ilka_slock lock;
+    size_t len;
+    ilka_off_t epoch;
+
+    // length that the region is capped at if it was created with the compact
+    // option; 0 otherwise.
+    uint64_t compact;
+
+    // length of the region as of the last save. The file is grown ahead of
+    // the region so it can be longer if the region wasn't closed.
+    size_t region_len;
 };
 
 struct ilka_region
 {
+    // Must come first as it's accessed by the inline ilka_read and ilka_write.
+    struct ilka_region_head head;
+
     int fd;
     const char* file;
     struct ilka_options options;
+    struct ilka_stripes stripes;
 
     ilka_slock lock;
+    ilka_slock release_lock;
 
     size_t len;
-    size_t header_len;
+    size_t file_len;
 
     struct ilka_mmap mmap;
     struct ilka_persist persist;
+    struct ilka_warm warm;
     struct ilka_alloc alloc;
     struct ilka_epoch epoch;
+    struct ilka_tier tier;
 
     struct ilka_mcheck mcheck;
 };
@@ -104,7 +141,11 @@ struct meta * meta_write(struct ilka_region *r)
 
 struct ilka_region * ilka_open(const char *file, struct ilka_options *options)
 {
-    journal_recover(file);
+    // Recovering would overwrite the file from under the processes using it.
+    if (!options->in_memory && !options->attach && !options->multi_process) {
+        journal_recover(file, options);
+        if (!options->read_only) undo_recover(file);
+    }
 
     struct ilka_region *r = calloc(1, sizeof(struct ilka_region));
     if (!r) {
@@ -114,18 +155,84 @@ struct ilka_region * ilka_open(const char *file, struct ilka_options *options)
     }
 
     slock_init(&r->lock);
+    slock_init(&r->release_lock);
 
     r->file = file;
     r->options = *options;
 
-    if ((r->fd = file_open(file, &r->options)) == -1) goto fail_open;
-    if ((r->len = file_grow(r->fd, ILKA_PAGE_SIZE)) == -1UL) goto fail_grow;
-    if (!mmap_init(&r->mmap, r->fd, r->len, &r->options)) goto fail_mmap;
-    if (!persist_init(&r->persist, r, r->file)) goto fail_persist;
+    if (r->options.attach) {
+        if (r->options.in_memory || r->options.huge_tlb || r->options.huge_pages) {
+            ilka_fail("attach option is not supported by in-memory or huge page regions");
+            goto fail_attach;
+        }
+        r->options.read_only = true;
+    }
+
+    if (r->options.multi_process) {
+        if (!r->options.max_len) {
+            ilka_fail("multi_process option requires the max_len option");
+            goto fail_attach;
+        }
+        if (r->options.read_only || r->options.in_memory ||
+                r->options.huge_tlb || r->options.huge_pages) {
+            ilka_fail("multi_process option is not supported by read-only, "
+                    "in-memory or huge page regions");
+            goto fail_attach;
+        }
+    }
+
+    // Binding splits the vmas of the region which can then no longer be
+    // coalesced.
+    if (r->options.numa && !r->options.max_len) {
+        ilka_fail("numa option requires the max_len option");
+        goto fail_attach;
+    }
+
+    // Stripes are mapped chunk by chunk in vmas that can't be expanded which
+    // also rules out the modes that load or share the region.
+    if (r->options.stripe_files_len) {
+        if (!r->options.max_len) {
+            ilka_fail("stripe_files option requires the max_len option");
+            goto fail_attach;
+        }
+        if (r->options.attach || r->options.multi_process || r->options.in_memory ||
+                r->options.huge_tlb || r->options.huge_pages ||
+                r->options.persist_engine == ilka_persist_shared) {
+            ilka_fail("stripe_files option is not supported by attached, "
+                    "multi-process, in-memory, huge page or shared persist regions");
+            goto fail_attach;
+        }
+    }
+    if (!stripes_init(&r->stripes, file, &r->options)) goto fail_attach;
+
+    // Soft-dirty bits are only cleared by saves which the shared engine can't
+    // rely on as it must capture pages before they're modified. hugetlb pages
+    // don't track the bits.
+    if (r->options.persist_track == ilka_track_soft_dirty) {
+        if (r->options.multi_process || r->options.in_memory || r->options.huge_tlb ||
+                r->options.persist_engine == ilka_persist_shared) {
+            ilka_fail("soft-dirty tracking is not supported by multi-process, "
+                    "in-memory, huge tlb or shared persist regions");
+            goto fail_attach;
+        }
+    }
+
+    r->fd = r->options.in_memory ?
+        file_memfd(file, &r->options) : file_open(file, &r->options);
+    if (r->fd == -1) goto fail_open;
+    if (!stripes_open(&r->stripes, r->fd, &r->options)) goto fail_stripes;
+    if ((r->len = stripes_grow(&r->stripes, ILKA_PAGE_SIZE)) == -1UL) goto fail_grow;
+    if ((r->file_len = stripes_grow(&r->stripes, ilka_file_len(r, r->len))) == -1UL)
+        goto fail_grow;
+    if (!mmap_init(&r->mmap, &r->stripes, r->len, &r->options)) goto fail_mmap;
+    if (!warm_init(&r->warm, r, r->file, r->len, &r->options)) goto fail_warm;
+    if (!persist_init(&r->persist, r, r->file, &r->stripes, &r->mmap, r->len,
+                &r->warm, &r->options))
+        goto fail_persist;
 
     const struct meta * meta = meta_read(r);
     if (meta->magic != ilka_magic) {
-        if (!r->options.create) {
+        if (!r->options.create && !r->options.in_memory) {
             ilka_fail("invalid magic for file '%s'", file);
             goto fail_magic;
         }
@@ -134,6 +241,9 @@ struct ilka_region * ilka_open(const char *file, struct ilka_options *options)
         m->magic = ilka_magic;
         m->version = ilka_version;
         m->alloc = sizeof(struct meta);
+        if (r->options.multi_process) m->len = r->len;
+        m->compact = r->options.compact ? ILKA_COMPACT_MAX_LEN : 0;
+        m->region_len = r->len;
     }
 
     if (meta->version != ilka_version) {
@@ -142,28 +252,94 @@ struct ilka_region * ilka_open(const char *file, struct ilka_options *options)
         goto fail_version;
     }
 
+    // Only multi-process regions share their length through the meta header.
+    if (!!meta->len != r->options.multi_process) {
+        ilka_fail("multi_process option doesn't match the region: %s", file);
+        goto fail_multi;
+    }
+
+    if (r->options.compact && !meta->compact) {
+        ilka_fail("compact option can only be set when creating a region: %s", file);
+        goto fail_compact;
+    }
+
+    // mcheck tags live in the high bits of the offsets which don't survive
+    // being compacted.
+    if (ILKA_MCHECK && meta->compact) {
+        ilka_fail("compact regions are not supported by ILKA_MCHECK: %s", file);
+        goto fail_compact;
+    }
+
+    // A save was interrupted by a crash and completed by the journal recovery.
+    if (!r->options.read_only && meta->generation % 2) {
+        if (!ilka_gen_publish(r)) goto fail_generation;
+        ilka_gen_end(r);
+    }
+
+    // Bytes of the file past the length of the region are left over by grows
+    // that weren't saved before a crash and are reused by later grows.
+    // Read-only regions can't truncate the file so they follow its length.
+    if (!r->options.multi_process && !r->options.read_only &&
+            meta->region_len && meta->region_len < r->len)
+    {
+        mmap_shrink(&r->mmap, meta->region_len);
+        r->len = meta->region_len;
+    }
+
     if (!alloc_init(&r->alloc, r, &r->options, meta->alloc)) goto fail_alloc;
-    if (!epoch_init(&r->epoch, r, &r->options)) goto fail_epoch;
+
+    if (r->options.multi_process && !meta->epoch) {
+        ilka_off_t off = ilka_grow(r, sizeof(struct epoch_shared));
+        if (!off) goto fail_epoch_shared;
+        meta_write(r)->epoch = off;
+    }
+
+    if (!epoch_init(&r->epoch, r, &r->options, meta->epoch)) goto fail_epoch;
     if (ILKA_MCHECK) mcheck_init(&r->mcheck);
 
-    r->header_len = alloc_end(&r->alloc);
+    r->head.header_len = alloc_end(&r->alloc);
+    if (meta->epoch) r->head.header_len = meta->epoch + sizeof(struct epoch_shared);
+    if (r->options.pin_header && !ilka_pin(r, 0, r->head.header_len)) goto fail_pin;
+
+    r->head.len = &r->mmap.len;
+    r->head.base = r->mmap.base;
+    r->head.track = !r->persist.in_memory && !r->persist.multi && !r->persist.soft_dirty;
+
+    if (!tier_init(&r->tier, r, &r->mmap, &r->persist, &r->options)) goto fail_tier;
+    if (!warm_start(&r->warm)) goto fail_warm_start;
 
     return r;
 
+  fail_warm_start:
+    tier_close(&r->tier);
+  fail_tier:
+  fail_pin:
+    epoch_close(&r->epoch);
   fail_epoch:
+  fail_epoch_shared:
   fail_alloc:
+  fail_generation:
+  fail_compact:
+  fail_multi:
   fail_version:
   fail_magic:
     persist_close(&r->persist);
 
   fail_persist:
+    warm_close(&r->warm);
+
+  fail_warm:
     mmap_close(&r->mmap);
 
   fail_mmap:
   fail_grow:
+    stripes_close(&r->stripes);
+
+  fail_stripes:
     file_close(r->fd);
 
   fail_open:
+  fail_attach:
     free(r);
     return NULL;
 }
@@ -172,10 +348,27 @@ bool ilka_close(struct ilka_region *r)
 {
     if (!ilka_save(r)) return false;
 
+    // Saves stop the world which completes any deferred work but read-only
+    // regions are never saved.
+    if (r->options.read_only) {
+        ilka_world_stop(r);
+        ilka_world_resume(r);
+    }
+
+    tier_close(&r->tier);
+    warm_close(&r->warm);
     epoch_close(&r->epoch);
     persist_close(&r->persist);
 
     if (!mmap_close(&r->mmap)) return false;
+
+    // The length of a multi-process region is owned by the region.
+    size_t file_len = ilka_file_len(r, r->len);
+    if (!r->options.multi_process && r->file_len > file_len) {
+        if (!stripes_truncate(&r->stripes, file_len)) return false;
+    }
+
+    if (!stripes_close(&r->stripes)) return false;
     if (!file_close(r->fd)) return false;
     free(r);
 
@@ -185,40 +378,146 @@ bool ilka_close(struct ilka_region *r)
 bool ilka_rm(struct ilka_region *r)
 {
     const char *file = r->file;
+    bool in_memory = r->options.in_memory;
+    struct ilka_stripes stripes = r->stripes;
+
     if (!ilka_close(r)) return false;
-    return file_rm(file);
+    if (in_memory) return true;
+    return warm_rm(file) && stripes_rm(&stripes) && file_rm(file);
 }
 
 
 size_t ilka_len(struct ilka_region *r)
 {
+    // morder_acquire: synchronizes with ilka_grow_multi to ensure that the file
+    // is grown before any of the new range is accessed.
+    if (r->options.multi_process)
+        return ilka_atomic_load(&meta_read(r)->len, morder_acquire);
+
     return ilka_atomic_load(&r->len, morder_relaxed);
 }
 
-ilka_off_t ilka_grow(struct ilka_region *r, size_t len)
+static bool ilka_grow_compact(struct ilka_region *r, ilka_off_t off, size_t len)
+{
+    size_t max_len = meta_read(r)->compact;
+    if (!max_len) return true;
+    if (off + len <= max_len) return true;
+
+    ilka_fail("compact region exceeds max length: %p + %p > %p",
+            (void *) off, (void *) len, (void *) max_len);
+    return false;
+}
+
+// The entire reservation is already mapped so growing a multi-process region
+// only requires growing the file while holding the lock stored in the region.
+static ilka_off_t ilka_grow_multi(struct ilka_region *r, size_t len)
+{
+    ilka_slock *lock =
+        ilka_write_sys(r, offsetof(struct meta, lock), sizeof(ilka_slock));
+    slock_lock(lock);
+
+    ilka_off_t off = meta_read(r)->len;
+    size_t new_len = off + len;
+
+    if (new_len > r->options.max_len) {
+        ilka_fail("region exceeds max_len: %p + %p > %p",
+                (void *) off, (void *) len, (void *) r->options.max_len);
+        goto fail;
+    }
+
+    if (!ilka_grow_compact(r, off, len)) goto fail;
+
+    if (file_grow(r->fd, new_len) == -1) goto fail;
+
+    // morder_release: ensure that the file is grown before publishing the new
+    // size.
+    ilka_atomic_store(&meta_write(r)->len, new_len, morder_release);
+
+    slock_unlock(lock);
+    return off;
+
+  fail:
+    slock_unlock(lock);
+    return 0;
+}
+
+// A grown range can't straddle two vmas so the end of the last vma is skipped
+// if it can't be expanded. The skipped range starts at slack and ends at the
+// returned offset; it's part of the region and must be handed to the page
+// allocator by the caller.
+static ilka_off_t ilka_grow_slack(struct ilka_region *r, size_t len, ilka_off_t *slack)
 {
     len = ceil_div(len, ILKA_PAGE_SIZE) * ILKA_PAGE_SIZE;
+    if (r->options.multi_process) {
+        ilka_off_t off = ilka_grow_multi(r, len);
+        *slack = off;
+        return off;
+    }
 
     slock_lock(&r->lock);
 
-    size_t old_len = r->len;
-    size_t new_len = old_len + len;
+    if (!ilka_grow_compact(r, r->len, len)) goto fail;
+
+    *slack = r->len;
+    ilka_off_t off = mmap_remap(&r->mmap, len);
+    if (!off) goto fail;
 
-    file_grow(r->fd, new_len);
-    if (!mmap_remap(&r->mmap, old_len, new_len)) goto fail_remap;
+    size_t new_len = off + len;
+    if (new_len > r->file_len && !ilka_file_grow(r, new_len)) goto fail;
+    mmap_commit(&r->mmap, new_len);
 
     // morder_release: ensure that the region is fully grown before publishing
     // the new size.
     ilka_atomic_store(&r->len, new_len, morder_release);
 
     slock_unlock(&r->lock);
-    return old_len;
+    return off;
 
-  fail_remap:
+  fail:
     slock_unlock(&r->lock);
     return 0;
 }
 
+ilka_off_t ilka_grow(struct ilka_region *r, size_t len)
+{
+    ilka_off_t slack;
+    ilka_off_t off = ilka_grow_slack(r, len, &slack);
+    if (off && slack < off) alloc_release(&r->alloc, slack, off - slack);
+    return off;
+}
+
+bool ilka_compact(struct ilka_region *r)
+{
+    return meta_read(r)->compact;
+}
+
+// Grows are serialized by the region lock or by the lock stored in the region
+// for multi-process regions so the length can't move past the cap.
+bool ilka_compact_cap(struct ilka_region *r, size_t len)
+{
+    if (!ilka_compact(r)) {
+        ilka_fail("compact cap requires a compact region");
+        return false;
+    }
+
+    ilka_slock *lock = &r->lock;
+    if (r->options.multi_process)
+        lock = ilka_write_sys(r, offsetof(struct meta, lock), sizeof(ilka_slock));
+    slock_lock(lock);
+
+    bool ret = true;
+    size_t region_len = ilka_len(r);
+    if (region_len > len) {
+        ilka_fail("compact region already exceeds cap: %p > %p",
+                (void *) region_len, (void *) len);
+        ret = false;
+    }
+    else if (len < meta_read(r)->compact) meta_write(r)->compact = len;
+
+    slock_unlock(lock);
+    return ret;
+}
+
 ilka_off_t ilka_get_root(struct ilka_region *r)
 {
     return meta_read(r)->root;
@@ -229,11 +528,115 @@ void ilka_set_root(struct ilka_region *r, ilka_off_t root)
     meta_write(r)->root = root;
 }
 
+static size_t ilka_file_len(struct ilka_region *r, size_t len)
+{
+    if (r->options.read_only) return len;
+    if (!r->options.huge_tlb && !r->options.huge_pages) return len;
+    return ceil_div(len, ILKA_HUGE_PAGE_SIZE) * ILKA_HUGE_PAGE_SIZE;
+}
+
+static bool ilka_file_grow(struct ilka_region *r, size_t len)
+{
+    size_t inc = r->options.grow_len;
+    if (r->options.grow_pct) {
+        size_t pct = (r->file_len / 100) * r->options.grow_pct;
+        if (pct > inc) inc = pct;
+    }
+
+    if (len < r->file_len + inc) len = r->file_len + inc;
+    len = ceil_div(ilka_file_len(r, len), ILKA_PAGE_SIZE) * ILKA_PAGE_SIZE;
+
+    bool ret = r->options.grow_prealloc ?
+        stripes_alloc(&r->stripes, r->file_len, len) :
+        stripes_truncate(&r->stripes, len);
+    if (!ret) return false;
+
+    r->file_len = len;
+    return true;
+}
+
+// Only shrinks if the region still ends at end which might not be the case if
+// the region was grown concurrently.
+static bool ilka_shrink_len(struct ilka_region *r, size_t len, size_t end)
+{
+    // Other processes could still be using the tail of a multi-process region.
+    if (r->options.multi_process) return false;
+
+    slock_lock(&r->lock);
+
+    bool ret = r->len == end;
+    if (ret) {
+        mmap_shrink(&r->mmap, len);
+        ilka_atomic_store(&r->len, len, morder_release);
+    }
+
+    slock_unlock(&r->lock);
+    return ret;
+}
+
+// The file can only be truncated once the allocator state that no longer
+// references the tail has been saved. Shrinks are serialized by the caller so
+// the region can't have shrunk below the length of the save.
+static bool ilka_file_trim(struct ilka_region *r)
+{
+    slock_lock(&r->lock);
+
+    bool ret = true;
+    size_t len = ilka_file_len(r, r->len);
+    if (len < r->file_len) {
+        if ((ret = stripes_truncate(&r->stripes, len))) r->file_len = len;
+    }
+
+    slock_unlock(&r->lock);
+    return ret;
+}
+
+// Punching a hole in a range must also wait for the save that marks the range
+// as free which would otherwise be restored with zeroes after a crash.
+static bool ilka_punch(struct ilka_region *r, ilka_off_t off, size_t len)
+{
+    if (!stripes_punch(&r->stripes, off, len)) return false;
+    mmap_reclaim(&r->mmap, off, len);
+    return true;
+}
+
+// Saves the region while releasing the free pages at its end if the run is at
+// least shrink_len bytes long and punching holes in free runs that are at
+// least punch_len bytes long.
+static bool ilka_release_save(struct ilka_region *r, size_t shrink_len)
+{
+    bool ret = false;
+    size_t punch_len = r->options.punch_len;
+
+    slock_lock(&r->release_lock);
+
+    bool shrunk = shrink_len && alloc_shrink(&r->alloc, shrink_len);
+    if (punch_len && !alloc_punch_prepare(&r->alloc, punch_len)) goto done;
+
+    ret = persist_save(&r->persist);
+    if (ret && shrunk) ret = ilka_file_trim(r);
+    if (punch_len && !alloc_punch(&r->alloc, ret)) ret = false;
+
+  done:
+    slock_unlock(&r->release_lock);
+    return ret;
+}
+
 static bool ilka_is_edge(struct ilka_region *r, ilka_off_t off)
 {
     return mmap_is_edge(&r->mmap, off);
 }
 
+static void ilka_reclaim(struct ilka_region *r, ilka_off_t off, size_t len)
+{
+    mmap_reclaim(&r->mmap, off, len);
+}
+
+static bool ilka_bind(struct ilka_region *r, ilka_off_t off, size_t len, size_t node)
+{
+    return mmap_bind(&r->mmap, off, len, node);
+}
+
 const void * ilka_read_sys(struct ilka_region *r, ilka_off_t off, size_t len)
 {
     return mmap_access(&r->mmap, off, len);
@@ -246,19 +649,21 @@ void * ilka_write_sys(struct ilka_region *r, ilka_off_t off, size_t len)
     return ptr;
 }
 
-const void * ilka_read(struct ilka_region *r, ilka_off_t off, size_t len)
+const void * ilka_read_slow(struct ilka_region *r, ilka_off_t off, size_t len)
 {
     mcheck_tag_t tag = ILKA_MCHECK ? mcheck_untag(&off) : 0;
-    ilka_assert(off >= r->header_len, "invalid read offset: %p", (void *) off);
+    ilka_debug_assert(off >= r->head.header_len,
+            "invalid read offset: %p", (void *) off);
     if (ILKA_MCHECK) mcheck_access(&r->mcheck, off, len, tag);
 
     return mmap_access(&r->mmap, off, len);
 }
 
-void * ilka_write(struct ilka_region *r, ilka_off_t off, size_t len)
+void * ilka_write_slow(struct ilka_region *r, ilka_off_t off, size_t len)
 {
     mcheck_tag_t tag = ILKA_MCHECK ? mcheck_untag(&off) : 0;
-    ilka_assert(off >= r->header_len, "invalid write offset: %p", (void *) off);
+    ilka_debug_assert(off >= r->head.header_len,
+            "invalid write offset: %p", (void *) off);
     if (ILKA_MCHECK) mcheck_access(&r->mcheck, off, len, tag);
 
     void *ptr = mmap_access(&r->mmap, off, len);
@@ -266,22 +671,102 @@ void * ilka_write(struct ilka_region *r, ilka_off_t off, size_t len)
     return ptr;
 }
 
+void ilka_prefetch(struct ilka_region *r, ilka_off_t off, size_t len)
+{
+    if (ILKA_MCHECK) mcheck_untag(&off);
+    mmap_prefetch(&r->mmap, off, len);
+}
+
+bool ilka_pin(struct ilka_region *r, ilka_off_t off, size_t len)
+{
+    if (ILKA_MCHECK) mcheck_untag(&off);
+    return mmap_pin(&r->mmap, off, len);
+}
+
+bool ilka_advise(
+        struct ilka_region *r, ilka_off_t off, size_t len, enum ilka_advice advice)
+{
+    if (ILKA_MCHECK) mcheck_untag(&off);
+
+    int value;
+    switch (advice) {
+    case ilka_advice_normal: value = MADV_NORMAL; break;
+    case ilka_advice_willneed: value = MADV_WILLNEED; break;
+    case ilka_advice_sequential: value = MADV_SEQUENTIAL; break;
+    case ilka_advice_random: value = MADV_RANDOM; break;
+    default:
+        ilka_fail("unknown advice: %d", advice);
+        return false;
+    }
+
+    return mmap_madvise(&r->mmap, off, len, value);
+}
+
 bool ilka_save(struct ilka_region *r)
 {
+    if (r->options.read_only) return true;
+    if (r->options.shrink_len || r->options.punch_len)
+        return ilka_release_save(r, r->options.shrink_len);
     return persist_save(&r->persist);
 }
 
+// Releasing pages requires the save to be durable before returning.
+bool ilka_save_async(struct ilka_region *r, void (*cb) (void *, bool), void *data)
+{
+    if (r->options.read_only || r->options.shrink_len || r->options.punch_len) {
+        if (!ilka_save(r)) return false;
+        cb(data, true);
+        return true;
+    }
+
+    return persist_save_async(&r->persist, cb, data);
+}
+
+bool ilka_save_poll(struct ilka_region *r)
+{
+    if (r->options.read_only) return true;
+    return persist_poll(&r->persist);
+}
+
+bool ilka_persist_stats(struct ilka_region *r, struct ilka_persist_stats *stats)
+{
+    return persist_stats(&r->persist, stats);
+}
+
+void ilka_dbg_save_queued(struct ilka_region *r, void (*fn) (void *), void *data)
+{
+    r->persist.dbg_queued = fn;
+    r->persist.dbg_queued_data = data;
+}
+
+bool ilka_soft_dirty_supported(void)
+{
+    return pagemap_supported();
+}
+
+bool ilka_tier_stats(struct ilka_region *r, struct ilka_tier_stats *stats)
+{
+    return tier_stats(&r->tier, stats);
+}
+
+bool ilka_shrink(struct ilka_region *r)
+{
+    return ilka_release_save(r, ILKA_PAGE_SIZE);
+}
+
 ilka_off_t ilka_alloc(struct ilka_region *r, size_t len)
 {
-    return ilka_alloc_in(r, len, ilka_tid());
+    return ilka_alloc_in(r, len, alloc_area(&r->alloc));
 }
 
 ilka_off_t ilka_alloc_in(struct ilka_region *r, size_t len, size_t area)
 {
     ilka_off_t off = alloc_new(&r->alloc, len, area);
 
-    ilka_assert(off + len <= ilka_len(r), "invalid alloc offset: %p", (void *) off);
-    ilka_assert(!off || off >= r->header_len, "invalid alloc offset: %p", (void *) off);
+    ilka_debug_assert(off + len <= ilka_len(r),
+            "invalid alloc offset: %p", (void *) off);
+    ilka_debug_assert(!off || off >= r->head.header_len,
+            "invalid alloc offset: %p", (void *) off);
 
     if (ILKA_MCHECK) {
         mcheck_tag_t tag = mcheck_tag_next();
@@ -300,15 +785,17 @@ ilka_off_t ilka_alloc_in(struct ilka_region *r, size_t len, size_t area)
 
 void ilka_free(struct ilka_region *r, ilka_off_t off, size_t len)
 {
-    ilka_free_in(r, off, len, ilka_tid());
+    ilka_free_in(r, off, len, alloc_area(&r->alloc));
 }
 
 void ilka_free_in(struct ilka_region *r, ilka_off_t off, size_t len, size_t area)
 {
     mcheck_tag_t tag = ILKA_MCHECK ? mcheck_untag(&off) : 0;
 
-    ilka_assert(off + len <= ilka_len(r), "invalid free offset: %p", (void *) off);
-    ilka_assert(off >= r->header_len, "invalid free offset: %p", (void *) off);
+    ilka_debug_assert(off + len <= ilka_len(r),
+            "invalid free offset: %p", (void *) off);
+    ilka_debug_assert(off >= r->head.header_len,
+            "invalid free offset: %p", (void *) off);
 
     if (ILKA_ALLOC_FILL_ON_FREE)
         memset(ilka_write(r, off, len), 0xFF, len);
@@ -320,7 +807,7 @@ void ilka_free_in(struct ilka_region *r, ilka_off_t off, size_t len, size_t area
 
 bool ilka_defer_free(struct ilka_region *r, ilka_off_t off, size_t len)
 {
-    return ilka_defer_free_in(r, off, len, ilka_tid());
+    return ilka_defer_free_in(r, off, len, alloc_area(&r->alloc));
 }
 
 bool ilka_defer_free_in(
@@ -354,3 +841,89 @@ void ilka_world_resume(struct ilka_region *r)
 {
     epoch_world_resume(&r->epoch);
 }
+
+
+// -----------------------------------------------------------------------------
+// generation
+// -----------------------------------------------------------------------------
+
+// Every save bumps the generation to an odd value before it starts writing to
+// the file and to the next even value once the file is fully written which
+// allows attached processes to detect a torn read.
+
+static uint64_t ilka_gen_read(struct ilka_region *r)
+{
+    // morder_acquire: synchronizes with the writes of the saving process such
+    // that reads made after this load don't observe a save that precedes it.
+    return ilka_atomic_load(&meta_read(r)->generation, morder_acquire);
+}
+
+// Must be called while the world is stopped and before the marks are swapped
+// which ensures that the meta page is part of the save. The meta page is at
+// the start of the region so it's the first range to be written to the file.
+static void ilka_gen_begin(struct ilka_region *r)
+{
+    struct meta *meta = meta_write(r);
+    meta->region_len = ilka_len(r);
+
+    uint64_t gen = (meta->generation + 1) | 1;
+    ilka_atomic_store(&meta->generation, gen, morder_release);
+}
+
+static void ilka_gen_end(struct ilka_region *r)
+{
+    uint64_t gen = meta_read(r)->generation + 1;
+    ilka_atomic_store(&meta_write(r)->generation, gen, morder_release);
+}
+
+// Writes the end of the save straight to the file without going through the
+// mapping which is what the persist process does.
+static bool ilka_gen_publish(struct ilka_region *r)
+{
+    uint64_t gen = meta_read(r)->generation + 1;
+    off_t off = offsetof(struct meta, generation);
+
+    ssize_t ret = pwrite(r->fd, &gen, sizeof(gen), off);
+    if (ret == -1) {
+        ilka_fail_errno("unable to write generation: %s", r->file);
+        return false;
+    }
+    if (ret != sizeof(gen)) {
+        ilka_fail("incomplete write of generation: %lu != %lu", ret, sizeof(gen));
+        return false;
+    }
+
+    return true;
+}
+
+bool ilka_follow(struct ilka_region *r, uint64_t *gen)
+{
+    while ((*gen = ilka_gen_read(r)) % 2) {
+        if (!ilka_nsleep(100 * 1000)) return false;
+    }
+
+    ssize_t len = file_len(r->fd);
+    if (len == -1) return false;
+
+    slock_lock(&r->lock);
+
+    bool ret = true;
+    if ((size_t) len > r->len) ret = mmap_follow(&r->mmap, len);
+    else if ((size_t) len < r->len) mmap_shrink(&r->mmap, len);
+
+    if (ret) {
+        r->file_len = len;
+
+        // morder_release: ensure that the region is fully mapped before
+        // publishing the new size.
+        ilka_atomic_store(&r->len, len, morder_release);
+    }
+
+    slock_unlock(&r->lock);
+    return ret;
+}
+
+bool ilka_changed(struct ilka_region *r, uint64_t gen)
+{
+    return ilka_gen_read(r) != gen;
+}
@@ -11,18 +11,142 @@
 // options
 // -----------------------------------------------------------------------------
 
+// ilka_persist_fork saves a snapshot of the region from a forked process which
+// journals the dirty ranges before writing them to the file.
+//
+// ilka_persist_shared maps the file shared and flushes the dirty ranges in
+// place. The content of a page is written to an undo log before it's first
+// modified after a save which is used to roll back the file after a crash.
+enum ilka_persist_engine
+{
+    ilka_persist_fork = 0,
+    ilka_persist_shared = 1,
+};
+
+// ilka_track_marks marks the cache lines touched by every ilka_write in
+// per-thread sets which are merged when the region is saved.
+//
+// ilka_track_soft_dirty leaves the tracking to the kernel which flags the pages
+// that are written to as soft-dirty. ilka_write is a plain translation but the
+// first write to a page after a save costs a minor fault, saves are done at
+// page granularity and only one region per process can use it. Writes made
+// outside of an epoch can be missed if they race with a save and lost if they
+// race with persist_reclaim. Only supported by the fork persist engine.
+enum ilka_persist_track
+{
+    ilka_track_marks = 0,
+    ilka_track_soft_dirty = 1,
+};
+
 struct ilka_options
 {
     bool open;
     bool create;
     bool read_only;
 
+    // attaches to a region owned by another process in read-only mode. The
+    // region follows the saves of its owner through ilka_follow.
+    bool attach;
+
+    // allows multiple processes to write to the region concurrently. The
+    // region must be created with the option and requires max_len as it's
+    // mapped shared at a fixed address. The epochs and allocator locks are
+    // stored in the region and ilka_save only flushes the file which is
+    // durable but not crash consistent. Regions can't shrink in this mode.
+    // The epochs of a process that dies are ignored once it's reaped but a
+    // process dying while it holds the allocator or meta lock is unsupported
+    // as the state they guard can't be recovered and leaves them held.
+    bool multi_process;
+
+    // backs the region with anonymous memory which is discarded on close. The
+    // region is never persisted so writes aren't tracked and ilka_save is a
+    // no-op.
+    bool in_memory;
+
+    // huge_tlb backs the region with pages from the hugetlb pool while
+    // huge_pages relies on transparent huge pages. Both load the region into
+    // anonymous memory and grow the file in huge page increments.
     bool huge_tlb;
+    bool huge_pages;
+
     bool populate;
     size_t vma_reserved;
 
+    // records which parts of the region are dirtied by saves in a profile
+    // stored next to the region. On open, warm_threads threads fault in the
+    // region in order of hotness in the background.
+    bool warm;
+    size_t warm_threads;
+
+    // a background pass runs every tier_freq_usec and advises the chunks of the
+    // region that weren't written to for tier_cold_passes passes out of
+    // memory with MADV_COLD or MADV_PAGEOUT if tier_pageout is set. Paged out
+    // chunks that are faulted back in are considered hot again. Private pages
+    // can only be paged out to swap which makes persist_reclaim a good fit.
+    bool tier;
+    bool tier_pageout;
+    size_t tier_cold_passes;
+    size_t tier_freq_usec;
+
+    // locks the region header in memory which holds the allocator's metadata.
+    bool pin_header;
+
+    // reserves the address space for the entire region up-front; the region
+    // can't grow beyond this length.
+    size_t max_len;
+
+    // stripes the region over its file and the stripe_files_len files of
+    // stripe_files in chunks of stripe_len bytes, 64MB by default, which must
+    // be a multiple of the huge page size. Saves and journal recoveries write
+    // to every file in parallel. The files must be listed in the same order
+    // every time the region is opened and the array must outlive the region.
+    // Requires max_len and isn't supported by attached, multi-process,
+    // in-memory, huge page or shared persist engine regions.
+    const char * const *stripe_files;
+    size_t stripe_files_len;
+    size_t stripe_len;
+
+    // The file grows by at least grow_len bytes or by grow_pct percent of its
+    // current length, whichever is larger. grow_prealloc reserves the blocks
+    // on disk as the file grows. The unused tail is truncated on close.
+    size_t grow_len;
+    size_t grow_pct;
+    bool grow_prealloc;
+
+    // ilka_save shrinks the region if the run of free pages at its end is at
+    // least shrink_len bytes long.
+    size_t shrink_len;
+
+    // ilka_save punches a hole in the file for every run of free pages that
+    // is at least punch_len bytes long and drops its pages from memory. The
+    // pages read back as zeroes once reallocated.
+    size_t punch_len;
+
+    enum ilka_persist_engine persist_engine;
+    enum ilka_persist_track persist_track;
+
+    // drops the private copy of pages once they're saved which allows the
+    // kernel to fall back on the shared page cache. Writes that can race with
+    // a save must be made within an epoch: outside of one, a write through a
+    // pointer whose ilka_write was already collected by the save can be lost
+    // as its page is dropped. With ilka_track_soft_dirty, any such write can
+    // be lost.
+    bool persist_reclaim;
+
     size_t alloc_areas;
+
+    // maps the allocation areas to numa nodes. ilka_alloc picks an area of the
+    // node of the calling thread and the pages handed out to an area are
+    // bound to its node. Requires max_len and is ignored unless the kernel
+    // exposes more than one online numa node.
+    bool numa;
+
     size_t epoch_gc_freq_usec;
+
+    // caps the region at ILKA_COMPACT_MAX_LEN bytes which allows any of its
+    // offsets to be stored as a 32-bit ilka_coff_t. Can only be chosen when
+    // the region is created and isn't supported by ILKA_MCHECK.
+    bool compact;
 };
 
 
@@ -34,6 +158,12 @@ struct ilka_region;
 typedef uint64_t ilka_off_t;
 enum { ilka_off_bits = 64 - ILKA_MCHECK_TAG_BITS };
 
+// Allocations are always aligned on 1 << ilka_coff_shift bytes so the offsets
+// of a compact region can be scaled down to 32 bits.
+typedef uint32_t ilka_coff_t;
+enum { ilka_coff_shift = 3 };
+#define ILKA_COMPACT_MAX_LEN ((1UL << 32) << ilka_coff_shift)
+
 struct ilka_region * ilka_open(const char *file, struct ilka_options *options);
 bool ilka_close(struct ilka_region *r);
 bool ilka_rm(struct ilka_region *r);
@@ -41,14 +171,91 @@ bool ilka_rm(struct ilka_region *r);
 size_t ilka_len(struct ilka_region *r);
 ilka_off_t ilka_grow(struct ilka_region *r, size_t len);
 
+bool ilka_compact(struct ilka_region *r);
+
+// Lowers the length that a compact region can grow to. Fails if the region is
+// already longer. The cap is stored in the region and can't be raised.
+bool ilka_compact_cap(struct ilka_region *r, size_t len);
+
 ilka_off_t ilka_get_root(struct ilka_region *r);
 void ilka_set_root(struct ilka_region *r, ilka_off_t root);
 
-const void * ilka_read(struct ilka_region *r, ilka_off_t off, size_t len);
-void * ilka_write(struct ilka_region *r, ilka_off_t off, size_t len);
+const void * ilka_read_slow(struct ilka_region *r, ilka_off_t off, size_t len);
+void * ilka_write_slow(struct ilka_region *r, ilka_off_t off, size_t len);
+
+enum ilka_advice
+{
+    ilka_advice_normal = 0,
+    ilka_advice_willneed = 1,
+    ilka_advice_sequential = 2,
+    ilka_advice_random = 3,
+};
+
+void ilka_prefetch(struct ilka_region *r, ilka_off_t off, size_t len);
+bool ilka_pin(struct ilka_region *r, ilka_off_t off, size_t len);
+bool ilka_advise(
+        struct ilka_region *r, ilka_off_t off, size_t len, enum ilka_advice advice);
 
 bool ilka_save(struct ilka_region *r);
 
+// Invokes cb with the outcome of a save whose snapshot is taken after the call
+// once it's durable. Never waits on another save: the snapshot is taken before
+// returning if no save is in progress and otherwise the request is queued and
+// its snapshot is taken by the next ilka_save_poll, ilka_save or ilka_close.
+// The save is completed by the first of those to find its persist process
+// exited and cb is invoked from that thread with ilka_err set on failure,
+// including when the queued save fails to start. Saves of regions that aren't
+// saved by the fork engine or that release pages on save are synchronous and
+// invoke cb before returning. Returns false without invoking cb if the request
+// couldn't be queued.
+bool ilka_save_async(struct ilka_region *r, void (*cb) (void *, bool), void *data);
+
+// Completes the pending asynchronous save if its persist process has exited
+// and starts the queued ones. Never blocks and returns false while a save is
+// still in progress or queued. Like ilka_save, must not be called from within
+// an epoch.
+bool ilka_save_poll(struct ilka_region *r);
+
+// hot_len and cold_len are the current number of bytes on either side of the
+// cold threshold while advised_len and refault_len are totals of the bytes
+// advised out and of the bytes faulted back in afterwards. failed_passes
+// counts the passes that failed and were retried on the next interval.
+struct ilka_tier_stats
+{
+    size_t passes;
+    size_t failed_passes;
+    size_t hot_len;
+    size_t cold_len;
+    size_t advised_len;
+    size_t refault_len;
+};
+
+// Returns false if tiering is disabled for the region.
+bool ilka_tier_stats(struct ilka_region *r, struct ilka_tier_stats *stats);
+
+// saves is the number of completed saves and saved_len is the total number of
+// dirty bytes that they wrote to the journal or flushed to the file.
+struct ilka_persist_stats
+{
+    size_t saves;
+    size_t saved_len;
+};
+
+// Returns false if the writes to the region aren't tracked.
+bool ilka_persist_stats(struct ilka_region *r, struct ilka_persist_stats *stats);
+
+// Invokes fn from every caller of ilka_save once it's queued up for the next
+// save and before it can lead one. Only meant for tests that need to control
+// how callers are batched and must be set before any save is started.
+void ilka_dbg_save_queued(struct ilka_region *r, void (*fn) (void *), void *data);
+
+// Returns true if the kernel supports the ilka_track_soft_dirty option.
+bool ilka_soft_dirty_supported(void);
+
+// Releases the run of free pages at the end of the region, saves the region
+// and truncates the file.
+bool ilka_shrink(struct ilka_region *r);
+
 ilka_off_t ilka_alloc(struct ilka_region *r, size_t len);
 ilka_off_t ilka_alloc_in(struct ilka_region *r, size_t len, size_t area);
 void ilka_free(struct ilka_region *r, ilka_off_t off, size_t len);
@@ -56,9 +263,81 @@ void ilka_free_in(struct ilka_region *r, ilka_off_t off, size_t len, size_t area
 bool ilka_defer_free(struct ilka_region *r, ilka_off_t off, size_t len);
 bool ilka_defer_free_in(struct ilka_region *r, ilka_off_t off, size_t len, size_t area);
 
+// Waits for any in-progress save of the owning process to complete and maps
+// the region up to its saved length. Reads made afterwards are consistent if
+// ilka_changed returns false for the returned generation once they're done.
+// Consistent reads are only provided by the fork persist engine; a region
+// saved by the shared engine is modified in place as it's written to.
+bool ilka_follow(struct ilka_region *r, uint64_t *gen);
+bool ilka_changed(struct ilka_region *r, uint64_t gen);
+
 bool ilka_enter(struct ilka_region *r);
 void ilka_exit(struct ilka_region *r);
 bool ilka_defer(struct ilka_region *r, void (*fn) (void *), void *data);
 
 void ilka_world_stop(struct ilka_region *r);
 void ilka_world_resume(struct ilka_region *r);
+
+
+// -----------------------------------------------------------------------------
+// access
+// -----------------------------------------------------------------------------
+
+#ifndef ILKA_MCHECK
+# define ILKA_MCHECK 0
+#endif
+
+// Leading fields of every region which allow accesses to be translated inline.
+// base is only set if the region is mapped in a single reservation and track
+// is set if writes must be marked for the next save. Everything else goes
+// through the out-of-line slow path.
+struct ilka_region_head
+{
+    uint8_t *base;
+    const size_t *len;
+    size_t header_len;
+    bool track;
+};
+
+static inline const void * ilka_read(
+        struct ilka_region *r, ilka_off_t off, size_t len)
+{
+    const struct ilka_region_head *head = (const struct ilka_region_head *) r;
+    if (ILKA_MCHECK || !head->base) return ilka_read_slow(r, off, len);
+
+    ilka_debug_assert(off >= head->header_len,
+            "invalid read offset: %p", (void *) off);
+    ilka_debug_assert(off + len <= __atomic_load_n(head->len, __ATOMIC_ACQUIRE),
+            "out-of-bounds access: %p + %p", (void *) off, (void *) len);
+
+    return head->base + off;
+}
+
+static inline void * ilka_write(struct ilka_region *r, ilka_off_t off, size_t len)
+{
+    const struct ilka_region_head *head = (const struct ilka_region_head *) r;
+    if (ILKA_MCHECK || !head->base || head->track)
+        return ilka_write_slow(r, off, len);
+
+    ilka_debug_assert(off >= head->header_len,
+            "invalid write offset: %p", (void *) off);
+    ilka_debug_assert(off + len <= __atomic_load_n(head->len, __ATOMIC_ACQUIRE),
+            "out-of-bounds access: %p + %p", (void *) off, (void *) len);
+
+    return head->base + off;
+}
+
+static inline ilka_coff_t ilka_off_compact(ilka_off_t off)
+{
+    ilka_debug_assert(!(off & ((1UL << ilka_coff_shift) - 1)),
+            "unaligned compact offset: %p", (void *) off);
+    ilka_debug_assert(off < ILKA_COMPACT_MAX_LEN,
+            "out-of-range compact offset: %p", (void *) off);
+
+    return off >> ilka_coff_shift;
+}
+
+static inline ilka_off_t ilka_off_expand(ilka_coff_t off)
+{
+    return ((ilka_off_t) off) << ilka_coff_shift;
+}
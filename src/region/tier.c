@@ -0,0 +1,308 @@
+/* tier.c
+   Rémi Attab (remi.attab@gmail.com), 16 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Cold-range tiering. A background thread periodically ages the chunks of the
+   region that weren't written to since its last pass and advises the chunks
+   that reach the cold threshold out of memory. Reads are only observed once a
+   paged out chunk is faulted back in which mincore reveals.
+*/
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+enum { tier_chunk_bits = 21 };
+static const size_t tier_chunk_len = 1UL << tier_chunk_bits;
+
+static const size_t tier_default_cold_passes = 8;
+static const size_t tier_default_freq_usec = 1000UL * 1000;
+static const size_t tier_sleep_usec = 10UL * 1000;
+static const size_t tier_batch_chunks = 64;
+
+#ifndef MADV_COLD
+# define MADV_COLD 20
+#endif
+
+#ifndef MADV_PAGEOUT
+# define MADV_PAGEOUT 21
+#endif
+
+
+// -----------------------------------------------------------------------------
+// structs
+// -----------------------------------------------------------------------------
+
+// A cold chunk is only out once it's been paged out which fails for private
+// pages if there's no swap.
+struct tier_chunk
+{
+    uint8_t age;
+    bool cold;
+    bool out;
+};
+
+struct ilka_tier
+{
+    struct ilka_region *region;
+    struct ilka_mmap *mmap;
+    struct ilka_persist *persist;
+
+    bool enabled;
+    int advice;
+    size_t cold_passes;
+    size_t freq_usec;
+
+    struct tier_chunk *chunks;
+    bool *dirty;
+    size_t chunks_len;
+
+    ilka_slock lock;
+    struct ilka_tier_stats stats;
+
+    pthread_t thread;
+    bool stop;
+};
+
+
+// -----------------------------------------------------------------------------
+// pass
+// -----------------------------------------------------------------------------
+
+static bool tier_reserve(struct ilka_tier *t, size_t chunks)
+{
+    if (chunks <= t->chunks_len) return true;
+
+    struct tier_chunk *new_chunks =
+        realloc(t->chunks, chunks * sizeof(struct tier_chunk));
+    if (!new_chunks) {
+        ilka_fail("out-of-memory for tier chunks: %lu", chunks);
+        return false;
+    }
+    memset(new_chunks + t->chunks_len, 0,
+            (chunks - t->chunks_len) * sizeof(struct tier_chunk));
+    t->chunks = new_chunks;
+
+    bool *dirty = realloc(t->dirty, chunks * sizeof(bool));
+    if (!dirty) {
+        ilka_fail("out-of-memory for tier dirty chunks: %lu", chunks);
+        return false;
+    }
+    t->dirty = dirty;
+
+    t->chunks_len = chunks;
+    return true;
+}
+
+// The marks of the threads are collected into the persist marks which are
+// read under the marks lock to prevent a save from swapping and freeing them.
+static void tier_dirty(struct ilka_tier *t, size_t region_len)
+{
+    memset(t->dirty, 0, t->chunks_len * sizeof(bool));
+
+    persist_collect(t->persist, NULL);
+
+    slock_lock(&t->persist->marks_lock);
+    const struct marks_node *marks = t->persist->marks;
+
+    size_t len;
+    for (ilka_off_t off = marks_next(marks, 0, &len);
+         off != marks_nil && marks_clip(off, &len, region_len);
+         off = marks_next(marks, off + len, &len))
+    {
+        size_t first = off >> tier_chunk_bits;
+        size_t last = (off + len - 1) >> tier_chunk_bits;
+        for (size_t chunk = first; chunk <= last; ++chunk) t->dirty[chunk] = true;
+    }
+
+    slock_unlock(&t->persist->marks_lock);
+}
+
+// Must be called from within an epoch so that the chunk can't be unmapped by a
+// shrink while it's being advised.
+static bool tier_chunk(
+        struct ilka_tier *t, size_t i, size_t region_len, struct ilka_tier_stats *stats)
+{
+    struct tier_chunk *chunk = &t->chunks[i];
+
+    ilka_off_t off = i << tier_chunk_bits;
+    size_t len = tier_chunk_len;
+    if (off + len > region_len) len = region_len - off;
+
+    if (t->dirty[i]) {
+        chunk->age = 0;
+        chunk->cold = chunk->out = false;
+    }
+
+    else if (chunk->out) {
+        if (mmap_resident(t->mmap, off, len)) {
+            chunk->age = 0;
+            chunk->cold = chunk->out = false;
+            stats->refault_len += len;
+        }
+    }
+
+    else {
+        if (chunk->age < UINT8_MAX) chunk->age++;
+
+        // Dirty pages and pages under writeback are skipped by the kernel
+        // so paging out is retried until the chunk is evicted.
+        bool retry = chunk->cold && t->advice == MADV_PAGEOUT;
+        retry = retry && chunk->age < UINT8_MAX;
+
+        if (retry || (!chunk->cold && chunk->age >= t->cold_passes)) {
+            if (!mmap_madvise(t->mmap, off, len, t->advice)) return false;
+
+            if (!chunk->cold) stats->advised_len += len;
+            chunk->cold = true;
+
+            // Cold pages are left resident so there's no refault to detect.
+            if (t->advice == MADV_PAGEOUT)
+                chunk->out = !mmap_resident(t->mmap, off, len);
+        }
+    }
+
+    if (chunk->cold) stats->cold_len += len;
+    else stats->hot_len += len;
+
+    return true;
+}
+
+// The epoch is only held for a batch of chunks at a time as saves stop the
+// world and would otherwise wait on the entire pass. The region can shrink
+// between batches and the chunks added by a grow are left to the next pass.
+static bool tier_pass(struct ilka_tier *t)
+{
+    size_t region_len = ilka_len(t->region);
+    size_t chunks = ceil_div(region_len, tier_chunk_len);
+    if (!tier_reserve(t, chunks)) return false;
+
+    tier_dirty(t, region_len);
+
+    struct ilka_tier_stats stats = t->stats;
+    stats.passes++;
+    stats.hot_len = stats.cold_len = 0;
+
+    bool ret = true;
+    for (size_t first = 0; ret && first < chunks; first += tier_batch_chunks) {
+        if (!(ret = ilka_enter(t->region))) break;
+
+        region_len = ilka_len(t->region);
+        size_t last = first + tier_batch_chunks;
+        if (last > chunks) last = chunks;
+        if (last > ceil_div(region_len, tier_chunk_len))
+            last = ceil_div(region_len, tier_chunk_len);
+
+        for (size_t i = first; ret && i < last; ++i)
+            ret = tier_chunk(t, i, region_len, &stats);
+
+        ilka_exit(t->region);
+    }
+
+    // The chunks advised or refaulted before a failure are kept in the totals
+    // but the hot and cold lengths of a partial pass are meaningless.
+    if (!ret) {
+        stats.hot_len = t->stats.hot_len;
+        stats.cold_len = t->stats.cold_len;
+    }
+
+    slock_lock(&t->lock);
+    t->stats = stats;
+    slock_unlock(&t->lock);
+
+    return ret;
+}
+
+static void * tier_thread(void *data)
+{
+    struct ilka_tier *t = data;
+
+    while (true) {
+        for (size_t slept = 0; slept < t->freq_usec; slept += tier_sleep_usec) {
+            if (ilka_atomic_load(&t->stop, morder_relaxed)) return NULL;
+
+            size_t usec = t->freq_usec - slept;
+            if (usec > tier_sleep_usec) usec = tier_sleep_usec;
+            ilka_nsleep(usec * 1000);
+        }
+
+        // Failed passes are retried on the next interval.
+        if (!tier_pass(t)) {
+            ilka_perror(&ilka_err);
+
+            slock_lock(&t->lock);
+            t->stats.failed_passes++;
+            slock_unlock(&t->lock);
+        }
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// basics
+// -----------------------------------------------------------------------------
+
+static bool tier_init(
+        struct ilka_tier *t,
+        struct ilka_region *r,
+        struct ilka_mmap *mmap,
+        struct ilka_persist *persist,
+        struct ilka_options *options)
+{
+    memset(t, 0, sizeof(struct ilka_tier));
+    if (!options->tier) return true;
+
+    // Writes to in-memory and multi-process regions aren't tracked and hugetlb
+    // pages can't be paged out.
+    if (options->in_memory || options->multi_process || options->huge_tlb) {
+        ilka_fail("tier option is not supported by in-memory, multi-process "
+                "or huge tlb regions");
+        return false;
+    }
+
+    t->region = r;
+    t->mmap = mmap;
+    t->persist = persist;
+    t->advice = options->tier_pageout ? MADV_PAGEOUT : MADV_COLD;
+    slock_init(&t->lock);
+
+    t->cold_passes = options->tier_cold_passes;
+    if (!t->cold_passes) t->cold_passes = tier_default_cold_passes;
+    if (t->cold_passes > UINT8_MAX) t->cold_passes = UINT8_MAX;
+
+    t->freq_usec = options->tier_freq_usec;
+    if (!t->freq_usec) t->freq_usec = tier_default_freq_usec;
+
+    int err = pthread_create(&t->thread, NULL, tier_thread, t);
+    if (err) {
+        ilka_fail_ierrno(err, "unable to pthread_create tier thread");
+        return false;
+    }
+
+    t->enabled = true;
+    return true;
+}
+
+static void tier_close(struct ilka_tier *t)
+{
+    if (!t->enabled) return;
+
+    ilka_atomic_store(&t->stop, true, morder_relaxed);
+
+    int err = pthread_join(t->thread, NULL);
+    if (err) ilka_fail_ierrno(err, "unable to pthread_join tier thread");
+
+    if (t->chunks) free(t->chunks);
+    if (t->dirty) free(t->dirty);
+}
+
+static bool tier_stats(struct ilka_tier *t, struct ilka_tier_stats *stats)
+{
+    if (!t->enabled) return false;
+
+    slock_lock(&t->lock);
+    *stats = t->stats;
+    slock_unlock(&t->lock);
+
+    return true;
+}
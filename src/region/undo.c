@@ -0,0 +1,428 @@
+/* undo.c
+   Rémi Attab (remi.attab@gmail.com), 16 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Undo log for the shared persist engine. The file is mapped shared so the
+   kernel is free to write back a page at any point. Before a page is first
+   modified after a save, its content is appended to the undo log and synced
+   which allows recovery to roll the file back to the last save.
+
+   A save rotates the current log into the previous log. Once the region is
+   flushed, the previous log is removed. Recovery applies the current log and
+   then the previous log which restores the file to the last completed save.
+*/
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+static const char *undo_ext = ".undo";
+static const char *undo_prev_ext = ".undo.prev";
+static const uint64_t undo_magic = 0x5A1D7C0E9B3F2A61;
+
+// Captured pages are tracked in lazily allocated chunks of bitmap which cover
+// the 48 bits of the address space in which the region is mapped.
+enum
+{
+    undo_addr_bits = 48,
+    undo_chunk_bits = 32,
+    undo_chunk_pages = (1UL << undo_chunk_bits) / ILKA_PAGE_SIZE,
+    undo_chunk_words = undo_chunk_pages / 64,
+    undo_chunks = 1UL << (undo_addr_bits - undo_chunk_bits),
+};
+
+
+// -----------------------------------------------------------------------------
+// structs
+// -----------------------------------------------------------------------------
+
+struct ilka_packed undo_node
+{
+    ilka_off_t off;
+    size_t len;
+    uint64_t hash;
+};
+
+struct ilka_undo
+{
+    struct ilka_region *region;
+    char *file;
+    char *prev_file;
+
+    int fd;
+    int prev_fd;
+
+    size_t len;
+
+    ilka_slock lock;
+    uint64_t **pages;
+};
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static char * undo_get_file(const char* file, const char *ext)
+{
+    size_t n = strlen(file) + strlen(ext) + 1;
+
+    char *buf = malloc(n);
+    if (!buf) {
+        ilka_fail("out-of-memory to construct undo file: %lu", n);
+        return NULL;
+    }
+
+    snprintf(buf, n, "%s%s", file, ext);
+    return buf;
+}
+
+static uint64_t undo_hash(ilka_off_t off, size_t len, const void *data)
+{
+    const uint64_t prime = 0x100000001B3;
+    const uint64_t *it = data;
+
+    uint64_t hash = undo_magic;
+    hash = (hash ^ off) * prime;
+    hash = (hash ^ len) * prime;
+    for (size_t i = 0; i < len / sizeof(uint64_t); ++i)
+        hash = (hash ^ it[i]) * prime;
+
+    return hash;
+}
+
+// Creating, renaming or unlinking a log is only durable once its directory
+// is synced.
+static bool undo_sync_dir(const char *file)
+{
+    char *dir = strdup(file);
+    if (!dir) {
+        ilka_fail("out-of-memory to sync undo dir: %s", file);
+        return false;
+    }
+
+    char *sep = strrchr(dir, '/');
+    if (!sep) strcpy(dir, ".");
+    else if (sep == dir) sep[1] = '\0';
+    else sep[0] = '\0';
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        ilka_fail_errno("unable to open undo dir: %s", dir);
+        goto fail;
+    }
+
+    if (fsync(fd) == -1) {
+        ilka_fail_errno("unable to fsync undo dir: %s", dir);
+        close(fd);
+        goto fail;
+    }
+
+    close(fd);
+    free(dir);
+    return true;
+
+  fail:
+    free(dir);
+    return false;
+}
+
+static int undo_open(const char *file)
+{
+    int flags = O_CREAT | O_TRUNC | O_WRONLY | O_APPEND | O_DSYNC;
+
+    int fd = open(file, flags, 0764);
+    if (fd == -1) {
+        ilka_fail_errno("unable to create undo log: %s", file);
+        return -1;
+    }
+
+    if (!undo_sync_dir(file)) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+// -----------------------------------------------------------------------------
+// basics
+// -----------------------------------------------------------------------------
+
+static bool undo_init(
+        struct ilka_undo *u, struct ilka_region *r, const char *file, size_t len)
+{
+    memset(u, 0, sizeof(struct ilka_undo));
+
+    u->region = r;
+    u->len = len;
+    u->prev_fd = -1;
+    slock_init(&u->lock);
+
+    u->file = undo_get_file(file, undo_ext);
+    if (!u->file) goto fail_file;
+
+    u->prev_file = undo_get_file(file, undo_prev_ext);
+    if (!u->prev_file) goto fail_prev_file;
+
+    u->pages = calloc(undo_chunks, sizeof(uint64_t *));
+    if (!u->pages) {
+        ilka_fail("out-of-memory for undo pages: %lu",
+                undo_chunks * sizeof(uint64_t *));
+        goto fail_pages;
+    }
+
+    if ((u->fd = undo_open(u->file)) == -1) goto fail_open;
+
+    return true;
+
+  fail_open:
+    free(u->pages);
+  fail_pages:
+    free(u->prev_file);
+  fail_prev_file:
+    free(u->file);
+  fail_file:
+    return false;
+}
+
+// Only called after a successful save so the log holds nothing of value.
+static void undo_close(struct ilka_undo *u)
+{
+    if (close(u->fd) == -1) ilka_fail_errno("unable to close undo log: %s", u->file);
+    if (unlink(u->file) == -1) ilka_fail_errno("unable to unlink undo log: %s", u->file);
+
+    for (size_t i = 0; i < undo_chunks; ++i) {
+        if (u->pages[i]) free(u->pages[i]);
+    }
+
+    free(u->pages);
+    free(u->prev_file);
+    free(u->file);
+}
+
+
+// -----------------------------------------------------------------------------
+// capture
+// -----------------------------------------------------------------------------
+
+static bool undo_write(struct ilka_undo *u, ilka_off_t off, size_t len)
+{
+    const void *ptr = ilka_read_sys(u->region, off, len);
+
+    struct undo_node node = { off, len, undo_hash(off, len, ptr) };
+    struct iovec iov[] = {
+        { .iov_base = &node, .iov_len = sizeof(node) },
+        { .iov_base = (void *) ptr, .iov_len = len },
+    };
+
+    ssize_t ret = writev(u->fd, iov, 2);
+    if (ret == -1) {
+        ilka_fail_errno("unable to write to undo log: %s", u->file);
+        return false;
+    }
+
+    if ((size_t) ret != sizeof(node) + len) {
+        ilka_fail("incomplete write to undo log: %lu != %lu", ret, sizeof(node) + len);
+        return false;
+    }
+
+    return true;
+}
+
+static bool undo_capture_page(struct ilka_undo *u, size_t page)
+{
+    size_t chunk = page / undo_chunk_pages;
+    ilka_assert(chunk < undo_chunks, "invalid undo page: %p", (void *) page);
+
+    size_t word = (page % undo_chunk_pages) / 64;
+    uint64_t mask = 1UL << (page % 64);
+
+    // morder_acquire: the pre-image must be durable before the page is
+    // modified which is synchronized by the release on the page bit.
+    uint64_t *pages = ilka_atomic_load(&u->pages[chunk], morder_acquire);
+    if (pages && ilka_atomic_load(&pages[word], morder_acquire) & mask)
+        return true;
+
+    bool ret = false;
+    slock_lock(&u->lock);
+
+    if (!(pages = u->pages[chunk])) {
+        pages = calloc(undo_chunk_words, sizeof(uint64_t));
+        if (!pages) {
+            ilka_fail("out-of-memory for undo pages: %lu",
+                    undo_chunk_words * sizeof(uint64_t));
+            goto done;
+        }
+
+        ilka_atomic_store(&u->pages[chunk], pages, morder_release);
+    }
+
+    if (!(pages[word] & mask)) {
+        if (!undo_write(u, page * ILKA_PAGE_SIZE, ILKA_PAGE_SIZE)) goto done;
+        ilka_atomic_fetch_or(&pages[word], mask, morder_release);
+    }
+
+    ret = true;
+
+  done:
+    slock_unlock(&u->lock);
+    return ret;
+}
+
+// Pages past the length of the last save are not referenced by the saved
+// state and don't need to be restored.
+static bool undo_capture(struct ilka_undo *u, ilka_off_t off, size_t len)
+{
+    ilka_off_t end = off + len;
+    if (end > u->len) end = u->len;
+
+    for (size_t page = off / ILKA_PAGE_SIZE; page * ILKA_PAGE_SIZE < end; ++page) {
+        if (!undo_capture_page(u, page)) return false;
+    }
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// save
+// -----------------------------------------------------------------------------
+
+// Requires the world to be stopped such that no pages are modified while the
+// capture set is reset.
+static bool undo_rotate(struct ilka_undo *u, size_t len)
+{
+    if (rename(u->file, u->prev_file) == -1) {
+        ilka_fail_errno("unable to rename undo log: %s", u->file);
+        return false;
+    }
+
+    u->prev_fd = u->fd;
+    if ((u->fd = undo_open(u->file)) == -1) return false;
+
+    for (size_t i = 0; i < undo_chunks; ++i) {
+        if (u->pages[i]) memset(u->pages[i], 0, undo_chunk_words * sizeof(uint64_t));
+    }
+
+    u->len = len;
+    return true;
+}
+
+static bool undo_commit(struct ilka_undo *u)
+{
+    if (unlink(u->prev_file) == -1) {
+        ilka_fail_errno("unable to unlink undo log: %s", u->prev_file);
+        return false;
+    }
+
+    if (!undo_sync_dir(u->prev_file)) return false;
+
+    if (close(u->prev_fd) == -1)
+        ilka_fail_errno("unable to close undo log: %s", u->prev_file);
+    u->prev_fd = -1;
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// recover
+// -----------------------------------------------------------------------------
+
+static bool undo_read(int fd, void *ptr, size_t len)
+{
+    ssize_t ret = read(fd, ptr, len);
+    if (ret == -1) {
+        ilka_fail_errno("unable to read from undo log");
+        return false;
+    }
+    return (size_t) ret == len;
+}
+
+// A torn record can only be the last one in the log and its page was never
+// modified so it's safe to stop there.
+static bool undo_apply(const char *file, int region_fd)
+{
+    int fd = open(file, O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT) return true;
+        ilka_fail_errno("unable to open undo log: %s", file);
+        return false;
+    }
+
+    uint8_t buf[ILKA_PAGE_SIZE];
+    struct undo_node node;
+
+    while (undo_read(fd, &node, sizeof(node))) {
+        if (node.len > sizeof(buf)) break;
+        if (!undo_read(fd, buf, node.len)) break;
+        if (node.hash != undo_hash(node.off, node.len, buf)) break;
+
+        ssize_t ret = pwrite(region_fd, buf, node.len, node.off);
+        if (ret == -1) {
+            ilka_fail_errno("unable to write to region from undo log: %s", file);
+            goto fail;
+        }
+        if ((size_t) ret != node.len) {
+            ilka_fail("incomplete write to region: %lu != %lu", ret, node.len);
+            goto fail;
+        }
+    }
+
+    close(fd);
+    return true;
+
+  fail:
+    close(fd);
+    return false;
+}
+
+static bool undo_recover(const char *file)
+{
+    bool ret = false;
+
+    char *undo_file = undo_get_file(file, undo_ext);
+    if (!undo_file) goto fail_file;
+
+    char *prev_file = undo_get_file(file, undo_prev_ext);
+    if (!prev_file) goto fail_prev_file;
+
+    if (access(undo_file, F_OK) && access(prev_file, F_OK)) {
+        ret = true;
+        goto done;
+    }
+
+    int region_fd = open(file, O_WRONLY);
+    if (region_fd == -1) {
+        ilka_fail_errno("unable to open region: %s", file);
+        goto done;
+    }
+
+    // The current log restores the state of the last save and the previous
+    // log restores the state of the save before it if it didn't complete.
+    if (!undo_apply(undo_file, region_fd)) goto fail_apply;
+    if (!undo_apply(prev_file, region_fd)) goto fail_apply;
+
+    if (fdatasync(region_fd) == -1) {
+        ilka_fail_errno("unable to fsync region: %s", file);
+        goto fail_apply;
+    }
+
+    if (unlink(undo_file) == -1 && errno != ENOENT)
+        ilka_fail_errno("unable to unlink undo log: %s", undo_file);
+    if (unlink(prev_file) == -1 && errno != ENOENT)
+        ilka_fail_errno("unable to unlink undo log: %s", prev_file);
+
+    ret = true;
+
+  fail_apply:
+    close(region_fd);
+  done:
+    free(prev_file);
+  fail_prev_file:
+    free(undo_file);
+  fail_file:
+    return ret;
+}
@@ -0,0 +1,329 @@
+/* warm.c
+   Rémi Attab (remi.attab@gmail.com), 16 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Region warm-up. Every save bumps the heat of the chunks that were dirtied
+   and the resulting profile is stored next to the region. On open, a pool of
+   threads faults in the chunks of the profile from hottest to coldest while
+   the region is being used.
+*/
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+static const char *warm_ext = ".warm";
+static const uint64_t warm_magic = 0x3C5E0B1D92A7F468;
+
+enum { warm_chunk_bits = 21 };
+static const size_t warm_chunk_len = 1UL << warm_chunk_bits;
+
+
+// -----------------------------------------------------------------------------
+// structs
+// -----------------------------------------------------------------------------
+
+struct ilka_packed warm_header
+{
+    uint64_t magic;
+    uint64_t chunks;
+};
+
+struct ilka_warm
+{
+    struct ilka_region *region;
+    char *file;
+    bool record;
+
+    uint32_t *heat;
+    size_t chunks;
+
+    size_t *order;
+    size_t order_len;
+    size_t next;
+
+    size_t threads;
+    pthread_t *pool;
+    bool stop;
+};
+
+
+// -----------------------------------------------------------------------------
+// profile
+// -----------------------------------------------------------------------------
+
+static bool warm_reserve(struct ilka_warm *w, size_t chunks)
+{
+    if (chunks <= w->chunks) return true;
+
+    uint32_t *heat = realloc(w->heat, chunks * sizeof(uint32_t));
+    if (!heat) {
+        ilka_fail("out-of-memory for warm heat: %lu", chunks * sizeof(uint32_t));
+        return false;
+    }
+
+    memset(heat + w->chunks, 0, (chunks - w->chunks) * sizeof(uint32_t));
+    w->heat = heat;
+    w->chunks = chunks;
+    return true;
+}
+
+// A missing or invalid profile leaves the region cold. So does a profile with
+// more chunks than a region of length len can hold which can only be corrupt.
+static bool warm_load(struct ilka_warm *w, size_t len)
+{
+    int fd = open(w->file, O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT) return true;
+        ilka_fail_errno("unable to open warm profile: %s", w->file);
+        return false;
+    }
+
+    bool ret = false;
+    struct warm_header header;
+
+    ssize_t n = pread(fd, &header, sizeof(header), 0);
+    if (n == -1) {
+        ilka_fail_errno("unable to read warm profile: %s", w->file);
+        goto done;
+    }
+    if ((size_t) n != sizeof(header) || header.magic != warm_magic ||
+            header.chunks > ceil_div(len, warm_chunk_len))
+    {
+        ret = true;
+        goto done;
+    }
+
+    if (!warm_reserve(w, header.chunks)) goto done;
+
+    size_t heat_len = header.chunks * sizeof(uint32_t);
+    n = pread(fd, w->heat, heat_len, sizeof(header));
+    if (n == -1) {
+        ilka_fail_errno("unable to read warm profile: %s", w->file);
+        goto done;
+    }
+    if ((size_t) n != heat_len) memset(w->heat, 0, heat_len);
+
+    ret = true;
+
+  done:
+    close(fd);
+    return ret;
+}
+
+static bool warm_write(int fd, const void *ptr, size_t len)
+{
+    ssize_t ret = write(fd, ptr, len);
+    if (ret == -1) {
+        ilka_fail_errno("unable to write to warm profile");
+        return false;
+    }
+
+    if ((size_t) ret != len) {
+        ilka_fail("incomplete write to warm profile: %lu != %lu", ret, len);
+        return false;
+    }
+
+    return true;
+}
+
+// The profile is only a hint so it's swapped in with a rename but never synced.
+static bool warm_save(struct ilka_warm *w)
+{
+    size_t n = strlen(w->file) + 5;
+    char tmp[n];
+    snprintf(tmp, n, "%s.tmp", w->file);
+
+    int fd = open(tmp, O_CREAT | O_TRUNC | O_WRONLY, 0764);
+    if (fd == -1) {
+        ilka_fail_errno("unable to create warm profile: %s", tmp);
+        return false;
+    }
+
+    struct warm_header header = { .magic = warm_magic, .chunks = w->chunks };
+    size_t len = w->chunks * sizeof(uint32_t);
+
+    if (!warm_write(fd, &header, sizeof(header))) goto fail;
+    if (len && !warm_write(fd, w->heat, len)) goto fail;
+
+    if (close(fd) == -1) {
+        ilka_fail_errno("unable to close warm profile: %s", tmp);
+        unlink(tmp);
+        return false;
+    }
+
+    if (rename(tmp, w->file) == -1) {
+        ilka_fail_errno("unable to rename warm profile: %s", tmp);
+        unlink(tmp);
+        return false;
+    }
+
+    return true;
+
+  fail:
+    close(fd);
+    unlink(tmp);
+    return false;
+}
+
+static bool warm_record(struct ilka_warm *w, ilka_off_t off, size_t len)
+{
+    size_t first = off >> warm_chunk_bits;
+    size_t last = (off + len - 1) >> warm_chunk_bits;
+    if (!warm_reserve(w, last + 1)) return false;
+
+    for (size_t i = first; i <= last; ++i) {
+        if (w->heat[i] != UINT32_MAX) w->heat[i]++;
+    }
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// threads
+// -----------------------------------------------------------------------------
+
+static void * warm_thread(void *data)
+{
+    struct ilka_warm *w = data;
+
+    while (!ilka_atomic_load(&w->stop, morder_relaxed)) {
+        size_t i = ilka_atomic_fetch_add(&w->next, 1, morder_relaxed);
+        if (i >= w->order_len) break;
+
+        // The region can be remapped by a coalesce or shrunk so its length is
+        // read and accessed within an epoch.
+        if (!ilka_enter(w->region)) break;
+
+        size_t region_len = ilka_len(w->region);
+        ilka_off_t start = w->order[i] << warm_chunk_bits;
+        ilka_off_t end = start + warm_chunk_len;
+        if (end > region_len) end = region_len;
+
+        uint64_t sum = 0;
+        for (ilka_off_t off = start; off < end; off += ILKA_PAGE_SIZE)
+            sum += *((const uint8_t *) ilka_read_sys(w->region, off, 1));
+        ilka_no_opt_val(sum);
+
+        ilka_exit(w->region);
+    }
+
+    return NULL;
+}
+
+static int warm_cmp(const void *lhs, const void *rhs, void *data)
+{
+    const uint32_t *heat = data;
+    uint32_t l = heat[*((const size_t *) lhs)];
+    uint32_t r = heat[*((const size_t *) rhs)];
+    return l < r ? 1 : (l > r ? -1 : 0);
+}
+
+static bool warm_start(struct ilka_warm *w)
+{
+    if (!w->file) return true;
+
+    w->order = calloc(w->chunks ? w->chunks : 1, sizeof(size_t));
+    if (!w->order) {
+        ilka_fail("out-of-memory for warm order: %lu", w->chunks * sizeof(size_t));
+        return false;
+    }
+
+    for (size_t i = 0; i < w->chunks; ++i) {
+        if (w->heat[i]) w->order[w->order_len++] = i;
+    }
+    if (!w->order_len) return true;
+
+    qsort_r(w->order, w->order_len, sizeof(size_t), warm_cmp, w->heat);
+
+    w->pool = calloc(w->threads, sizeof(pthread_t));
+    if (!w->pool) {
+        ilka_fail("out-of-memory for warm threads: %lu", w->threads);
+        return false;
+    }
+
+    for (size_t i = 0; i < w->threads; ++i) {
+        int err = pthread_create(&w->pool[i], NULL, warm_thread, w);
+        if (err) {
+            ilka_fail_ierrno(err, "unable to pthread_create warm thread");
+            w->threads = i;
+            goto fail;
+        }
+    }
+
+    return true;
+
+  fail:
+    ilka_atomic_store(&w->stop, true, morder_relaxed);
+    for (size_t i = 0; i < w->threads; ++i) pthread_join(w->pool[i], NULL);
+
+    free(w->pool);
+    w->pool = NULL;
+    return false;
+}
+
+
+// -----------------------------------------------------------------------------
+// basics
+// -----------------------------------------------------------------------------
+
+static bool warm_init(
+        struct ilka_warm *w,
+        struct ilka_region *r,
+        const char *file,
+        size_t len,
+        struct ilka_options *options)
+{
+    memset(w, 0, sizeof(struct ilka_warm));
+    if (!options->warm || options->in_memory) return true;
+
+    w->region = r;
+    w->record = !options->read_only;
+    w->threads = options->warm_threads ? options->warm_threads : ilka_cpus();
+
+    size_t n = strlen(file) + strlen(warm_ext) + 1;
+    w->file = malloc(n);
+    if (!w->file) {
+        ilka_fail("out-of-memory to construct warm file: %lu", n);
+        goto fail_file;
+    }
+    snprintf(w->file, n, "%s%s", file, warm_ext);
+
+    if (!warm_load(w, len)) goto fail_load;
+
+    return true;
+
+  fail_load:
+    if (w->heat) free(w->heat);
+    free(w->file);
+  fail_file:
+    return false;
+}
+
+static bool warm_rm(const char *file)
+{
+    size_t n = strlen(file) + strlen(warm_ext) + 1;
+    char warm_file[n];
+    snprintf(warm_file, n, "%s%s", file, warm_ext);
+
+    if (!unlink(warm_file) || errno == ENOENT) return true;
+
+    ilka_fail_errno("unable to unlink warm profile: %s", warm_file);
+    return false;
+}
+
+static void warm_close(struct ilka_warm *w)
+{
+    ilka_atomic_store(&w->stop, true, morder_relaxed);
+
+    for (size_t i = 0; w->pool && i < w->threads; ++i) {
+        int err = pthread_join(w->pool[i], NULL);
+        if (err) ilka_fail_ierrno(err, "unable to pthread_join warm thread");
+    }
+
+    if (w->pool) free(w->pool);
+    if (w->order) free(w->order);
+    if (w->heat) free(w->heat);
+    if (w->file) free(w->file);
+}
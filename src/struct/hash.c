@@ -58,6 +58,7 @@ struct ilka_hash
 {
     struct ilka_region *region;
     ilka_off_t meta;
+    bool compact;
 };
 
 
@@ -103,7 +104,8 @@ static enum ret_code check_key(const void *key, size_t key_len)
     return ret_ok;
 }
 
-static enum ret_code check_value(const char *name, ilka_off_t value)
+static enum ret_code check_value(
+        struct ilka_hash *ht, const char *name, ilka_off_t value)
 {
     // Required to disambiguate return values (not-there vs there but wrong
     // value) and the value 0 is used internally to determined whether a bucket
@@ -118,6 +120,11 @@ static enum ret_code check_value(const char *name, ilka_off_t value)
         return ret_err;
     }
 
+    if (!word_check(ht, value)) {
+        ilka_fail("invalid compact offset for '%s': %p", name, (void *) value);
+        return ret_err;
+    }
+
     return ret_ok;
 }
 
@@ -126,7 +133,7 @@ static enum ret_code check_value(const char *name, ilka_off_t value)
 // basics
 // -----------------------------------------------------------------------------
 
-struct ilka_hash * ilka_hash_alloc(struct ilka_region *region)
+static struct ilka_hash * hash_alloc(struct ilka_region *region, bool compact)
 {
     struct ilka_hash *ht = malloc(sizeof(struct ilka_hash));
     if (!ht) {
@@ -136,18 +143,39 @@ struct ilka_hash * ilka_hash_alloc(struct ilka_region *region)
     }
 
     ht->region = region;
+    ht->compact = compact;
     ht->meta = ilka_alloc(region, sizeof(struct hash_meta));
     if (!ht->meta) goto fail_meta;
 
     struct hash_meta *meta = ilka_write(region, ht->meta, sizeof(struct hash_meta));
     memset(meta, 0, sizeof(struct hash_meta));
+    meta->compact = compact;
     return ht;
 
-    free(ht);
   fail_meta:
+    free(ht);
     return NULL;
 }
 
+struct ilka_hash * ilka_hash_alloc(struct ilka_region *region)
+{
+    return hash_alloc(region, false);
+}
+
+struct ilka_hash * ilka_hash_alloc_compact(struct ilka_region *region)
+{
+    if (!ilka_compact(region)) {
+        ilka_fail("compact hash requires a compact region");
+        return NULL;
+    }
+
+    // The state bits of the words leave room for the offsets of the first 8GB
+    // of the region only.
+    if (!ilka_compact_cap(region, cword_max_off)) return NULL;
+
+    return hash_alloc(region, true);
+}
+
 bool ilka_hash_free(struct ilka_hash *ht)
 {
     const struct hash_table *table = meta_table(ht);
@@ -165,6 +193,10 @@ struct ilka_hash * ilka_hash_open(struct ilka_region *region, ilka_off_t off)
     ht->region = region;
     ht->meta = off;
 
+    const struct hash_meta *meta =
+        ilka_read(region, off, sizeof(struct hash_meta));
+    ht->compact = meta->compact;
+
     return ht;
 
     free(ht);
@@ -248,7 +280,7 @@ struct ilka_hash_ret ilka_hash_put(
         struct ilka_hash *ht, const void *key, size_t key_len, ilka_off_t value)
 {
     if (check_key(key, key_len)) return make_ret(ret_err, 0);
-    if (check_value("value", value)) return make_ret(ret_err, 0);
+    if (check_value(ht, "value", value)) return make_ret(ret_err, 0);
 
     const struct hash_table *table = meta_ensure_table(ht, default_cap);
     if (!table) return make_ret(ret_err, 0);
@@ -279,7 +311,7 @@ struct ilka_hash_ret ilka_hash_xchg(
         struct ilka_hash *ht, const void *key, size_t key_len, ilka_off_t value)
 {
     if (check_key(key, key_len)) return make_ret(ret_err, 0);
-    if (check_value("value", value)) return make_ret(ret_err, 0);
+    if (check_value(ht, "value", value)) return make_ret(ret_err, 0);
 
     return hash_xchg(ht, key, key_len, 0, value);
 }
@@ -292,8 +324,8 @@ struct ilka_hash_ret ilka_hash_cmp_xchg(
         ilka_off_t value)
 {
     if (check_key(key, key_len)) return make_ret(ret_err, 0);
-    if (check_value("value", value)) return make_ret(ret_err, 0);
-    if (check_value("expected", expected)) return make_ret(ret_err, 0);
+    if (check_value(ht, "value", value)) return make_ret(ret_err, 0);
+    if (check_value(ht, "expected", expected)) return make_ret(ret_err, 0);
 
     return hash_xchg(ht, key, key_len, expected, value);
 }
@@ -330,7 +362,7 @@ struct ilka_hash_ret ilka_hash_cmp_del(
         ilka_off_t expected)
 {
     if (check_key(key, key_len)) return make_ret(ret_err, 0);
-    if (check_value("expected", expected)) return make_ret(ret_err, 0);
+    if (check_value(ht, "expected", expected)) return make_ret(ret_err, 0);
 
     return hash_del(ht, key, key_len, expected);
 }
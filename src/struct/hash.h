@@ -15,6 +15,11 @@
 struct ilka_hash;
 
 struct ilka_hash * ilka_hash_alloc(struct ilka_region *r);
+
+// Stores the keys and values as 32-bit offsets which halves the size of the
+// buckets. Requires a compact region no longer than 8GB which is capped at that
+// length through ilka_compact_cap. Values must be 8-byte aligned.
+struct ilka_hash * ilka_hash_alloc_compact(struct ilka_region *r);
 bool ilka_hash_free(struct ilka_hash *h);
 
 struct ilka_hash * ilka_hash_open(struct ilka_region *r, ilka_off_t off);
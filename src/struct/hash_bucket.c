@@ -36,30 +36,133 @@ static inline enum state state_get(ilka_off_t v) { return (v >> state_shift) & 0
 static inline ilka_off_t state_clear(ilka_off_t v) { return v & ~(0x3UL << state_shift); }
 static inline ilka_off_t state_trans(ilka_off_t v, enum state s)
 {
-    ilka_assert(state_get(v) < s,
+    ilka_debug_assert(state_get(v) < s,
             "invalid state transition: %d -> %d", state_get(v), s);
     return state_clear(v) | (((ilka_off_t) s) << state_shift);
 }
 
 
+// -----------------------------------------------------------------------------
+// word
+// -----------------------------------------------------------------------------
+//
+// The words of compact buckets hold a scaled 32-bit offset with the state in
+// its top bits. They're expanded to the regular layout when loaded so the rest
+// of the bucket code is oblivious to the width of the words.
+//
+// The state bits leave 30 bits for the offset which only covers the first 8GB
+// of a compact region rather than the full ILKA_COMPACT_MAX_LEN so compact
+// hashes cap their region at cword_max_off.
+
+enum { cstate_shift = 32 - state_bits };
+
+static const ilka_off_t cword_max_off = (1UL << cstate_shift) << ilka_coff_shift;
+
+static inline bool word_check(struct ilka_hash *ht, ilka_off_t off)
+{
+    if (!ht->compact) return true;
+    return off < cword_max_off && !(off & ((1UL << ilka_coff_shift) - 1));
+}
+
+static inline ilka_off_t word_expand(uint32_t word)
+{
+    ilka_off_t off = ilka_off_expand(word & ~(0x3U << cstate_shift));
+    return off | (((ilka_off_t) (word >> cstate_shift)) << state_shift);
+}
+
+static inline uint32_t word_compact(ilka_off_t v)
+{
+    return ilka_off_compact(state_clear(v)) | (state_get(v) << cstate_shift);
+}
+
+static inline ilka_off_t word_load(struct ilka_hash *ht, const void *word)
+{
+    if (!ht->compact)
+        return ilka_atomic_load((const ilka_off_t *) word, morder_relaxed);
+    return word_expand(ilka_atomic_load((const uint32_t *) word, morder_relaxed));
+}
+
+static inline bool word_cmp_xchg(
+        struct ilka_hash *ht,
+        void *word,
+        ilka_off_t *expected,
+        ilka_off_t value,
+        enum morder mo)
+{
+    if (!ht->compact)
+        return ilka_atomic_cmp_xchg((ilka_off_t *) word, expected, value, mo);
+
+    uint32_t old = word_compact(*expected);
+    bool ret = ilka_atomic_cmp_xchg((uint32_t *) word, &old, word_compact(value), mo);
+    *expected = word_expand(old);
+    return ret;
+}
+
+
 // -----------------------------------------------------------------------------
 // bucket
 // -----------------------------------------------------------------------------
 //
 // \todo: This code needs a review of the morder.
 
+// Only used to type the buckets; the key and val words of a bucket must be
+// accessed through the bucket_key and bucket_val functions.
 struct ilka_packed hash_bucket
 {
     ilka_off_t key;
     ilka_off_t val;
 };
 
+struct ilka_packed hash_cbucket
+{
+    uint32_t key;
+    uint32_t val;
+};
+
+static inline size_t bucket_len(struct ilka_hash *ht)
+{
+    return ht->compact ? sizeof(struct hash_cbucket) : sizeof(struct hash_bucket);
+}
+
+static inline ilka_off_t bucket_key(
+        struct ilka_hash *ht, const struct hash_bucket *bucket)
+{
+    return word_load(ht, bucket);
+}
+
+static inline ilka_off_t bucket_val(
+        struct ilka_hash *ht, const struct hash_bucket *bucket)
+{
+    return word_load(ht, ((const uint8_t *) bucket) + bucket_len(ht) / 2);
+}
+
+static inline bool bucket_cmp_xchg_key(
+        struct ilka_hash *ht,
+        struct hash_bucket *bucket,
+        ilka_off_t *expected,
+        ilka_off_t value,
+        enum morder mo)
+{
+    return word_cmp_xchg(ht, bucket, expected, value, mo);
+}
+
+static inline bool bucket_cmp_xchg_val(
+        struct ilka_hash *ht,
+        struct hash_bucket *bucket,
+        ilka_off_t *expected,
+        ilka_off_t value,
+        enum morder mo)
+{
+    void *word = ((uint8_t *) bucket) + bucket_len(ht) / 2;
+    return word_cmp_xchg(ht, word, expected, value, mo);
+}
+
 static struct ilka_hash_ret bucket_get(
         struct ilka_hash *ht,
         const struct hash_bucket *bucket,
         struct hash_key *key)
 {
-    ilka_off_t old_key = ilka_atomic_load(&bucket->key, morder_relaxed);
+    ilka_off_t old_key = bucket_key(ht, bucket);
     bucket_log("hash.bucket.get.key", "bucket=%p, value=%p", (void *) bucket, (void *) old_key);
 
     switch (state_get(old_key)) {
@@ -67,7 +170,7 @@ static struct ilka_hash_ret bucket_get(
     case state_move: return make_ret(ret_resize, 0);
 
     case state_nil: {
-        ilka_off_t val = ilka_atomic_load(&bucket->val, morder_relaxed);
+        ilka_off_t val = bucket_val(ht, bucket);
         return make_ret(state_get(val) == state_nil ? ret_stop : ret_skip, 0);
     }
 
@@ -77,7 +180,7 @@ static struct ilka_hash_ret bucket_get(
         break;
     }
 
-    ilka_off_t old_val = ilka_atomic_load(&bucket->val, morder_relaxed);
+    ilka_off_t old_val = bucket_val(ht, bucket);
     bucket_log("hash.bucket.get.val", "bucket=%p, value=%p", (void *) bucket, (void *) old_val);
 
     switch (state_get(old_val)) {
@@ -96,7 +199,7 @@ static int bucket_iterate(
         ilka_hash_fn_t fn,
         void *data)
 {
-    ilka_off_t old_key = ilka_atomic_load(&bucket->key, morder_relaxed);
+    ilka_off_t old_key = bucket_key(ht, bucket);
     bucket_log("hash.bucket.itr.key", "bucket=%p, value=%p", (void *) bucket, (void *) old_key);
 
     switch (state_get(old_key)) {
@@ -106,7 +209,7 @@ static int bucket_iterate(
     case state_set: break;
     }
 
-    ilka_off_t old_val = ilka_atomic_load(&bucket->val, morder_relaxed);
+    ilka_off_t old_val = bucket_val(ht, bucket);
     bucket_log("hash.bucket.itr.val", "bucket=%p, value=%p", (void *) bucket, (void *) old_val);
 
     switch (state_get(old_val)) {
@@ -123,33 +226,35 @@ static int bucket_iterate(
     return ret_ok;
 }
 
-static void bucket_tomb_key(struct ilka_hash *ht, ilka_off_t *val, enum morder mo)
+static void bucket_tomb_key(
+        struct ilka_hash *ht, struct hash_bucket *bucket, enum morder mo)
 {
     ilka_off_t new;
-    ilka_off_t old = ilka_atomic_load(val, morder_relaxed);
+    ilka_off_t old = bucket_key(ht, bucket);
     do {
         if (state_get(old) == state_tomb) {
             ilka_atomic_fence(mo);
             return;
         }
         new = state_trans(old, state_tomb);
-    } while (!ilka_atomic_cmp_xchg(val, &old, new, mo));
+    } while (!bucket_cmp_xchg_key(ht, bucket, &old, new, mo));
 
     if (state_get(old) != state_move)
         key_free(ht, state_clear(old));
 }
 
-static void bucket_tomb_val(ilka_off_t *val, enum morder mo)
+static void bucket_tomb_val(
+        struct ilka_hash *ht, struct hash_bucket *bucket, enum morder mo)
 {
     ilka_off_t new;
-    ilka_off_t old = ilka_atomic_load(val, morder_relaxed);
+    ilka_off_t old = bucket_val(ht, bucket);
     do {
         if (state_get(old) == state_tomb) {
             ilka_atomic_fence(mo);
             return;
         }
         new = state_trans(old, state_tomb);
-    } while (!ilka_atomic_cmp_xchg(val, &old, new, mo));
+    } while (!bucket_cmp_xchg_val(ht, bucket, &old, new, mo));
 }
 
 static struct ilka_hash_ret bucket_put(
@@ -159,7 +264,7 @@ static struct ilka_hash_ret bucket_put(
         ilka_off_t value)
 {
     ilka_off_t new_key;
-    ilka_off_t old_key = ilka_atomic_load(&bucket->key, morder_relaxed);
+    ilka_off_t old_key = bucket_key(ht, bucket);
     do {
         bucket_log("hash.bucket.put.key", "bucket=%p, value=%p", (void *) bucket, (void *) old_key);
 
@@ -176,12 +281,17 @@ static struct ilka_hash_ret bucket_put(
         case state_nil:
             if (!key->off) key_alloc(ht, key);
             if (!key->off) return make_ret(ret_err, 0);
+            if (!word_check(ht, key->off)) {
+                ilka_fail("out-of-range key offset for compact hash: %p",
+                        (void *) key->off);
+                return make_ret(ret_err, 0);
+            }
             new_key = state_trans(key->off, state_set);
             break;
         }
 
         // morder_relaxed: we can commit the key with the value set.
-    } while (!ilka_atomic_cmp_xchg(&bucket->key, &old_key, new_key, morder_relaxed));
+    } while (!bucket_cmp_xchg_key(ht, bucket, &old_key, new_key, morder_relaxed));
   break_key: (void) 0;
 
     // We just inserted the key into the table so make sure we don't reuse or
@@ -189,7 +299,7 @@ static struct ilka_hash_ret bucket_put(
     if (new_key) key->off = 0;
 
     ilka_off_t new_val;
-    ilka_off_t old_val = ilka_atomic_load(&bucket->val, morder_relaxed);
+    ilka_off_t old_val = bucket_val(ht, bucket);
     do {
         bucket_log("hash.bucket.put.val", "bucket=%p, value=%p", (void *) bucket, (void *) old_val);
 
@@ -201,7 +311,7 @@ static struct ilka_hash_ret bucket_put(
         }
 
         // morder_release: make sure both writes are commited before moving on.
-    } while (!ilka_atomic_cmp_xchg(&bucket->val, &old_val, new_val, morder_release));
+    } while (!bucket_cmp_xchg_val(ht, bucket, &old_val, new_val, morder_release));
 
     return make_ret(ret_ok, 0);
 }
@@ -213,7 +323,7 @@ static struct ilka_hash_ret bucket_xchg(
         ilka_off_t expected,
         ilka_off_t value)
 {
-    ilka_off_t old_key = ilka_atomic_load(&bucket->key, morder_relaxed);
+    ilka_off_t old_key = bucket_key(ht, bucket);
     bucket_log("hash.bucket.xch.key", "bucket=%p, value=%p", (void *) bucket, (void *) old_key);
 
     switch (state_get(old_key)) {
@@ -221,7 +331,7 @@ static struct ilka_hash_ret bucket_xchg(
     case state_move: return make_ret(ret_resize, 0);
 
     case state_nil: {
-        ilka_off_t val = ilka_atomic_load(&bucket->val, morder_relaxed);
+        ilka_off_t val = bucket_val(ht, bucket);
         return make_ret(state_get(val) == state_nil ? ret_stop : ret_skip, 0);
     }
 
@@ -232,7 +342,7 @@ static struct ilka_hash_ret bucket_xchg(
     }
 
     ilka_off_t new_val, clean_val;
-    ilka_off_t old_val = ilka_atomic_load(&bucket->val, morder_relaxed);
+    ilka_off_t old_val = bucket_val(ht, bucket);
     do {
         clean_val = state_clear(old_val);
 
@@ -253,7 +363,7 @@ static struct ilka_hash_ret bucket_xchg(
 
         // morder_release: make sure all value related writes are committed
         // before publishing it.
-    } while (!ilka_atomic_cmp_xchg(&bucket->val, &old_val, new_val, morder_release));
+    } while (!bucket_cmp_xchg_val(ht, bucket, &old_val, new_val, morder_release));
 
     return make_ret(ret_ok, clean_val);
 }
@@ -264,7 +374,7 @@ static struct ilka_hash_ret bucket_del(
         struct hash_key *key,
         ilka_off_t expected)
 {
-    ilka_off_t old_key = ilka_atomic_load(&bucket->key, morder_relaxed);
+    ilka_off_t old_key = bucket_key(ht, bucket);
     bucket_log("hash.bucket.del.key", "bucket=%p, value=%p", (void *) bucket, (void *) old_key);
 
     switch (state_get(old_key)) {
@@ -272,7 +382,7 @@ static struct ilka_hash_ret bucket_del(
     case state_move: return make_ret(ret_resize, 0);
 
     case state_nil: {
-        ilka_off_t val = ilka_atomic_load(&bucket->val, morder_relaxed);
+        ilka_off_t val = bucket_val(ht, bucket);
         return make_ret(state_get(val) == state_nil ? ret_stop : ret_skip, 0);
     }
 
@@ -283,7 +393,7 @@ static struct ilka_hash_ret bucket_del(
     }
 
     ilka_off_t new_val, clean_val;
-    ilka_off_t old_val = ilka_atomic_load(&bucket->val, morder_relaxed);
+    ilka_off_t old_val = bucket_val(ht, bucket);
     do {
         clean_val = state_clear(old_val);
 
@@ -306,10 +416,10 @@ static struct ilka_hash_ret bucket_del(
         // semantic of the sequential program (there are return statements in
         // the for-loop. As a result we can just commit this write along with
         // the tomb of the key.
-    } while (!ilka_atomic_cmp_xchg(&bucket->val, &old_val, new_val, morder_relaxed));
+    } while (!bucket_cmp_xchg_val(ht, bucket, &old_val, new_val, morder_relaxed));
 
     // morder_release: commit both the key and val writes.
-    bucket_tomb_key(ht, &bucket->key, morder_release);
+    bucket_tomb_key(ht, bucket, morder_release);
 
     return make_ret(ret_ok, state_clear(old_val));
 }
@@ -317,7 +427,7 @@ static struct ilka_hash_ret bucket_del(
 static bool bucket_lock(struct ilka_hash *ht, struct hash_bucket *bucket)
 {
     ilka_off_t new_key;
-    ilka_off_t old_key = ilka_atomic_load(&bucket->key, morder_relaxed);
+    ilka_off_t old_key = bucket_key(ht, bucket);
     do {
         bucket_log("hash.bucket.lck.key", "bucket=%p, value=%p", (void *) bucket, (void *) old_key);
 
@@ -329,13 +439,13 @@ static bool bucket_lock(struct ilka_hash *ht, struct hash_bucket *bucket)
         }
 
         // morder_relaxed: we can commit the key with the value lock.
-    } while (!ilka_atomic_cmp_xchg(&bucket->key, &old_key, new_key, morder_relaxed));
+    } while (!bucket_cmp_xchg_key(ht, bucket, &old_key, new_key, morder_relaxed));
   break_key_lock: (void) 0;
 
     enum state key_state = state_get(new_key);
 
     ilka_off_t new_val;
-    ilka_off_t old_val = ilka_atomic_load(&bucket->val, morder_relaxed);
+    ilka_off_t old_val = bucket_val(ht, bucket);
     do {
         bucket_log("hash.bucket.lck.val", "bucket=%p, value=%p", (void *) bucket, (void *) old_val);
 
@@ -347,14 +457,14 @@ static bool bucket_lock(struct ilka_hash *ht, struct hash_bucket *bucket)
         }
 
         // morder_release: make sure both locks are committed before moving on.
-    } while (!ilka_atomic_cmp_xchg(&bucket->val, &old_val, new_val, morder_release));
+    } while (!bucket_cmp_xchg_val(ht, bucket, &old_val, new_val, morder_release));
   break_val_lock: (void) 0;
 
     enum state val_state = state_get(new_val);
     if (key_state == state_move && val_state == state_tomb) {
         // morder_relaxed: this is not a linearlization point and mostly just
         // bookeeping so no ordering guarantees are required.
-        bucket_tomb_key(ht, &bucket->key, morder_relaxed);
+        bucket_tomb_key(ht, bucket, morder_relaxed);
         return false;
     }
 
@@ -372,7 +482,7 @@ static struct ilka_hash_ret bucket_move(
     ilka_assert(key->off, "invalid nil offset while moving a bucket");
 
     ilka_off_t new_key;
-    ilka_off_t old_key = ilka_atomic_load(&bucket->key, morder_relaxed);
+    ilka_off_t old_key = bucket_key(ht, bucket);
     do {
         bucket_log("hash.bucket.mov.key", "bucket=%p, value=%p", (void *) bucket, (void *) old_key);
 
@@ -412,17 +522,17 @@ static struct ilka_hash_ret bucket_move(
             // completed. Otherwise we're in scenario one and we need to retry
             // the move.
 
-            if (state_clear(ilka_atomic_load(&bucket->val, morder_relaxed)))
+            if (state_clear(bucket_val(ht, bucket)))
                 return make_ret(ret_ok, 0);
             return make_ret(ret_resize, 0);
         }
 
         // morder_relaxed: we can commit the key with the value set.
-    } while (!ilka_atomic_cmp_xchg(&bucket->key, &old_key, new_key, morder_relaxed));
+    } while (!bucket_cmp_xchg_key(ht, bucket, &old_key, new_key, morder_relaxed));
   break_key: (void) 0;
 
     ilka_off_t new_val;
-    ilka_off_t old_val = ilka_atomic_load(&bucket->val, morder_relaxed);
+    ilka_off_t old_val = bucket_val(ht, bucket);
     do {
         bucket_log("hash.bucket.mov.val", "bucket=%p, value=%p", (void *) bucket, (void *) old_val);
 
@@ -439,7 +549,7 @@ static struct ilka_hash_ret bucket_move(
         }
 
         // morder_release: make sure both writes are commited before moving on.
-    } while (!ilka_atomic_cmp_xchg(&bucket->val, &old_val, new_val, morder_release));
+    } while (!bucket_cmp_xchg_val(ht, bucket, &old_val, new_val, morder_release));
 
     return make_ret(ret_ok, 0);
 }
@@ -12,6 +12,9 @@ struct ilka_packed hash_meta
 {
     size_t len;
     ilka_off_t tables;
+
+    // set if the tables are made of compact buckets.
+    uint64_t compact;
 };
 
 static size_t meta_len(struct ilka_hash *ht)
@@ -68,7 +71,7 @@ static const struct hash_table * meta_ensure_table(struct ilka_hash *ht, size_t
 
         if (ilka_atomic_cmp_xchg(&wmeta->tables, &table_off, new_off, morder_release))
             table_off = new_off;
-        else ilka_free(ht->region, new_off, table_len(cap));
+        else ilka_free(ht->region, new_off, table_len(ht, cap));
     }
 
     ilka_assert(table_off, "unexpected nil table offset");
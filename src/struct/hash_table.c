@@ -22,6 +22,8 @@ struct ilka_packed hash_table
     // Avoids invalidating the table header when updating buckets.
     uint64_t padding[4];
 
+    // Either hash_bucket or hash_cbucket for compact hashes which is why the
+    // buckets must be indexed through table_bucket.
     struct hash_bucket buckets[];
 };
 
@@ -30,14 +32,21 @@ struct ilka_packed hash_table
 // utils
 // -----------------------------------------------------------------------------
 
-static size_t table_len(size_t cap)
+static size_t table_len(struct ilka_hash *ht, size_t cap)
 {
-    return sizeof(struct hash_table) + cap * sizeof(struct hash_bucket);
+    return sizeof(struct hash_table) + cap * bucket_len(ht);
+}
+
+static const struct hash_bucket * table_bucket(
+        struct ilka_hash *ht, const struct hash_table *table, size_t i)
+{
+    const uint8_t *buckets = (const uint8_t *) table->buckets;
+    return (const struct hash_bucket *) (buckets + i * bucket_len(ht));
 }
 
 static ilka_off_t table_alloc(struct ilka_hash *ht, size_t cap)
 {
-    size_t len = table_len(cap);
+    size_t len = table_len(ht, cap);
     ilka_off_t off = ilka_alloc(ht->region, len);
     if (!off) return 0;
 
@@ -52,7 +61,7 @@ static ilka_off_t table_alloc(struct ilka_hash *ht, size_t cap)
 
 static void table_defer_free(struct ilka_hash *ht, const struct hash_table *table)
 {
-    ilka_defer_free(ht->region, table->table_off, table_len(table->cap));
+    ilka_defer_free(ht->region, table->table_off, table_len(ht, table->cap));
 }
 
 static bool table_free(struct ilka_hash *ht, const struct hash_table *table)
@@ -63,14 +72,14 @@ static bool table_free(struct ilka_hash *ht, const struct hash_table *table)
     }
 
     for (size_t i = 0; i < table->cap; ++i) {
-        const struct hash_bucket* bucket = &table->buckets[i];
+        ilka_off_t key = bucket_key(ht, table_bucket(ht, table, i));
 
-        switch (state_get(bucket->key)) {
+        switch (state_get(key)) {
         case state_nil: break;
         case state_tomb: break;
 
         case state_set:
-            key_free(ht, state_clear(bucket->key));
+            key_free(ht, state_clear(key));
             break;
 
         case state_move:
@@ -79,7 +88,7 @@ static bool table_free(struct ilka_hash *ht, const struct hash_table *table)
         }
     }
 
-    ilka_free(ht->region, table->table_off, table_len(table->cap));
+    ilka_free(ht->region, table->table_off, table_len(ht, table->cap));
     return true;
 }
 
@@ -91,7 +100,7 @@ static bool table_free(struct ilka_hash *ht, const struct hash_table *table)
 static const struct hash_table * table_read(struct ilka_hash *ht, ilka_off_t off)
 {
     const size_t *cap = ilka_read(ht->region, off, sizeof(size_t));
-    return ilka_read(ht->region, off, table_len(*cap));
+    return ilka_read(ht->region, off, table_len(ht, *cap));
 }
 
 static struct hash_table * table_write(
@@ -104,15 +113,18 @@ struct table_window
 {
     const struct hash_table *table;
     size_t start;
-    struct hash_bucket *frames[2];
+    size_t bucket_len;
+    uint8_t *frames[2];
 };
 
 static struct hash_bucket *table_window_bucket(
         const struct table_window *wnd, size_t i)
 {
     if (wnd->start + i < wnd->table->cap)
-        return &wnd->frames[0][i];
-    return &wnd->frames[1][wnd->start + i - wnd->table->cap];
+        return (struct hash_bucket *) (wnd->frames[0] + i * wnd->bucket_len);
+
+    size_t j = wnd->start + i - wnd->table->cap;
+    return (struct hash_bucket *) (wnd->frames[1] + j * wnd->bucket_len);
 }
 
 static struct table_window table_write_window(
@@ -124,6 +136,7 @@ static struct table_window table_write_window(
     struct table_window window = {
         .table = table,
         .start = start,
+        .bucket_len = bucket_len(ht),
         .frames = { 0, 0 }
     };
 
@@ -131,13 +144,13 @@ static struct table_window table_write_window(
     if (start + len > table->cap) len = table->cap - start;
 
     window.frames[0] = ilka_write(ht->region,
-            buckets_off + (start * sizeof(struct hash_bucket)),
-            len * sizeof(struct hash_bucket));
+            buckets_off + (start * window.bucket_len),
+            len * window.bucket_len);
 
     if (len == probe_window) return window;
 
     window.frames[1] = ilka_write(ht->region,
-            buckets_off, (probe_window - len) * sizeof(struct hash_bucket));
+            buckets_off, (probe_window - len) * window.bucket_len);
 
     return window;
 }
@@ -169,9 +182,9 @@ static struct table_ret table_move_window(
 
         if (!bucket_lock(ht, src)) continue;
 
-        ilka_off_t key_off = ilka_atomic_load(&src->key, morder_relaxed);
+        ilka_off_t key_off = bucket_key(ht, src);
         struct hash_key key = key_from_off(ht, state_clear(key_off));
-        ilka_off_t val = state_clear(ilka_atomic_load(&src->val, morder_relaxed));
+        ilka_off_t val = state_clear(bucket_val(ht, src));
 
         struct ilka_hash_ret ret = table_move(ht, dst_table, &key, val);
 
@@ -186,27 +199,28 @@ static struct table_ret table_move_window(
 
         // morder_relaxed: these are not linearlization point but merely
         // bookeeping so no ordering requirements applies.
-        bucket_tomb_key(ht, &src->key, morder_relaxed);
-        bucket_tomb_val(&src->val, morder_relaxed);
+        bucket_tomb_key(ht, src, morder_relaxed);
+        bucket_tomb_val(ht, src, morder_relaxed);
     }
 
     return (struct table_ret) { ret_ok, dst_table };
 }
 
-static size_t table_resize_cap(const struct hash_table *table, size_t start)
+static size_t table_resize_cap(
+        struct ilka_hash *ht, const struct hash_table *table, size_t start)
 {
     size_t tombstones = 0;
     for (size_t i = 0; i < probe_window; ++i) {
         size_t index = (start + i) % table->cap;
-        const struct hash_bucket *bucket = &table->buckets[index];
+        const struct hash_bucket *bucket = table_bucket(ht, table, index);
 
-        ilka_off_t key = ilka_atomic_load(&bucket->key, morder_relaxed);
+        ilka_off_t key = bucket_key(ht, bucket);
         if (state_get(key) == state_tomb) {
             tombstones++;
             continue;
         }
 
-        ilka_off_t val = ilka_atomic_load(&bucket->val, morder_relaxed);
+        ilka_off_t val = bucket_val(ht, bucket);
         if (state_get(val) == state_tomb)
             tombstones++;
     }
@@ -222,7 +236,7 @@ static struct table_ret table_resize(
     ilka_off_t old_next = ilka_atomic_load(&table->next, morder_relaxed);
     if (old_next) return table_move_window(ht, table, start, probe_window);
 
-    size_t cap = table_resize_cap(table, start);
+    size_t cap = table_resize_cap(ht, table, start);
     ilka_off_t new_next = table_alloc(ht, cap);
     if (!new_next) return (struct table_ret) { ret_err, 0 };
 
@@ -231,7 +245,7 @@ static struct table_ret table_resize(
     // morder_release: ensures that the table initialization is fully committed
     // before publishing it.
     if (!ilka_atomic_cmp_xchg(&wtable->next, &old_next, new_next, morder_release)) {
-        ilka_free(ht->region, new_next, table_len(cap));
+        ilka_free(ht->region, new_next, table_len(ht, cap));
         return table_move_window(ht, table, start, probe_window);
     }
 
@@ -266,7 +280,7 @@ static bool table_reserve(
     // morder_release: ensures that the table initialization is fully committed
     // before publishing it.
     if (!ilka_atomic_cmp_xchg(&wtable->next, &old_next, new_next, morder_release)) {
-        ilka_free(ht->region, new_next, table_len(cap));
+        ilka_free(ht->region, new_next, table_len(ht, cap));
         return table_reserve(ht, table_read(ht, old_next), cap);
     }
 
@@ -297,7 +311,7 @@ static struct ilka_hash_ret table_get(
     size_t start = key_hash(key) % table->cap;
     for (size_t i = 0; i < probe_window; ++i) {
         size_t index = (start + i) % table->cap;
-        const struct hash_bucket *bucket = &table->buckets[index];
+        const struct hash_bucket *bucket = table_bucket(ht, table, index);
 
         struct ilka_hash_ret ret = bucket_get(ht, bucket, key);
         hash_log("hash.table.get", "table=%p, key=%p, bucket=%p, ret={ %d, %p }",
@@ -324,7 +338,7 @@ static int table_iterate(
         void *data)
 {
     for (size_t i = 0; i < table->cap; ++i) {
-        const struct hash_bucket *bucket = &table->buckets[i];
+        const struct hash_bucket *bucket = table_bucket(ht, table, i);
 
         int ret = bucket_iterate(ht, bucket, fn, data);
         hash_log("hash.table.itr", "table=%p, bucket=%p, ret=%d",
@@ -14,6 +14,7 @@
 // -----------------------------------------------------------------------------
 
 static const ilka_off_t list_mark = 1UL << 63;
+static const ilka_coff_t list_cmark = 1U << 31;
 
 
 // -----------------------------------------------------------------------------
@@ -25,50 +26,148 @@ struct ilka_list
     struct ilka_region *region;
     ilka_off_t head;
     size_t off;
+    bool compact;
 };
 
 
 // -----------------------------------------------------------------------------
-// basics
+// link
 // -----------------------------------------------------------------------------
+//
+// The links of compact lists are expanded to the regular layout when loaded so
+// the rest of the list code is oblivious to the width of the links.
 
-struct ilka_list * ilka_list_alloc(
-        struct ilka_region *region, ilka_off_t head_off, size_t off)
+static inline ilka_off_t link_expand(ilka_coff_t link)
 {
-    if (!head_off) {
-        ilka_fail("invalid nil head offset");
-        return NULL;
-    }
+    ilka_off_t off = ilka_off_expand(link & ~list_cmark);
+    return link & list_cmark ? off | list_mark : off;
+}
 
-    struct ilka_list *list = ilka_list_open(region, head_off, off);
-    if (!list) return NULL;
+static inline ilka_coff_t link_compact(ilka_off_t link)
+{
+    ilka_coff_t off = ilka_off_compact(link & ~list_mark);
+    return link & list_mark ? off | list_cmark : off;
+}
 
-    struct ilka_list_node *head =
-        ilka_write(region, head_off, sizeof(struct ilka_list_node));
-    head->next = 0;
+static inline ilka_off_t link_load(
+        struct ilka_list *list, const struct ilka_list_node *node)
+{
+    if (!list->compact) return ilka_atomic_load(&node->next, morder_relaxed);
 
-    return list;
+    const struct ilka_list_cnode *cnode = (const struct ilka_list_cnode *) node;
+    return link_expand(ilka_atomic_load(&cnode->next, morder_relaxed));
 }
 
-struct ilka_list * ilka_list_open(
-        struct ilka_region *region, ilka_off_t head, size_t off)
+static inline void link_store(
+        struct ilka_list *list, struct ilka_list_node *node, ilka_off_t next)
+{
+    if (!list->compact) node->next = next;
+    else ((struct ilka_list_cnode *) node)->next = link_compact(next);
+}
+
+static inline bool link_cmp_xchg(
+        struct ilka_list *list,
+        struct ilka_list_node *node,
+        ilka_off_t *expected,
+        ilka_off_t value,
+        enum morder mo)
+{
+    if (!list->compact)
+        return ilka_atomic_cmp_xchg(&node->next, expected, value, mo);
+
+    struct ilka_list_cnode *cnode = (struct ilka_list_cnode *) node;
+    ilka_coff_t old = link_compact(*expected);
+    bool ret = ilka_atomic_cmp_xchg(&cnode->next, &old, link_compact(value), mo);
+    *expected = link_expand(old);
+    return ret;
+}
+
+static inline ilka_off_t link_xchg(
+        struct ilka_list *list, struct ilka_list_node *node, ilka_off_t value)
+{
+    if (!list->compact) return ilka_atomic_xchg(&node->next, value, morder_relaxed);
+
+    struct ilka_list_cnode *cnode = (struct ilka_list_cnode *) node;
+    ilka_coff_t old = ilka_atomic_xchg(&cnode->next, link_compact(value), morder_relaxed);
+    return link_expand(old);
+}
+
+static inline size_t link_len(struct ilka_list *list)
+{
+    return list->compact ?
+        sizeof(struct ilka_list_cnode) : sizeof(struct ilka_list_node);
+}
+
+
+// -----------------------------------------------------------------------------
+// basics
+// -----------------------------------------------------------------------------
+
+static struct ilka_list * list_open(
+        struct ilka_region *region, ilka_off_t head, size_t off, bool compact)
 {
     if (!head) {
         ilka_fail("invalid nil head offset");
         return NULL;
     }
 
+    if (compact && !ilka_compact(region)) {
+        ilka_fail("compact list requires a compact region");
+        return NULL;
+    }
+
     struct ilka_list *list = calloc(1, sizeof(struct ilka_list));
     if (!list) {
         ilka_fail("out-of-memory for list struct");
         return NULL;
     }
 
-    *list = (struct ilka_list) { region, head, off };
+    *list = (struct ilka_list) { region, head, off, compact };
 
     return list;
 }
 
+static struct ilka_list * list_alloc(
+        struct ilka_region *region, ilka_off_t head_off, size_t off, bool compact)
+{
+    if (!head_off) {
+        ilka_fail("invalid nil head offset");
+        return NULL;
+    }
+
+    struct ilka_list *list = list_open(region, head_off, off, compact);
+    if (!list) return NULL;
+
+    struct ilka_list_node *head = ilka_write(region, head_off, link_len(list));
+    link_store(list, head, 0);
+
+    return list;
+}
+
+struct ilka_list * ilka_list_alloc(
+        struct ilka_region *region, ilka_off_t head_off, size_t off)
+{
+    return list_alloc(region, head_off, off, false);
+}
+
+struct ilka_list * ilka_list_open(
+        struct ilka_region *region, ilka_off_t head, size_t off)
+{
+    return list_open(region, head, off, false);
+}
+
+struct ilka_list * ilka_list_alloc_compact(
+        struct ilka_region *region, ilka_off_t head_off, size_t off)
+{
+    return list_alloc(region, head_off, off, true);
+}
+
+struct ilka_list * ilka_list_open_compact(
+        struct ilka_region *region, ilka_off_t head, size_t off)
+{
+    return list_open(region, head, off, true);
+}
+
 void ilka_list_close(struct ilka_list *list)
 {
     free(list);
@@ -82,7 +181,7 @@ void ilka_list_close(struct ilka_list *list)
 static const struct ilka_list_node * list_read(
         struct ilka_list *list, ilka_off_t off)
 {
-    return ilka_read(list->region, off + list->off, sizeof(struct ilka_list_node));
+    return ilka_read(list->region, off + list->off, link_len(list));
 }
 
 static inline bool check_node(const struct ilka_list_node *node, const char *name)
@@ -95,7 +194,8 @@ static inline bool check_node(const struct ilka_list_node *node, const char *nam
     return true;
 }
 
-static inline bool check_off(ilka_off_t off, const char *name)
+static inline bool check_off(
+        struct ilka_list *list, ilka_off_t off, const char *name)
 {
     if (!off) {
         ilka_fail("invalid nil offset for '%s'", name);
@@ -107,6 +207,12 @@ static inline bool check_off(ilka_off_t off, const char *name)
         return false;
     }
 
+    if (list->compact && (off & ((1UL << ilka_coff_shift) - 1) ||
+                    off >= ilka_off_expand(list_cmark))) {
+        ilka_fail("invalid compact offset for '%s': %p", name, (void *) off);
+        return false;
+    }
+
     return true;
 }
 
@@ -118,7 +224,7 @@ static inline bool check_off(ilka_off_t off, const char *name)
 ilka_off_t ilka_list_head(struct ilka_list *list)
 {
     const struct ilka_list_node *head =
-        ilka_read(list->region, list->head, sizeof(struct ilka_list_node));
+        ilka_read(list->region, list->head, link_len(list));
     return ilka_list_next(list, head);
 }
 
@@ -127,13 +233,13 @@ ilka_off_t ilka_list_next(
 {
     if (!check_node(node, "node")) return ILKA_LIST_ERROR;
 
-    ilka_off_t off = ilka_atomic_load(&node->next, morder_relaxed);
+    ilka_off_t off = link_load(list, node);
     off &= ~list_mark;
 
     while (off) {
         node = list_read(list, off);
 
-        ilka_off_t next = ilka_atomic_load(&node->next, morder_relaxed);
+        ilka_off_t next = link_load(list, node);
         if (!(next & list_mark)) return off;
 
         ilka_assert(off != (next & ~list_mark),
@@ -154,17 +260,17 @@ int ilka_list_insert(
         struct ilka_list *list, struct ilka_list_node *prev, ilka_off_t node_off)
 {
     if (!check_node(prev, "prev")) return -1;
-    if (!check_off(node_off, "node_off")) return -1;
+    if (!check_off(list, node_off, "node_off")) return -1;
 
     struct ilka_list_node *node =
-        ilka_write(list->region, node_off + list->off, sizeof(struct ilka_list_node));
+        ilka_write(list->region, node_off + list->off, link_len(list));
 
-    ilka_off_t next = ilka_atomic_load(&prev->next, morder_relaxed);
+    ilka_off_t next = link_load(list, prev);
     do {
         if (next & list_mark) return 0;
 
-        node->next = next;
-    } while (!ilka_atomic_cmp_xchg(&prev->next, &next, node_off, morder_release));
+        link_store(list, node, next);
+    } while (!link_cmp_xchg(list, prev, &next, node_off, morder_release));
 
     return 1;
 }
@@ -172,13 +278,11 @@ int ilka_list_insert(
 int ilka_list_set(
         struct ilka_list *list, struct ilka_list_node *node, ilka_off_t next)
 {
-    (void) list;
-
     if (!check_node(node, "node")) return -1;
-    if (!check_off(next, "next")) return -1;
+    if (!check_off(list, next, "next")) return -1;
 
     ilka_off_t old = 0;
-    return ilka_atomic_cmp_xchg(&node->next, &old, next, morder_release) ? 0 : 1;
+    return link_cmp_xchg(list, node, &old, next, morder_release) ? 0 : 1;
 }
 
 static bool list_clean(
@@ -189,7 +293,7 @@ static bool list_clean(
 {
     const struct ilka_list_node *node = list_read(list, node_off);
 
-    ilka_off_t next = ilka_atomic_load(&node->next, morder_relaxed);
+    ilka_off_t next = link_load(list, node);
     while (true) {
         ilka_off_t clean_next = next & ~list_mark;
         ilka_assert(node_off != clean_next,
@@ -198,8 +302,8 @@ static bool list_clean(
 
         if (node == target) {
             struct ilka_list_node *prev =
-                ilka_write(list->region, prev_off, sizeof(struct ilka_list_node));
-            return ilka_atomic_cmp_xchg(&prev->next, &node_off, clean_next, morder_relaxed);
+                ilka_write(list->region, prev_off, link_len(list));
+            return link_cmp_xchg(list, prev, &node_off, clean_next, morder_relaxed);
         }
 
         // if it's not in the list then someone else has removed the node.
@@ -208,7 +312,7 @@ static bool list_clean(
         ilka_off_t new_prev = next & list_mark ? prev_off : node_off + list->off;
         if (list_clean(list, target, new_prev, clean_next)) return true;
 
-        next = ilka_atomic_load(&node->next, morder_relaxed);
+        next = link_load(list, node);
         if (next & list_mark) return false;
     }
 
@@ -220,21 +324,21 @@ int ilka_list_del(struct ilka_list *list, struct ilka_list_node *node)
     if (!check_node(node, "node")) return -1;
 
     const struct ilka_list_node *head =
-        ilka_read(list->region, list->head, sizeof(struct ilka_list_node));
+        ilka_read(list->region, list->head, link_len(list));
 
     ilka_off_t new_next;
-    ilka_off_t old_next = ilka_atomic_load(&node->next, morder_relaxed);
+    ilka_off_t old_next = link_load(list, node);
     do {
         if (old_next & list_mark) return 1;
         new_next = old_next | list_mark;
 
         // morder_release: linearilization point where the node is removed from
         // the list.
-    } while (!ilka_atomic_cmp_xchg(&node->next, &old_next, new_next, morder_release));
+    } while (!link_cmp_xchg(list, node, &old_next, new_next, morder_release));
 
     ilka_off_t first;
     do {
-        first = ilka_atomic_load(&head->next, morder_relaxed);
+        first = link_load(list, head);
     } while (!list_clean(list, node, list->head, first));
 
     return 0;
@@ -243,6 +347,6 @@ int ilka_list_del(struct ilka_list *list, struct ilka_list_node *node)
 ilka_off_t ilka_list_clear(struct ilka_list *list)
 {
     struct ilka_list_node *head =
-        ilka_write(list->region, list->head, sizeof(struct ilka_list_node));
-    return ilka_atomic_xchg(&head->next, 0, morder_relaxed);
+        ilka_write(list->region, list->head, link_len(list));
+    return link_xchg(list, head, 0);
 }
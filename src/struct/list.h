@@ -18,12 +18,23 @@
 struct ilka_list;
 struct ilka_packed ilka_list_node { ilka_off_t next; };
 
+// Compact lists link their nodes with an ilka_list_cnode which is passed to the
+// list functions in place of an ilka_list_node. Requires a compact region and
+// restricts the nodes to 8-byte aligned offsets within the first 16GB of the
+// region.
+struct ilka_packed ilka_list_cnode { ilka_coff_t next; };
+
 struct ilka_list * ilka_list_alloc(
         struct ilka_region *r, ilka_off_t head, size_t off);
 struct ilka_list * ilka_list_open(
         struct ilka_region *r, ilka_off_t head, size_t off);
 void ilka_list_close(struct ilka_list *l);
 
+struct ilka_list * ilka_list_alloc_compact(
+        struct ilka_region *r, ilka_off_t head, size_t off);
+struct ilka_list * ilka_list_open_compact(
+        struct ilka_region *r, ilka_off_t head, size_t off);
+
 ilka_off_t ilka_list_head(struct ilka_list *l);
 ilka_off_t ilka_list_next(struct ilka_list *l, const struct ilka_list_node *node);
 
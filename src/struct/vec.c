@@ -18,6 +18,7 @@ struct ilka_vec
 {
     struct ilka_region *r;
     ilka_off_t meta;
+    bool compact;
 };
 
 struct ilka_packed vec_meta
@@ -28,13 +29,70 @@ struct ilka_packed vec_meta
     ilka_off_t data;
 };
 
+// Compact vecs are flagged by the top bit of the first 32-bit word of their
+// meta which is left unset by the item_len of regular vecs.
+struct ilka_packed vec_cmeta
+{
+    uint32_t item_len;
+    uint32_t len;
+    uint32_t cap;
+    ilka_coff_t data;
+};
+
+static const uint32_t vec_compact_flag = 1U << 31;
+
 static bool vec_reserve(struct ilka_vec *v, struct vec_meta *meta, size_t cap);
 
+
+// -----------------------------------------------------------------------------
+// meta
+// -----------------------------------------------------------------------------
+
+static size_t vec_meta_len(struct ilka_vec *v)
+{
+    return v->compact ? sizeof(struct vec_cmeta) : sizeof(struct vec_meta);
+}
+
+static struct vec_meta vec_load(struct ilka_vec *v)
+{
+    if (!v->compact) {
+        const struct vec_meta *meta =
+            ilka_read(v->r, v->meta, sizeof(struct vec_meta));
+        return *meta;
+    }
+
+    const struct vec_cmeta *meta = ilka_read(v->r, v->meta, sizeof(struct vec_cmeta));
+    return (struct vec_meta) {
+        .item_len = meta->item_len & ~vec_compact_flag,
+        .len = meta->len,
+        .cap = meta->cap,
+        .data = ilka_off_expand(meta->data),
+    };
+}
+
+static void vec_store(struct ilka_vec *v, const struct vec_meta *meta)
+{
+    if (!v->compact) {
+        struct vec_meta *wmeta = ilka_write(v->r, v->meta, sizeof(struct vec_meta));
+        *wmeta = *meta;
+        return;
+    }
+
+    struct vec_cmeta *cmeta = ilka_write(v->r, v->meta, sizeof(struct vec_cmeta));
+    *cmeta = (struct vec_cmeta) {
+        .item_len = meta->item_len | vec_compact_flag,
+        .len = meta->len,
+        .cap = meta->cap,
+        .data = ilka_off_compact(meta->data),
+    };
+}
+
 // -----------------------------------------------------------------------------
 // alloc & free
 // -----------------------------------------------------------------------------
 
-struct ilka_vec * ilka_vec_alloc(struct ilka_region *r, size_t item_len)
+static struct ilka_vec * vec_alloc(
+        struct ilka_region *r, size_t item_len, bool compact)
 {
     if (!r) {
         ilka_fail("invalid nil value for region");
@@ -44,15 +102,19 @@ struct ilka_vec * ilka_vec_alloc(struct ilka_region *r, size_t item_len)
         ilka_fail("invalid nil value for item_len");
         return NULL;
     }
+    if (item_len >= vec_compact_flag) {
+        ilka_fail("invalid item_len: %lu", item_len);
+        return NULL;
+    }
 
     struct ilka_vec *v = calloc(1, sizeof(struct ilka_vec));
     v->r = r;
+    v->compact = compact;
 
-    v->meta = ilka_alloc(v->r, sizeof(struct vec_meta));
+    v->meta = ilka_alloc(v->r, vec_meta_len(v));
     if (!v->meta) goto fail_meta;
 
-    struct vec_meta *meta = ilka_write(v->r, v->meta, sizeof(struct vec_meta));
-    *meta = (struct vec_meta) { .item_len = item_len };
+    vec_store(v, &(struct vec_meta) { .item_len = item_len });
 
     return v;
 
@@ -61,13 +123,28 @@ struct ilka_vec * ilka_vec_alloc(struct ilka_region *r, size_t item_len)
     return NULL;
 }
 
+struct ilka_vec * ilka_vec_alloc(struct ilka_region *r, size_t item_len)
+{
+    return vec_alloc(r, item_len, false);
+}
+
+struct ilka_vec * ilka_vec_alloc_compact(struct ilka_region *r, size_t item_len)
+{
+    if (r && !ilka_compact(r)) {
+        ilka_fail("compact vec requires a compact region");
+        return NULL;
+    }
+
+    return vec_alloc(r, item_len, true);
+}
+
 bool ilka_vec_free(struct ilka_vec *v)
 {
-    const struct vec_meta *meta = ilka_read(v->r, v->meta, sizeof(struct vec_meta));
+    struct vec_meta meta = vec_load(v);
 
-    if (meta->data)
-        ilka_free(v->r, meta->data, meta->cap * meta->item_len);
-    ilka_free(v->r, v->meta, sizeof(struct vec_meta));
+    if (meta.data)
+        ilka_free(v->r, meta.data, meta.cap * meta.item_len);
+    ilka_free(v->r, v->meta, vec_meta_len(v));
 
     return ilka_vec_close(v);
 }
@@ -83,6 +160,9 @@ struct ilka_vec * ilka_vec_open(struct ilka_region *r, ilka_off_t off)
     v->r = r;
     v->meta = off;
 
+    const uint32_t *flag = ilka_read(v->r, v->meta, sizeof(uint32_t));
+    v->compact = *flag & vec_compact_flag;
+
     return v;
 }
 
@@ -99,14 +179,12 @@ bool ilka_vec_close(struct ilka_vec *v)
 
 size_t ilka_vec_len(struct ilka_vec *v)
 {
-    const struct vec_meta *meta = ilka_read(v->r, v->meta, sizeof(struct vec_meta));
-    return meta->len;
+    return vec_load(v).len;
 }
 
 size_t ilka_vec_cap(struct ilka_vec *v)
 {
-    const struct vec_meta *meta = ilka_read(v->r, v->meta, sizeof(struct vec_meta));
-    return meta->cap;
+    return vec_load(v).cap;
 }
 
 static bool vec_reserve(struct ilka_vec *v, struct vec_meta *meta, size_t cap)
@@ -114,6 +192,11 @@ static bool vec_reserve(struct ilka_vec *v, struct vec_meta *meta, size_t cap)
     if (cap <= meta->cap) return true;
     cap = ceil_pow2(cap);
 
+    if (v->compact && cap > UINT32_MAX) {
+        ilka_fail("compact vec cap is too large: %lu", cap);
+        return false;
+    }
+
     ilka_off_t data = ilka_alloc(v->r, cap * meta->item_len);
     if (!data) return false;
 
@@ -167,14 +250,18 @@ static bool vec_resize(struct ilka_vec *v, struct vec_meta *meta, size_t len)
 
 bool ilka_vec_reserve(struct ilka_vec *v, size_t cap)
 {
-    struct vec_meta *meta = ilka_write(v->r, v->meta, sizeof(struct vec_meta));
-    return vec_reserve(v, meta, cap);
+    struct vec_meta meta = vec_load(v);
+    bool ret = vec_reserve(v, &meta, cap);
+    vec_store(v, &meta);
+    return ret;
 }
 
 bool ilka_vec_resize(struct ilka_vec *v, size_t len)
 {
-    struct vec_meta *meta = ilka_write(v->r, v->meta, sizeof(struct vec_meta));
-    return vec_resize(v, meta, len);
+    struct vec_meta meta = vec_load(v);
+    bool ret = vec_resize(v, &meta, len);
+    vec_store(v, &meta);
+    return ret;
 }
 
 
@@ -199,20 +286,20 @@ static ilka_off_t vec_get(const struct vec_meta *meta, size_t i, size_t n)
 
 ilka_off_t ilka_vec_get(struct ilka_vec *v, size_t i)
 {
-    const struct vec_meta *meta = ilka_read(v->r, v->meta, sizeof(struct vec_meta));
-    return vec_get(meta, i, 1);
+    struct vec_meta meta = vec_load(v);
+    return vec_get(&meta, i, 1);
 }
 
 const void * ilka_vec_read(struct ilka_vec *v, size_t i, size_t n)
 {
-    const struct vec_meta *meta = ilka_read(v->r, v->meta, sizeof(struct vec_meta));
-    return ilka_read(v->r, vec_get(meta, i, n), n * meta->item_len);
+    struct vec_meta meta = vec_load(v);
+    return ilka_read(v->r, vec_get(&meta, i, n), n * meta.item_len);
 }
 
 void * ilka_vec_write(struct ilka_vec *v, size_t i, size_t n)
 {
-    const struct vec_meta *meta = ilka_read(v->r, v->meta, sizeof(struct vec_meta));
-    return ilka_write(v->r, vec_get(meta, i, n), n * meta->item_len);
+    struct vec_meta meta = vec_load(v);
+    return ilka_write(v->r, vec_get(&meta, i, n), n * meta.item_len);
 }
 
 
@@ -220,10 +307,9 @@ void * ilka_vec_write(struct ilka_vec *v, size_t i, size_t n)
 // writes
 // -----------------------------------------------------------------------------
 
-bool ilka_vec_append(struct ilka_vec *v, const void *data, size_t n)
+static bool vec_append(
+        struct ilka_vec *v, struct vec_meta *meta, const void *data, size_t n)
 {
-    struct vec_meta *meta = ilka_write(v->r, v->meta, sizeof(struct vec_meta));
-
     size_t i = meta->len;
     if (!vec_resize(v, meta, meta->len + n)) return false;
 
@@ -235,10 +321,13 @@ bool ilka_vec_append(struct ilka_vec *v, const void *data, size_t n)
     return true;
 }
 
-bool ilka_vec_insert(struct ilka_vec *v, const void *data, size_t i, size_t n)
+static bool vec_insert(
+        struct ilka_vec *v,
+        struct vec_meta *meta,
+        const void *data,
+        size_t i,
+        size_t n)
 {
-    struct vec_meta *meta = ilka_write(v->r, v->meta, sizeof(struct vec_meta));
-
     if (i > meta->len) {
         ilka_fail("out-of-bound access: %lu > %lu", i, meta->len);
         return false;
@@ -258,10 +347,9 @@ bool ilka_vec_insert(struct ilka_vec *v, const void *data, size_t i, size_t n)
     return true;
 }
 
-bool ilka_vec_remove(struct ilka_vec *v, size_t i, size_t n)
+static bool vec_remove(
+        struct ilka_vec *v, struct vec_meta *meta, size_t i, size_t n)
 {
-    struct vec_meta *meta = ilka_write(v->r, v->meta, sizeof(struct vec_meta));
-
     if (i + n > meta->len) {
         ilka_fail("out-of-bound access: %lu > %lu", i + n, meta->len);
         return false;
@@ -282,3 +370,27 @@ bool ilka_vec_remove(struct ilka_vec *v, size_t i, size_t n)
 
     return true;
 }
+
+bool ilka_vec_append(struct ilka_vec *v, const void *data, size_t n)
+{
+    struct vec_meta meta = vec_load(v);
+    bool ret = vec_append(v, &meta, data, n);
+    vec_store(v, &meta);
+    return ret;
+}
+
+bool ilka_vec_insert(struct ilka_vec *v, const void *data, size_t i, size_t n)
+{
+    struct vec_meta meta = vec_load(v);
+    bool ret = vec_insert(v, &meta, data, i, n);
+    vec_store(v, &meta);
+    return ret;
+}
+
+bool ilka_vec_remove(struct ilka_vec *v, size_t i, size_t n)
+{
+    struct vec_meta meta = vec_load(v);
+    bool ret = vec_remove(v, &meta, i, n);
+    vec_store(v, &meta);
+    return ret;
+}
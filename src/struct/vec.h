@@ -15,6 +15,10 @@
 struct ilka_vec;
 
 struct ilka_vec * ilka_vec_alloc(struct ilka_region *r, size_t item_len);
+
+// Stores the vec's metadata with 32-bit fields which requires a compact
+// region and caps the vec at UINT32_MAX items.
+struct ilka_vec * ilka_vec_alloc_compact(struct ilka_region *r, size_t item_len);
 bool ilka_vec_free(struct ilka_vec *v);
 
 struct ilka_vec * ilka_vec_open(struct ilka_region *r, ilka_off_t off);
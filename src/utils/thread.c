@@ -17,6 +17,81 @@ size_t ilka_cpus()
 }
 
 
+// -----------------------------------------------------------------------------
+// numa
+// -----------------------------------------------------------------------------
+
+// Node ids can be sparse so the online nodes are indexed in ascending order of
+// their ids. The table is empty if the kernel doesn't expose any numa nodes.
+enum { numa_max_nodes = 1024 };
+
+static pthread_once_t numa_once = PTHREAD_ONCE_INIT;
+static size_t numa_len = 0;
+static uint16_t numa_ids[numa_max_nodes];
+static uint16_t numa_index[numa_max_nodes];
+
+// Parses a list of ranges of the form "0-3,5,8-9". Ids beyond numa_max_nodes
+// are ignored.
+static void numa_parse(FILE *file)
+{
+    unsigned long first, last;
+    while (fscanf(file, "%lu", &first) == 1) {
+        last = first;
+
+        int c = fgetc(file);
+        if (c == '-') {
+            if (fscanf(file, "%lu", &last) != 1) return;
+            c = fgetc(file);
+        }
+
+        for (size_t id = first; id <= last && id < numa_max_nodes; ++id) {
+            numa_index[id] = numa_len;
+            numa_ids[numa_len++] = id;
+        }
+
+        if (c != ',') return;
+    }
+}
+
+static void numa_init()
+{
+    FILE *file = fopen("/sys/devices/system/node/online", "r");
+    if (!file) return;
+
+    numa_parse(file);
+    fclose(file);
+}
+
+// Returns the number of online nodes or 0 if the kernel doesn't expose any.
+size_t ilka_numa_nodes()
+{
+    pthread_once(&numa_once, numa_init);
+    return numa_len;
+}
+
+size_t ilka_numa_node_id(size_t index)
+{
+    ilka_assert(index < ilka_numa_nodes(), "invalid numa node index: %lu", index);
+    return numa_ids[index];
+}
+
+// Sampled once per thread much like the tid which means that it goes stale if
+// the thread migrates to another node.
+static __thread size_t numa_node = -1UL;
+
+size_t ilka_numa_node()
+{
+    if (numa_node != -1UL) return numa_node;
+
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == -1) node = 0;
+
+    size_t nodes = ilka_numa_nodes();
+    if (node >= numa_max_nodes || !nodes) return numa_node = 0;
+    return numa_node = numa_index[node];
+}
+
+
 // -----------------------------------------------------------------------------
 // tid
 // -----------------------------------------------------------------------------
@@ -13,3 +13,13 @@ size_t ilka_cpus();
 size_t ilka_tid();
 
 void ilka_run_threads(void (*fn) (size_t, void *), void *data, size_t n);
+
+
+// -----------------------------------------------------------------------------
+// numa
+// -----------------------------------------------------------------------------
+
+// Nodes are identified by their index in the list of online nodes.
+size_t ilka_numa_nodes();
+size_t ilka_numa_node();
+size_t ilka_numa_node_id(size_t index);
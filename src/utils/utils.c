@@ -11,6 +11,7 @@
 #include <unistd.h>
 #include <sched.h>
 #include <pthread.h>
+#include <sys/syscall.h>
 
 #include "ilka.h"
 #include "utils/utils.h"
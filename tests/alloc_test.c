@@ -5,6 +5,9 @@
 
 #include "check.h"
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 // -----------------------------------------------------------------------------
 // utils
@@ -16,7 +19,7 @@ struct alloc_node
     size_t len;
 };
 
-inline void fill_block(
+static inline void fill_block(
         struct ilka_region *r, ilka_off_t off, size_t len, size_t value)
 {
     size_t *data = ilka_write(r, off, len);
@@ -24,7 +27,7 @@ inline void fill_block(
         data[i] = value;
 }
 
-inline void check_block(struct ilka_region *r, ilka_off_t off, size_t len)
+static inline void check_block(struct ilka_region *r, ilka_off_t off, size_t len)
 {
     const size_t *data = ilka_read(r, off, len);
     size_t value = data[0];
@@ -153,6 +156,337 @@ START_TEST(block_test_mt)
 END_TEST
 
 
+// -----------------------------------------------------------------------------
+// shrink
+// -----------------------------------------------------------------------------
+
+static size_t file_size(const char *file)
+{
+    struct stat st;
+    if (stat(file, &st) == -1) ilka_abort();
+    return st.st_size;
+}
+
+static void shrink_test(bool automatic)
+{
+    enum { n = 8, len = 1UL << 20 };
+    const char *file = "blah";
+
+    // Grows in place such that the allocations are contiguous.
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .vma_reserved = 1UL << 26,
+        .shrink_len = automatic ? 2 * len : 0,
+    };
+    struct ilka_region *r = ilka_open(file, &options);
+
+    ilka_off_t offs[n];
+    for (size_t i = 0; i < n; ++i) {
+        offs[i] = ilka_alloc(r, len);
+        fill_block(r, offs[i], len, i);
+    }
+    ilka_set_root(r, offs[0]);
+
+    size_t full = ilka_len(r);
+    ck_assert_int_eq(full, offs[n - 1] + len);
+
+    // A run that's too small for the automatic policy.
+    ilka_free(r, offs[n - 1], len);
+    if (automatic) {
+        if (!ilka_save(r)) ilka_abort();
+        ck_assert_int_eq(ilka_len(r), full);
+    }
+
+    for (size_t i = n / 2; i < n - 1; ++i) ilka_free(r, offs[i], len);
+    if (automatic) { if (!ilka_save(r)) ilka_abort(); }
+    else { if (!ilka_shrink(r)) ilka_abort(); }
+
+    ck_assert_int_eq(ilka_len(r), offs[n / 2]);
+    ck_assert_int_eq(file_size(file), offs[n / 2]);
+
+    for (size_t i = 0; i < n / 2; ++i) check_block(r, offs[i], len);
+
+    // Growing back into the released range.
+    ilka_off_t off = ilka_alloc(r, len);
+    ck_assert_int_eq(off, offs[n / 2]);
+    fill_block(r, off, len, 1);
+    ilka_free(r, off, len);
+
+    if (!ilka_close(r)) ilka_abort();
+
+    options = (struct ilka_options) { .open = true };
+    r = ilka_open(file, &options);
+    ck_assert_int_eq(ilka_len(r), off + len);
+    ck_assert_int_eq(ilka_get_root(r), offs[0]);
+    for (size_t i = 0; i < n / 2; ++i) check_block(r, offs[i], len);
+    if (!ilka_close(r)) ilka_abort();
+}
+
+START_TEST(shrink_test_st)
+{
+    shrink_test(false);
+}
+END_TEST
+
+START_TEST(shrink_auto_test_st)
+{
+    shrink_test(true);
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// punch
+// -----------------------------------------------------------------------------
+
+static size_t file_blocks(const char *file)
+{
+    struct stat st;
+    if (stat(file, &st) == -1) ilka_abort();
+    return st.st_blocks * 512;
+}
+
+START_TEST(punch_test_st)
+{
+    enum { n = 6, len = 1UL << 20 };
+    const char *file = "blah";
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .vma_reserved = 1UL << 26,
+        .punch_len = 2 * len,
+    };
+    struct ilka_region *r = ilka_open(file, &options);
+
+    ilka_off_t offs[n];
+    for (size_t i = 0; i < n; ++i) {
+        offs[i] = ilka_alloc(r, len);
+        fill_block(r, offs[i], len, i + 1);
+    }
+    ilka_set_root(r, offs[0]);
+    if (!ilka_save(r)) ilka_abort();
+
+    size_t full = file_blocks(file);
+
+    // A run that's too small to be punched.
+    ilka_free(r, offs[1], len);
+    if (!ilka_save(r)) ilka_abort();
+    ck_assert_int_eq(file_blocks(file), full);
+
+    for (size_t i = 2; i < n - 1; ++i) ilka_free(r, offs[i], len);
+    if (!ilka_save(r)) ilka_abort();
+    ck_assert(file_blocks(file) <= full - (4 * len - ILKA_PAGE_SIZE));
+    ck_assert_int_eq(ilka_len(r), offs[n - 1] + len);
+
+    // Pages are carved from the end of the run which was punched.
+    ilka_off_t off = ilka_alloc(r, len);
+    ck_assert_int_eq(off, offs[n - 2]);
+    const uint8_t *data = ilka_read(r, off, len);
+    for (size_t i = 0; i < len; ++i) ck_assert_int_eq(data[i], 0);
+    fill_block(r, off, len, 1);
+
+    if (!ilka_close(r)) ilka_abort();
+
+    options = (struct ilka_options) { .open = true };
+    r = ilka_open(file, &options);
+    ck_assert_int_eq(ilka_get_root(r), offs[0]);
+    check_block(r, offs[0], len);
+    check_block(r, offs[n - 1], len);
+    check_block(r, off, len);
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// multi-process
+// -----------------------------------------------------------------------------
+
+struct ilka_packed multi_node
+{
+    ilka_off_t next;
+    size_t len;
+};
+
+static void run_multi_test(const char *file, size_t id, size_t allocs)
+{
+    struct ilka_options options = {
+        .open = true,
+        .multi_process = true,
+        .max_len = 1UL << 30,
+    };
+    struct ilka_region *r = ilka_open(file, &options);
+
+    ilka_srand(id + 1);
+    ilka_off_t head = 0;
+
+    for (size_t i = 0; i < allocs; ++i) {
+        if (!ilka_enter(r)) ilka_abort();
+
+        size_t len = i % 8 ? ilka_rand_range(16, 512) : ilka_rand_range(4096, 16384);
+        ilka_off_t off = ilka_alloc(r, len);
+        fill_block(r, off, len, id);
+
+        struct multi_node *node = ilka_write(r, off, sizeof(struct multi_node));
+        *node = (struct multi_node) { .next = head, .len = len };
+        head = off;
+
+        // Keeps the epochs of the processes moving.
+        if (i % 16 == 0) {
+            ilka_off_t tmp = ilka_alloc(r, 64);
+            if (!ilka_defer_free(r, tmp, 64)) ilka_abort();
+        }
+
+        ilka_exit(r);
+    }
+
+    ilka_off_t *heads = ilka_write(r, ilka_get_root(r), sizeof(ilka_off_t) * (id + 1));
+    heads[id] = head;
+
+    if (!ilka_close(r)) ilka_abort();
+}
+
+START_TEST(multi_process_test_st)
+{
+    enum { procs = 4, allocs = 1000 };
+    const char *file = "blah";
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .multi_process = true,
+        .max_len = 1UL << 30,
+    };
+    struct ilka_region *r = ilka_open(file, &options);
+
+    ilka_off_t root = ilka_alloc(r, sizeof(ilka_off_t) * procs);
+    memset(ilka_write(r, root, sizeof(ilka_off_t) * procs), 0, sizeof(ilka_off_t) * procs);
+    ilka_set_root(r, root);
+
+    pid_t pids[procs];
+    for (size_t id = 0; id < procs; ++id) {
+        if ((pids[id] = fork()) == -1) ilka_abort();
+        if (pids[id]) continue;
+
+        run_multi_test(file, id, allocs);
+        _exit(0);
+    }
+
+    for (size_t id = 0; id < procs; ++id) {
+        int status;
+        if (waitpid(pids[id], &status, 0) == -1) ilka_abort();
+        ck_assert(WIFEXITED(status) && !WEXITSTATUS(status));
+    }
+
+    const ilka_off_t *heads = ilka_read(r, root, sizeof(ilka_off_t) * procs);
+    for (size_t id = 0; id < procs; ++id) {
+        size_t n = 0;
+
+        for (ilka_off_t off = heads[id]; off; ++n) {
+            const struct multi_node *node = ilka_read(r, off, sizeof(struct multi_node));
+            const size_t *data = ilka_read(r, off, node->len);
+            for (size_t i = 2; (i + 1) * sizeof(size_t) <= node->len; ++i)
+                ck_assert_int_eq(data[i], id);
+            off = node->next;
+        }
+
+        ck_assert_int_eq(n, allocs);
+    }
+
+    if (!ilka_rm(r)) ilka_abort();
+}
+END_TEST
+
+// A process that dies within an epoch must not hold back the deferred work of
+// the others once it's reaped.
+static void multi_dead_defer(void *data)
+{
+    *((bool *) data) = true;
+}
+
+START_TEST(multi_process_dead_test_st)
+{
+    const char *file = "blah";
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .multi_process = true,
+        .max_len = 1UL << 30,
+    };
+    struct ilka_region *r = ilka_open(file, &options);
+
+    // Claims our slot such that the dead process' slot is never reclaimed.
+    if (!ilka_enter(r)) ilka_abort();
+    ilka_exit(r);
+
+    pid_t pid = fork();
+    if (pid == -1) ilka_abort();
+    if (!pid) {
+        struct ilka_options child = {
+            .open = true,
+            .multi_process = true,
+            .max_len = 1UL << 30,
+        };
+        if (!ilka_enter(ilka_open(file, &child))) ilka_abort();
+        _exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1) ilka_abort();
+    ck_assert(WIFEXITED(status) && !WEXITSTATUS(status));
+
+    bool done = false;
+    if (!ilka_enter(r)) ilka_abort();
+    if (!ilka_defer(r, multi_dead_defer, &done)) ilka_abort();
+    ilka_exit(r);
+
+    if (!ilka_rm(r)) ilka_abort();
+    ck_assert(done);
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// numa
+// -----------------------------------------------------------------------------
+
+// Falls back to the regular areas on machines with a single numa node.
+START_TEST(numa_test_mt)
+{
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .numa = true,
+        .max_len = 1UL << 30,
+    };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    struct alloc_test tdata = {
+        .r = r,
+        .blocks = 100,
+        .allocs = 100 * 100,
+        .mul = 64,
+    };
+    ilka_run_threads(run_alloc_test, &tdata, 0);
+
+    if (!ilka_close(r)) ilka_abort();
+
+    // The area count is fixed by the region.
+    options = (struct ilka_options) {
+        .open = true,
+        .numa = true,
+        .max_len = 1UL << 30,
+    };
+    tdata.r = r = ilka_open("blah", &options);
+    ilka_run_threads(run_alloc_test, &tdata, 0);
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
 // -----------------------------------------------------------------------------
 // setup
 // -----------------------------------------------------------------------------
@@ -164,6 +498,16 @@ void make_suite(Suite *s)
 
     ilka_tc(s, block_test_st, true);
     ilka_tc(s, block_test_mt, true);
+
+    ilka_tc(s, shrink_test_st, true);
+    ilka_tc(s, shrink_auto_test_st, true);
+
+    ilka_tc(s, punch_test_st, true);
+
+    ilka_tc(s, multi_process_test_st, true);
+    ilka_tc(s, multi_process_dead_test_st, true);
+
+    ilka_tc(s, numa_test_mt, true);
 }
 
 int main(void)
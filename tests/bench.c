@@ -106,6 +106,14 @@ int cmp_elapsed(const void *_lhs, const void *_rhs)
     return 0;
 }
 
+// Tags the results with the flavor of ilka being measured so that the output of
+// the debug and ndebug benches can be diffed.
+#ifdef ILKA_NDEBUG
+static const char *bench_flavor = "ndebug";
+#else
+static const char *bench_flavor = "debug";
+#endif
+
 static void bench_report(
         const char *title, size_t n, size_t threads, double *dist, size_t dist_len)
 {
@@ -121,8 +129,9 @@ static void bench_report(
     char p90_mul = ' ';
     double p90_val = ilka_scale_elapsed(dist[(dist_len * 90) / 100], &p90_mul);
 
-    printf("bench: %-30s  %4lu %8lu    p0:%6.2f%c    p50:%6.2f%c    p90:%6.2f%c\n",
-            title, threads, n, p0_val, p0_mul, p50_val, p50_mul, p90_val, p90_mul);
+    printf("bench: %-30s %-6s  %4lu %8lu    p0:%6.2f%c    p50:%6.2f%c    p90:%6.2f%c\n",
+            title, bench_flavor, threads, n,
+            p0_val, p0_mul, p50_val, p50_mul, p90_val, p90_mul);
 }
 
 static void bench_runner(
@@ -58,6 +58,26 @@ START_TEST(get_bench_st)
 END_TEST
 
 
+START_TEST(get_compact_bench_st)
+{
+    struct ilka_options options = { .open = true, .create = true, .compact = true };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    enum { keys = 100000 };
+    struct ilka_hash *hash = ilka_hash_alloc_compact(r);
+    ilka_hash_reserve(hash, keys);
+
+    for (uint64_t i = 0; i < keys; ++i)
+        ilka_hash_put(hash, &i, sizeof(i), 8);
+
+    struct hash_bench tdata = { .hash = hash, .r = r, .keys = keys };
+    ilka_bench_st("get_compact_bench_st", run_get_bench, &tdata);
+
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
 START_TEST(get_bench_mt)
 {
     struct ilka_options options = { .open = true, .create = true };
@@ -234,6 +254,7 @@ END_TEST
 void make_suite(Suite *s)
 {
     ilka_tc(s, get_bench_st, true);
+    ilka_tc(s, get_compact_bench_st, true);
     ilka_tc(s, get_bench_mt, true);
     ilka_tc(s, insert_only_bench_st, true);
     ilka_tc_timeout(s, insert_only_bench_mt, 60, true);
@@ -6,6 +6,8 @@
 #include "check.h"
 #include "struct/hash.h"
 
+#include <signal.h>
+
 // -----------------------------------------------------------------------------
 // utils
 // -----------------------------------------------------------------------------
@@ -124,6 +126,79 @@ START_TEST(basic_test_st)
 END_TEST
 
 
+// -----------------------------------------------------------------------------
+// compact
+// -----------------------------------------------------------------------------
+
+START_TEST(compact_test_st)
+{
+    struct ilka_options options = { .open = true, .create = true, .compact = true };
+    struct ilka_region *r = ilka_open("blah", &options);
+    if (!ilka_enter(r)) ilka_abort();
+
+    ck_assert(ilka_compact(r));
+
+    struct ilka_hash *h0 = ilka_hash_alloc_compact(r);
+    struct ilka_hash *h1 = ilka_hash_open(r, ilka_hash_off(h0));
+
+    enum {
+        key_count = 1024,
+        klen = sizeof(uint64_t)
+    };
+
+    uint64_t keys[key_count];
+    for (size_t i = 0; i < key_count; ++i) keys[i] = i;
+
+    for (size_t i = 0; i < key_count; ++i) {
+        uint64_t *k = &keys[i];
+        ilka_off_t val = (i + 1) * 8;
+
+        check_ret(ilka_hash_put(h0, k, klen, val), k, true, 0);
+        check_ret(ilka_hash_get(h1, k, klen), k, true, val);
+        check_ret(ilka_hash_xchg(h0, k, klen, val * 2), k, true, val);
+    }
+
+    ck_assert_int_eq(ilka_hash_len(h1), key_count);
+
+    size_t count = 0;
+    ck_assert_int_eq(ilka_hash_iterate(h1, fn_count, &count), 0);
+    ck_assert_int_eq(count, key_count);
+
+    for (size_t i = 0; i < key_count; ++i) {
+        uint64_t *k = &keys[i];
+        ilka_off_t val = (i + 1) * 16;
+
+        check_ret(ilka_hash_get(h1, k, klen), k, true, val);
+        check_ret(ilka_hash_cmp_del(h0, k, klen, val), k, true, val);
+        check_ret(ilka_hash_get(h1, k, klen), k, false, 0);
+    }
+
+    ilka_hash_close(h1);
+    ilka_hash_free(h0);
+
+    ilka_exit(r);
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
+// Compact hashes cap their region at 8GB which can't raise a lower cap.
+START_TEST(compact_cap_test_st)
+{
+    const size_t cap = 1UL << 22;
+
+    struct ilka_options options = { .open = true, .create = true, .compact = true };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    ck_assert(ilka_compact_cap(r, cap));
+    ck_assert(ilka_hash_alloc_compact(r));
+
+    ilka_grow(r, cap - ilka_len(r));
+    ilka_grow(r, ILKA_PAGE_SIZE);
+}
+END_TEST
+
+
 // -----------------------------------------------------------------------------
 // split test
 // -----------------------------------------------------------------------------
@@ -251,6 +326,8 @@ END_TEST
 void make_suite(Suite *s)
 {
     ilka_tc(s, basic_test_st, true);
+    ilka_tc(s, compact_test_st, true);
+    ilka_tc_signal(s, compact_cap_test_st, SIGABRT, true);
     ilka_tc(s, split_test_mt, true);
     ilka_tc(s, overlap_test_mt, true);
 }
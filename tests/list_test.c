@@ -134,6 +134,66 @@ START_TEST(basic_test_st)
 END_TEST
 
 
+// -----------------------------------------------------------------------------
+// compact
+// -----------------------------------------------------------------------------
+
+struct cnode
+{
+    uint64_t value;
+    struct ilka_list_cnode next;
+    ilka_off_t off;
+};
+
+START_TEST(compact_test_st)
+{
+    struct ilka_options options = { .open = true, .create = true, .compact = true };
+    struct ilka_region *r = ilka_open("blah", &options);
+    if (!ilka_enter(r)) ilka_abort();
+
+    ilka_off_t root_off = ilka_alloc(r, sizeof(struct ilka_list_cnode));
+    struct ilka_list *l0 =
+        ilka_list_alloc_compact(r, root_off, offsetof(struct cnode, next));
+    struct ilka_list *l1 =
+        ilka_list_open_compact(r, root_off, offsetof(struct cnode, next));
+
+    enum { n = 16 };
+    struct cnode *nodes[n];
+
+    for (size_t i = 0; i < n; ++i) {
+        ilka_off_t off = ilka_alloc(r, sizeof(struct cnode));
+        nodes[i] = ilka_write(r, off, sizeof(struct cnode));
+        *nodes[i] = (struct cnode) { i, { 0 }, off };
+
+        struct ilka_list_node *root =
+            ilka_write(r, root_off, sizeof(struct ilka_list_cnode));
+        ck_assert_int_eq(ilka_list_insert(l0, root, off), 1);
+    }
+
+    for (size_t i = 0; i < n; i += 2)
+        ck_assert_int_eq(ilka_list_del(l0, (void *) &nodes[i]->next), 0);
+
+    size_t i = n - 1;
+    ilka_off_t off = ilka_list_head(l1);
+    while (off) {
+        const struct cnode *node = ilka_read(r, off, sizeof(struct cnode));
+        ck_assert_int_eq(node->value, i);
+        ck_assert_int_eq(node->off, off);
+
+        off = ilka_list_next(l1, (const void *) &node->next);
+        i -= 2;
+    }
+    ck_assert_int_eq(i, -1UL);
+
+    ilka_list_close(l1);
+    ilka_list_close(l0);
+
+    ilka_exit(r);
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
 // -----------------------------------------------------------------------------
 // insert
 // -----------------------------------------------------------------------------
@@ -250,6 +310,7 @@ END_TEST
 void make_suite(Suite *s)
 {
     ilka_tc(s, basic_test_st, true);
+    ilka_tc(s, compact_test_st, true);
     ilka_tc(s, insert_test_mt, true);
     ilka_tc(s, del_test_mt, true);
 }
@@ -22,10 +22,14 @@ void run_access_bench(struct ilka_bench *b, void *data, size_t id, size_t n)
     (void) id;
     struct access_bench *t = data;
 
+    uint64_t sum = 0;
+
     ilka_bench_start(b);
 
-    for (size_t i = 0; i < n; ++i)
-        ilka_read(t->r, t->off, sizeof(uint64_t));
+    for (size_t i = 0; i < n; ++i) {
+        sum += *((const uint64_t *) ilka_read(t->r, t->off, sizeof(uint64_t)));
+        ilka_no_opt_val(sum);
+    }
 }
 
 enum type { st, mt };
@@ -39,10 +43,12 @@ void access_bench_runner(size_t i, enum type type)
     };
     struct ilka_region *r = ilka_open("blah", &options);
 
-    ilka_off_t pages[32];
+    // large enough to force a new vma on every grow.
+    enum { vmas = 128, vma_len = 1UL << 21 };
+    ilka_off_t pages[vmas];
 
-    for (size_t i = 0; i < 32; ++i)
-        pages[i] = ilka_grow(r, 2 * ILKA_PAGE_SIZE);
+    for (size_t i = 0; i < vmas; ++i)
+        pages[i] = ilka_grow(r, vma_len);
 
     char title[256];
     struct access_bench data = { .r = r };
@@ -69,6 +75,7 @@ START_TEST(access_bench_4_st) { access_bench_runner(4, st); } END_TEST
 START_TEST(access_bench_8_st) { access_bench_runner(8, st); } END_TEST
 START_TEST(access_bench_16_st) { access_bench_runner(16, st); } END_TEST
 START_TEST(access_bench_32_st) { access_bench_runner(32, st); } END_TEST
+START_TEST(access_bench_128_st) { access_bench_runner(128, st); } END_TEST
 
 START_TEST(access_bench_1_mt) { access_bench_runner(1, mt); } END_TEST
 START_TEST(access_bench_2_mt) { access_bench_runner(2, mt); } END_TEST
@@ -76,6 +83,275 @@ START_TEST(access_bench_4_mt) { access_bench_runner(4, mt); } END_TEST
 START_TEST(access_bench_8_mt) { access_bench_runner(8, mt); } END_TEST
 START_TEST(access_bench_16_mt) { access_bench_runner(16, mt); } END_TEST
 START_TEST(access_bench_32_mt) { access_bench_runner(32, mt); } END_TEST
+START_TEST(access_bench_128_mt) { access_bench_runner(128, mt); } END_TEST
+
+
+// -----------------------------------------------------------------------------
+// fixed bench
+// -----------------------------------------------------------------------------
+
+// The inline ilka_read is compared against its out-of-line slow path and
+// against raw pointers into the mapping.
+void run_access_slow_bench(struct ilka_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+    struct access_bench *t = data;
+
+    uint64_t sum = 0;
+
+    ilka_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        sum += *((const uint64_t *) ilka_read_slow(t->r, t->off, sizeof(uint64_t)));
+        ilka_no_opt_val(sum);
+    }
+}
+
+void run_access_raw_bench(struct ilka_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+    struct access_bench *t = data;
+
+    const uint64_t *ptr = ilka_read(t->r, t->off, sizeof(uint64_t));
+    uint64_t sum = 0;
+
+    ilka_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        sum += *ptr;
+        ilka_no_opt_val(sum);
+    }
+}
+
+void fixed_bench_runner(const char *title, ilka_bench_fn_t fn, enum type type)
+{
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .max_len = 1UL << 40,
+    };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    struct access_bench data = { .r = r };
+    for (size_t i = 0; i < 128; ++i)
+        data.off = ilka_grow(r, 1UL << 21);
+
+    switch (type) {
+    case st: ilka_bench_st(title, fn, &data); break;
+    case mt: ilka_bench_mt(title, fn, &data); break;
+    }
+
+    if (!ilka_close(r)) ilka_abort();
+}
+
+START_TEST(access_fixed_bench_st)
+{
+    fixed_bench_runner("access_fixed_bench_st", run_access_bench, st);
+}
+END_TEST
+
+START_TEST(access_fixed_bench_mt)
+{
+    fixed_bench_runner("access_fixed_bench_mt", run_access_bench, mt);
+}
+END_TEST
+
+START_TEST(access_fixed_slow_bench_st)
+{
+    fixed_bench_runner("access_fixed_slow_bench_st", run_access_slow_bench, st);
+}
+END_TEST
+
+START_TEST(access_fixed_raw_bench_st)
+{
+    fixed_bench_runner("access_fixed_raw_bench_st", run_access_raw_bench, st);
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// random bench
+// -----------------------------------------------------------------------------
+
+struct random_bench
+{
+    struct ilka_region *r;
+    ilka_off_t off;
+    size_t len;
+    size_t prefetch;
+};
+
+static uint64_t random_next(uint64_t x)
+{
+    return x * 6364136223846793005UL + 1442695040888963407UL;
+}
+
+void run_random_bench(struct ilka_bench *b, void *data, size_t id, size_t n)
+{
+    struct random_bench *t = data;
+    const size_t words = t->len / sizeof(uint64_t);
+
+    uint64_t x = id + 1;
+    uint64_t sum = 0;
+
+    // walks the same sequence as x but prefetch steps ahead.
+    uint64_t ahead = x;
+    for (size_t i = 0; i < t->prefetch; ++i) ahead = random_next(ahead);
+
+    ilka_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        if (t->prefetch) {
+            ahead = random_next(ahead);
+            ilka_off_t off = t->off + ((ahead >> 16) % words) * sizeof(uint64_t);
+            ilka_prefetch(t->r, off, sizeof(uint64_t));
+        }
+
+        x = random_next(x);
+        ilka_off_t off = t->off + ((x >> 16) % words) * sizeof(uint64_t);
+
+        sum += *((const uint64_t *) ilka_read(t->r, off, sizeof(uint64_t)));
+        ilka_no_opt_val(sum);
+    }
+}
+
+void random_bench_runner(
+        const char *title, bool huge, size_t prefetch, enum type type)
+{
+    enum { len = 1UL << 26 };
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .huge_pages = huge,
+    };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    struct random_bench data = { .r = r, .len = len, .prefetch = prefetch };
+    data.off = ilka_grow(r, len);
+    memset(ilka_write(r, data.off, len), 0xFF, len);
+
+    switch (type) {
+    case st: ilka_bench_st(title, run_random_bench, &data); break;
+    case mt: ilka_bench_mt(title, run_random_bench, &data); break;
+    }
+
+    if (!ilka_close(r)) ilka_abort();
+}
+
+START_TEST(random_bench_st) { random_bench_runner("random_bench_st", false, 0, st); } END_TEST
+START_TEST(random_bench_mt) { random_bench_runner("random_bench_mt", false, 0, mt); } END_TEST
+START_TEST(random_huge_bench_st) { random_bench_runner("random_huge_bench_st", true, 0, st); } END_TEST
+START_TEST(random_huge_bench_mt) { random_bench_runner("random_huge_bench_mt", true, 0, mt); } END_TEST
+START_TEST(random_prefetch_bench_st) { random_bench_runner("random_prefetch_bench_st", false, 8, st); } END_TEST
+START_TEST(random_prefetch_bench_mt) { random_bench_runner("random_prefetch_bench_mt", false, 8, mt); } END_TEST
+
+
+// -----------------------------------------------------------------------------
+// scan bench
+// -----------------------------------------------------------------------------
+
+struct scan_bench
+{
+    const char *file;
+    struct ilka_region *r;
+    ilka_off_t off;
+    size_t len;
+
+    enum ilka_advice advice;
+};
+
+static void scan_bench_read(struct scan_bench *t, struct ilka_region *r, size_t n)
+{
+    const size_t pages = t->len / ILKA_PAGE_SIZE;
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        ilka_off_t off = t->off + (i % pages) * ILKA_PAGE_SIZE;
+        sum += *((const uint64_t *) ilka_read(r, off, sizeof(uint64_t)));
+        ilka_no_opt_val(sum);
+    }
+}
+
+// Cold runs map the region from scratch such that every page faults.
+void run_scan_bench(struct ilka_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+    struct scan_bench *t = data;
+
+    struct ilka_region *r = t->r;
+    if (!r) {
+        struct ilka_options options = { .open = true, .read_only = true };
+        r = ilka_open(t->file, &options);
+    }
+
+    size_t len = n * ILKA_PAGE_SIZE;
+    if (len > t->len) len = t->len;
+
+    ilka_bench_start(b);
+
+    if (t->advice != ilka_advice_normal) {
+        if (!ilka_advise(r, t->off, len, t->advice)) ilka_abort();
+    }
+    scan_bench_read(t, r, n);
+
+    ilka_bench_stop(b);
+
+    if (!t->r && !ilka_close(r)) ilka_abort();
+}
+
+void scan_bench_runner(const char *title, bool warm, enum ilka_advice advice)
+{
+    // large enough for cold runs to never wrap around.
+    enum { len = 1UL << 28 };
+
+    struct ilka_options options = { .open = true, .create = true };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    struct scan_bench data = { .file = "blah", .len = len, .advice = advice };
+    data.off = ilka_grow(r, len);
+    memset(ilka_write(r, data.off, len), 0xFF, len);
+
+    if (warm) {
+        data.r = r;
+        scan_bench_read(&data, r, len / ILKA_PAGE_SIZE);
+    }
+    else if (!ilka_save(r)) ilka_abort();
+
+    ilka_bench_st(title, run_scan_bench, &data);
+
+    if (!ilka_close(r)) ilka_abort();
+}
+
+START_TEST(scan_cold_bench_st)
+{
+    scan_bench_runner("scan_cold_bench_st", false, ilka_advice_normal);
+}
+END_TEST
+
+START_TEST(scan_cold_willneed_bench_st)
+{
+    scan_bench_runner("scan_cold_willneed_bench_st", false, ilka_advice_willneed);
+}
+END_TEST
+
+START_TEST(scan_cold_sequential_bench_st)
+{
+    scan_bench_runner("scan_cold_sequential_bench_st", false, ilka_advice_sequential);
+}
+END_TEST
+
+START_TEST(scan_warm_bench_st)
+{
+    scan_bench_runner("scan_warm_bench_st", true, ilka_advice_normal);
+}
+END_TEST
+
+START_TEST(scan_warm_willneed_bench_st)
+{
+    scan_bench_runner("scan_warm_willneed_bench_st", true, ilka_advice_willneed);
+}
+END_TEST
 
 
 // -----------------------------------------------------------------------------
@@ -96,6 +372,23 @@ void make_suite(Suite *s)
     ilka_tc(s, access_bench_16_mt, true);
     ilka_tc(s, access_bench_32_st, true);
     ilka_tc(s, access_bench_32_mt, true);
+    ilka_tc(s, access_bench_128_st, true);
+    ilka_tc(s, access_bench_128_mt, true);
+    ilka_tc(s, access_fixed_bench_st, true);
+    ilka_tc(s, access_fixed_bench_mt, true);
+    ilka_tc(s, access_fixed_slow_bench_st, true);
+    ilka_tc(s, access_fixed_raw_bench_st, true);
+    ilka_tc(s, random_bench_st, true);
+    ilka_tc(s, random_bench_mt, true);
+    ilka_tc(s, random_huge_bench_st, true);
+    ilka_tc(s, random_huge_bench_mt, true);
+    ilka_tc(s, random_prefetch_bench_st, true);
+    ilka_tc(s, random_prefetch_bench_mt, true);
+    ilka_tc(s, scan_cold_bench_st, true);
+    ilka_tc(s, scan_cold_willneed_bench_st, true);
+    ilka_tc(s, scan_cold_sequential_bench_st, true);
+    ilka_tc(s, scan_warm_bench_st, true);
+    ilka_tc(s, scan_warm_willneed_bench_st, true);
 }
 
 int main(void)
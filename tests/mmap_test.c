@@ -5,6 +5,8 @@
 
 #include "check.h"
 
+#include <sys/stat.h>
+
 void coalesce(struct ilka_region *r)
 {
     ilka_world_stop(r);
@@ -58,6 +60,410 @@ START_TEST(coalesce_test_st)
 END_TEST
 
 
+// -----------------------------------------------------------------------------
+// vma test
+// -----------------------------------------------------------------------------
+
+START_TEST(vma_test_st)
+{
+    // large enough to force a new vma on every grow.
+    const size_t n = 1UL << 21;
+    const size_t vmas = 16;
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .vma_reserved = ILKA_PAGE_SIZE
+    };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    ilka_off_t offs[vmas];
+    for (size_t i = 0; i < vmas; ++i) {
+        offs[i] = ilka_grow(r, n);
+
+        uint64_t *head = ilka_write(r, offs[i], sizeof(uint64_t));
+        *head = i;
+
+        uint64_t *tail = ilka_write(r, offs[i] + n - sizeof(uint64_t), sizeof(uint64_t));
+        *tail = ~i;
+    }
+
+    for (size_t i = 0; i < vmas; ++i) {
+        const uint64_t *head = ilka_read(r, offs[i], sizeof(uint64_t));
+        ck_assert_int_eq(*head, i);
+
+        const uint64_t *tail = ilka_read(r, offs[i] + n - sizeof(uint64_t), sizeof(uint64_t));
+        ck_assert_int_eq(*tail, ~i);
+    }
+
+    coalesce(r);
+
+    for (size_t i = 1; i < vmas; ++i) {
+        const uint64_t *p = ilka_read(r, offs[i] - sizeof(uint64_t), 2 * sizeof(uint64_t));
+        ck_assert_int_eq(p[0], ~(i - 1));
+        ck_assert_int_eq(p[1], i);
+    }
+
+    // A coalesced region is left in place by the following world stops.
+    const void *base = ilka_read(r, offs[0], sizeof(uint64_t));
+    coalesce(r);
+    ck_assert(ilka_read(r, offs[0], sizeof(uint64_t)) == base);
+
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// straddle test
+// -----------------------------------------------------------------------------
+
+START_TEST(straddle_test_st)
+{
+    const size_t n = 1UL << 20;
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .vma_reserved = ILKA_PAGE_SIZE
+    };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    for (size_t i = 1; i < 8; ++i) {
+        ilka_off_t off = ilka_grow(r, i * n);
+        ck_assert(off + i * n <= ilka_len(r));
+        memset(ilka_write(r, off, i * n), i, i * n);
+
+        const uint8_t *p = ilka_read(r, off, i * n);
+        for (size_t j = 0; j < i * n; j += ILKA_PAGE_SIZE)
+            ck_assert_int_eq(p[j], i);
+    }
+
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// slack test
+// -----------------------------------------------------------------------------
+
+START_TEST(slack_test_st)
+{
+    const size_t n = 1UL << 20;
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .vma_reserved = ILKA_PAGE_SIZE
+    };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    // the first grow fills most of the first vma so the second one can't fit
+    // in what's left and has to skip it.
+    ilka_grow(r, n);
+    size_t slack = ilka_len(r);
+    ilka_off_t off = ilka_grow(r, 2 * n);
+    ck_assert(off > slack);
+
+    // the skipped range is handed to the page allocator.
+    for (size_t i = 0; i < (off - slack) / ILKA_PAGE_SIZE; ++i) {
+        ilka_off_t page = ilka_alloc(r, ILKA_PAGE_SIZE);
+        ck_assert(page >= slack && page < off);
+        memset(ilka_write(r, page, ILKA_PAGE_SIZE), 0xFF, ILKA_PAGE_SIZE);
+    }
+
+    const uint8_t *p = ilka_read(r, off, 2 * n);
+    for (size_t i = 0; i < 2 * n; i += ILKA_PAGE_SIZE) ck_assert_int_eq(p[i], 0);
+
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// fixed test
+// -----------------------------------------------------------------------------
+
+START_TEST(fixed_test_st)
+{
+    const size_t n = 1UL << 21;
+    const size_t grows = 16;
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .vma_reserved = ILKA_PAGE_SIZE,
+        .max_len = 1UL << 30,
+    };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    ilka_off_t start = ilka_grow(r, n);
+    const uint8_t *base = ilka_read(r, start, n);
+
+    for (size_t i = 0; i < grows; ++i) {
+        ilka_off_t off = ilka_grow(r, n);
+        ck_assert_int_eq(off, start + (i + 1) * n);
+        memset(ilka_write(r, off, n), i, n);
+
+        coalesce(r);
+        ck_assert(ilka_read(r, start, n) == base);
+    }
+
+    // the entire region is contiguous so accesses can span grows.
+    const uint8_t *p = ilka_read(r, start + n, grows * n);
+    ck_assert(p == base + n);
+
+    for (size_t i = 0; i < grows * n; i += ILKA_PAGE_SIZE)
+        ck_assert_int_eq(p[i], i / n);
+
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// huge pages test
+// -----------------------------------------------------------------------------
+
+START_TEST(huge_pages_test_st)
+{
+    const size_t n = 3 * ILKA_PAGE_SIZE;
+    enum { grows = 1024 };
+
+    ilka_off_t offs[grows];
+    {
+        struct ilka_options options = {
+            .open = true,
+            .create = true,
+            .huge_pages = true,
+        };
+        struct ilka_region *r = ilka_open("blah", &options);
+
+        for (size_t i = 0; i < grows; ++i) {
+            offs[i] = ilka_grow(r, n);
+            memset(ilka_write(r, offs[i], n), i, n);
+        }
+
+        if (!ilka_close(r)) ilka_abort();
+    }
+
+    struct stat stat;
+    ck_assert(!lstat("blah", &stat));
+    ck_assert_int_eq(stat.st_size % ILKA_HUGE_PAGE_SIZE, 0);
+
+    for (size_t huge = 0; huge < 2; ++huge) {
+        struct ilka_options options = { .open = true, .huge_pages = huge };
+        struct ilka_region *r = ilka_open("blah", &options);
+
+        for (size_t i = 0; i < grows; ++i) {
+            const uint8_t *p = ilka_read(r, offs[i], n);
+            for (size_t j = 0; j < n; j += ILKA_PAGE_SIZE)
+                ck_assert_int_eq(p[j], i & 0xFF);
+        }
+
+        if (!ilka_close(r)) ilka_abort();
+    }
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// grow test
+// -----------------------------------------------------------------------------
+
+START_TEST(grow_test_st)
+{
+    const size_t grow_len = 1UL << 20;
+    const size_t n = ILKA_PAGE_SIZE;
+    enum { grows = 1024 };
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .grow_len = grow_len,
+        .grow_pct = 25,
+        .grow_prealloc = true,
+    };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    ilka_off_t offs[grows];
+    for (size_t i = 0; i < grows; ++i) {
+        offs[i] = ilka_grow(r, n);
+        memset(ilka_write(r, offs[i], n), i, n);
+
+        struct stat stat;
+        ck_assert(!lstat("blah", &stat));
+        ck_assert((size_t) stat.st_size >= ilka_len(r));
+        ck_assert((size_t) stat.st_size >= grow_len);
+    }
+
+    size_t len = ilka_len(r);
+    if (!ilka_close(r)) ilka_abort();
+
+    struct stat stat;
+    ck_assert(!lstat("blah", &stat));
+    ck_assert_int_eq(stat.st_size, len);
+
+    options.create = false;
+    r = ilka_open("blah", &options);
+    ck_assert_int_eq(ilka_len(r), len);
+
+    for (size_t i = 0; i < grows; ++i) {
+        const uint8_t *p = ilka_read(r, offs[i], n);
+        ck_assert_int_eq(p[0], i & 0xFF);
+        ck_assert_int_eq(p[n - 1], i & 0xFF);
+    }
+
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
+START_TEST(grow_crash_test_st)
+{
+    const size_t grow_len = 1UL << 20;
+    const size_t n = ILKA_PAGE_SIZE;
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .grow_len = grow_len,
+    };
+
+    size_t len;
+    ilka_off_t off;
+    {
+        struct ilka_region *r = ilka_open("blah", &options);
+        off = ilka_grow(r, n);
+        memset(ilka_write(r, off, n), 0xFF, n);
+        if (!ilka_save(r)) ilka_abort();
+        len = ilka_len(r);
+
+        // abandoned without being closed as if the process had crashed.
+    }
+
+    struct stat stat;
+    ck_assert(!lstat("blah", &stat));
+    ck_assert((size_t) stat.st_size >= grow_len);
+
+    options.create = false;
+    struct ilka_region *r = ilka_open("blah", &options);
+    ck_assert_int_eq(ilka_len(r), len);
+    ck_assert_int_eq(*(const uint8_t *) ilka_read(r, off, n), 0xFF);
+
+    // the tail of the file is reused without growing it.
+    ck_assert_int_eq(ilka_grow(r, n), len);
+    ck_assert(!lstat("blah", &stat));
+    ck_assert((size_t) stat.st_size >= grow_len);
+
+    if (!ilka_close(r)) ilka_abort();
+
+    ck_assert(!lstat("blah", &stat));
+    ck_assert_int_eq(stat.st_size, len + n);
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// advise test
+// -----------------------------------------------------------------------------
+
+START_TEST(advise_test_st)
+{
+    const size_t n = 1UL << 21;
+    const size_t vmas = 8;
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .vma_reserved = ILKA_PAGE_SIZE
+    };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    ilka_off_t offs[vmas];
+    for (size_t i = 0; i < vmas; ++i) {
+        offs[i] = ilka_grow(r, n);
+        memset(ilka_write(r, offs[i], n), i + 1, n);
+    }
+
+    // Ranges that span multiple vmas.
+    size_t len = ilka_len(r) - offs[0];
+    ilka_prefetch(r, offs[0] + 1, len - 1);
+    ilka_prefetch(r, offs[0], len + n);
+    ck_assert(ilka_advise(r, offs[0] + 1, len - 1, ilka_advice_willneed));
+    ck_assert(ilka_advise(r, offs[0], len, ilka_advice_sequential));
+    ck_assert(ilka_advise(r, offs[0], len, ilka_advice_random));
+    ck_assert(ilka_advise(r, offs[0], len, ilka_advice_normal));
+
+    for (size_t i = 0; i < vmas; ++i) {
+        const uint8_t *p = ilka_read(r, offs[i], n);
+        ck_assert_int_eq(p[0], i + 1);
+        ck_assert_int_eq(p[n - 1], i + 1);
+    }
+
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// pin test
+// -----------------------------------------------------------------------------
+
+static size_t locked_kb()
+{
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) ilka_abort();
+
+    char line[256];
+    size_t kb = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmLck: %lu kB", &kb) == 1) break;
+    }
+
+    fclose(f);
+    return kb;
+}
+
+START_TEST(pin_test_st)
+{
+    const size_t n = 1UL << 21;
+    const size_t vmas = 4;
+    const size_t pin_len = 16 * ILKA_PAGE_SIZE;
+
+    size_t base = locked_kb();
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .vma_reserved = ILKA_PAGE_SIZE,
+        .pin_header = true,
+    };
+    struct ilka_region *r = ilka_open("blah", &options);
+    ck_assert(locked_kb() > base);
+
+    ilka_off_t offs[vmas];
+    for (size_t i = 0; i < vmas; ++i) offs[i] = ilka_grow(r, n);
+
+    // straddles the edge of two vmas.
+    ck_assert(ilka_pin(r, offs[2] - pin_len / 2, pin_len));
+    size_t pinned = locked_kb();
+    ck_assert(pinned >= base + pin_len / 1024);
+
+    coalesce(r);
+    ck_assert_int_eq(locked_kb(), pinned);
+
+    memset(ilka_write(r, offs[2] - pin_len / 2, pin_len), 0xFF, pin_len);
+    const uint8_t *p = ilka_read(r, offs[2] - pin_len / 2, pin_len);
+    for (size_t i = 0; i < pin_len; ++i) ck_assert_int_eq(p[i], 0xFF);
+
+    if (!ilka_close(r)) ilka_abort();
+    ck_assert_int_eq(locked_kb(), base);
+}
+END_TEST
+
+
 // -----------------------------------------------------------------------------
 // setup
 // -----------------------------------------------------------------------------
@@ -65,6 +471,15 @@ END_TEST
 void make_suite(Suite *s)
 {
     ilka_tc(s, coalesce_test_st, true);
+    ilka_tc(s, vma_test_st, true);
+    ilka_tc(s, straddle_test_st, true);
+    ilka_tc(s, slack_test_st, true);
+    ilka_tc(s, fixed_test_st, true);
+    ilka_tc(s, huge_pages_test_st, true);
+    ilka_tc(s, grow_test_st, true);
+    ilka_tc(s, grow_crash_test_st, true);
+    ilka_tc(s, advise_test_st, true);
+    ilka_tc(s, pin_test_st, true);
 }
 
 int main(void)
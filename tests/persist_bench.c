@@ -68,6 +68,49 @@ START_TEST(marks_small_bench_mt)
 END_TEST
 
 
+START_TEST(marks_in_memory_bench_st)
+{
+    enum { len = sizeof(uint64_t) };
+
+    struct ilka_options options = { .in_memory = true };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    struct marks_bench data = {
+        .r = r,
+        .off = ilka_alloc(r, len),
+        .len = len
+    };
+    ilka_bench_st("marks_in_memory_bench_st", run_marks_bench, &data);
+
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
+START_TEST(marks_soft_dirty_bench_st)
+{
+    enum { len = sizeof(uint64_t) };
+    if (!ilka_soft_dirty_supported()) return;
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .persist_track = ilka_track_soft_dirty,
+    };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    struct marks_bench data = {
+        .r = r,
+        .off = ilka_alloc(r, len),
+        .len = len
+    };
+    ilka_bench_st("marks_soft_dirty_bench_st", run_marks_bench, &data);
+
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
 START_TEST(marks_large_bench_st)
 {
     enum { len = ILKA_PAGE_SIZE };
@@ -105,6 +148,174 @@ START_TEST(marks_large_bench_mt)
 END_TEST
 
 
+// -----------------------------------------------------------------------------
+// save
+// -----------------------------------------------------------------------------
+
+struct save_bench
+{
+    struct ilka_region *r;
+
+    ilka_off_t off;
+    size_t pages;
+    size_t dirty;
+
+    size_t written;
+};
+
+void run_save_bench(struct ilka_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+    struct save_bench *t = data;
+    if (!ilka_srand(1)) ilka_abort();
+
+    ilka_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < t->dirty; ++j) {
+            size_t page = ilka_rand() % t->pages;
+            uint64_t *p = ilka_write(t->r, t->off + page * ILKA_PAGE_SIZE, sizeof(uint64_t));
+            *p = i;
+            t->written += sizeof(uint64_t);
+        }
+
+        if (!ilka_save(t->r)) ilka_abort();
+    }
+}
+
+static void save_bench(
+        const char *title,
+        enum ilka_persist_engine engine,
+        enum ilka_persist_track track,
+        size_t dirty)
+{
+    enum { pages = 1 << 14 };
+    if (track == ilka_track_soft_dirty && !ilka_soft_dirty_supported()) return;
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .persist_engine = engine,
+        .persist_track = track,
+    };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    struct save_bench data = {
+        .r = r,
+        .off = ilka_alloc(r, pages * ILKA_PAGE_SIZE),
+        .pages = pages,
+        .dirty = dirty,
+    };
+    memset(ilka_write(r, data.off, pages * ILKA_PAGE_SIZE), 0, pages * ILKA_PAGE_SIZE);
+    if (!ilka_save(r)) ilka_abort();
+
+    struct ilka_persist_stats before;
+    if (!ilka_persist_stats(r, &before)) ilka_abort();
+
+    ilka_bench_st(title, run_save_bench, &data);
+
+    // Includes the meta lines that every save writes.
+    struct ilka_persist_stats after;
+    if (!ilka_persist_stats(r, &after)) ilka_abort();
+    printf("bench: %-30s saved %.2f bytes per byte written\n",
+            title, (double) (after.saved_len - before.saved_len) / data.written);
+
+    if (!ilka_close(r)) ilka_abort();
+}
+
+START_TEST(save_fork_small_bench_st)
+{
+    save_bench("save_fork_small_bench_st",
+            ilka_persist_fork, ilka_track_marks, 1);
+}
+END_TEST
+
+START_TEST(save_shared_small_bench_st)
+{
+    save_bench("save_shared_small_bench_st",
+            ilka_persist_shared, ilka_track_marks, 1);
+}
+END_TEST
+
+START_TEST(save_soft_dirty_small_bench_st)
+{
+    save_bench("save_soft_dirty_small_bench_st",
+            ilka_persist_fork, ilka_track_soft_dirty, 1);
+}
+END_TEST
+
+START_TEST(save_fork_large_bench_st)
+{
+    save_bench("save_fork_large_bench_st",
+            ilka_persist_fork, ilka_track_marks, 256);
+}
+END_TEST
+
+START_TEST(save_shared_large_bench_st)
+{
+    save_bench("save_shared_large_bench_st",
+            ilka_persist_shared, ilka_track_marks, 256);
+}
+END_TEST
+
+START_TEST(save_soft_dirty_large_bench_st)
+{
+    save_bench("save_soft_dirty_large_bench_st",
+            ilka_persist_fork, ilka_track_soft_dirty, 256);
+}
+END_TEST
+
+// Every thread saves after each write which group commit batches into shared
+// saves.
+struct save_group_bench
+{
+    struct ilka_region *r;
+    ilka_off_t off;
+
+    size_t calls;
+};
+
+void run_save_group_bench(struct ilka_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+    struct save_group_bench *t = data;
+
+    ilka_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        if (!ilka_enter(t->r)) ilka_abort();
+        *((uint64_t *) ilka_write(t->r, t->off, sizeof(uint64_t))) = i;
+        ilka_exit(t->r);
+
+        if (!ilka_save(t->r)) ilka_abort();
+    }
+
+    ilka_atomic_fetch_add(&t->calls, n, morder_relaxed);
+}
+
+START_TEST(save_group_bench_mt)
+{
+    struct ilka_options options = { .open = true, .create = true };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    struct save_group_bench data = {
+        .r = r,
+        .off = ilka_alloc(r, sizeof(uint64_t)),
+    };
+
+    struct ilka_persist_stats before;
+    if (!ilka_persist_stats(r, &before)) ilka_abort();
+
+    ilka_bench_mt("save_group_bench_mt", run_save_group_bench, &data);
+
+    struct ilka_persist_stats after;
+    if (!ilka_persist_stats(r, &after)) ilka_abort();
+    printf("bench: %-30s %.2f saves per call\n", "save_group_bench_mt",
+            (double) (after.saves - before.saves) / data.calls);
+
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
 
 
 // -----------------------------------------------------------------------------
@@ -115,8 +326,17 @@ void make_suite(Suite *s)
 {
     ilka_tc(s, marks_small_bench_st, true);
     ilka_tc(s, marks_small_bench_mt, true);
+    ilka_tc(s, marks_in_memory_bench_st, true);
+    ilka_tc(s, marks_soft_dirty_bench_st, true);
     ilka_tc(s, marks_large_bench_st, true);
     ilka_tc(s, marks_large_bench_mt, true);
+    ilka_tc(s, save_fork_small_bench_st, true);
+    ilka_tc(s, save_shared_small_bench_st, true);
+    ilka_tc(s, save_soft_dirty_small_bench_st, true);
+    ilka_tc(s, save_fork_large_bench_st, true);
+    ilka_tc(s, save_shared_large_bench_st, true);
+    ilka_tc(s, save_soft_dirty_large_bench_st, true);
+    ilka_tc(s, save_group_bench_mt, true);
 }
 
 int main(void)
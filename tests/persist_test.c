@@ -5,17 +5,26 @@
 
 #include "check.h"
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
 
 // -----------------------------------------------------------------------------
 // marks
 // -----------------------------------------------------------------------------
 
-START_TEST(marks_test_st)
+static void marks_test(enum ilka_persist_engine engine)
 {
     const char *file = "blah";
     const size_t max_len = 1UL << 20;
 
-    struct ilka_options options = { .open = true, .create = true };
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .persist_engine = engine,
+    };
     struct ilka_region *r = ilka_open(file, &options);
 
     ilka_off_t root;
@@ -50,12 +59,315 @@ START_TEST(marks_test_st)
 
     if (!ilka_close(r)) ilka_abort();
 }
+
+START_TEST(marks_test_st)
+{
+    marks_test(ilka_persist_fork);
+}
+END_TEST
+
+START_TEST(marks_shared_test_st)
+{
+    marks_test(ilka_persist_shared);
+}
+END_TEST
+
+// Every thread marks its own set which must be merged by the save even if the
+// thread exited beforehand.
+struct marks_threads_test
+{
+    struct ilka_region *r;
+    ilka_off_t off;
+    size_t len;
+    uint8_t c;
+};
+
+static void * marks_threads_run(void *data)
+{
+    struct marks_threads_test *t = data;
+    memset(ilka_write(t->r, t->off, t->len), t->c, t->len);
+    return NULL;
+}
+
+START_TEST(marks_threads_test_st)
+{
+    enum { threads = 4, n = 1 << 20 };
+
+    struct ilka_options options = { .open = true, .create = true };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    ilka_off_t root = ilka_alloc(r, threads * n);
+    ilka_set_root(r, root);
+
+    struct marks_threads_test data[threads];
+    pthread_t tids[threads];
+    for (size_t i = 0; i < threads; ++i) {
+        data[i] = (struct marks_threads_test) { r, root + i * n, n, i + 1 };
+        ck_assert(!pthread_create(&tids[i], NULL, marks_threads_run, &data[i]));
+    }
+    for (size_t i = 0; i < threads; ++i) ck_assert(!pthread_join(tids[i], NULL));
+
+    if (!ilka_save(r)) ilka_abort();
+
+    struct ilka_options ro = { .open = true, .read_only = true };
+    struct ilka_region *tr = ilka_open("blah", &ro);
+
+    const uint8_t *p = ilka_read(tr, root, threads * n);
+    for (size_t i = 0; i < threads * n; ++i) {
+        ilka_assert(p[i] == i / n + 1, "unexpected value (%lu != %lu): i=%lu",
+                (size_t) p[i], i / n + 1, i);
+    }
+
+    if (!ilka_close(tr)) ilka_abort();
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+// Scattered writes far into the region should only save the lines they touch
+// along with the lines of the meta which holds the generation.
+START_TEST(marks_exact_test_st)
+{
+    enum { n = 1 << 26, writes = 16 };
+
+    struct ilka_options options = { .open = true, .create = true };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    ilka_off_t root = ilka_alloc(r, n);
+    memset(ilka_write(r, root, n), 0, n);
+    if (!ilka_save(r)) ilka_abort();
+
+    struct ilka_persist_stats before;
+    ck_assert(ilka_persist_stats(r, &before));
+
+    for (size_t i = 0; i < writes; ++i) {
+        ilka_off_t off = root + (n / writes) * i + (n / writes) / 2;
+        *((uint64_t *) ilka_write(r, off, sizeof(uint64_t))) = i + 1;
+    }
+    if (!ilka_save(r)) ilka_abort();
+
+    struct ilka_persist_stats after;
+    ck_assert(ilka_persist_stats(r, &after));
+    ck_assert_int_eq(after.saves, before.saves + 1);
+    ck_assert(after.saved_len - before.saved_len <= (writes + 2) * ILKA_CACHE_LINE);
+
+    if (!ilka_close(r)) ilka_abort();
+
+    struct ilka_options ro = { .open = true, .read_only = true };
+    r = ilka_open("blah", &ro);
+    for (size_t i = 0; i < writes; ++i) {
+        ilka_off_t off = root + (n / writes) * i + (n / writes) / 2;
+        ck_assert_int_eq(*((const uint64_t *) ilka_read(r, off, sizeof(uint64_t))), i + 1);
+    }
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+// The kernel tracks the writes by page. Skipped if the kernel doesn't expose
+// the soft-dirty bits.
+START_TEST(soft_dirty_test_st)
+{
+    if (!ilka_soft_dirty_supported()) return;
+
+    enum { n = 1 << 26, writes = 16 };
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .persist_track = ilka_track_soft_dirty,
+    };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    ilka_off_t root = ilka_alloc(r, n);
+    memset(ilka_write(r, root, n), 0, n);
+    if (!ilka_save(r)) ilka_abort();
+
+    struct ilka_persist_stats before;
+    ck_assert(ilka_persist_stats(r, &before));
+
+    for (size_t i = 0; i < writes; ++i) {
+        ilka_off_t off = root + (n / writes) * i + (n / writes) / 2;
+        *((uint64_t *) ilka_write(r, off, sizeof(uint64_t))) = i + 1;
+    }
+    if (!ilka_save(r)) ilka_abort();
+
+    // Pages are saved whole and the meta page is written by every save.
+    struct ilka_persist_stats after;
+    ck_assert(ilka_persist_stats(r, &after));
+    ck_assert_int_eq(after.saves, before.saves + 1);
+    ck_assert(after.saved_len - before.saved_len >= writes * ILKA_PAGE_SIZE);
+    ck_assert(after.saved_len - before.saved_len <= (writes + 1) * ILKA_PAGE_SIZE);
+
+    if (!ilka_close(r)) ilka_abort();
+
+    struct ilka_options ro = { .open = true, .read_only = true };
+    r = ilka_open("blah", &ro);
+    for (size_t i = 0; i < writes; ++i) {
+        ilka_off_t off = root + (n / writes) * i + (n / writes) / 2;
+        ck_assert_int_eq(*((const uint64_t *) ilka_read(r, off, sizeof(uint64_t))), i + 1);
+    }
+    if (!ilka_close(r)) ilka_abort();
+}
 END_TEST
 
 // -----------------------------------------------------------------------------
 // save
 // -----------------------------------------------------------------------------
 
+struct save_async_test
+{
+    size_t calls;
+    bool ok;
+};
+
+static void save_async_done(void *data, bool ok)
+{
+    struct save_async_test *t = data;
+    t->calls++;
+    t->ok = ok;
+}
+
+static void save_async_check(const char *file, ilka_off_t off, uint64_t value)
+{
+    struct ilka_options ro = { .open = true, .read_only = true };
+    struct ilka_region *r = ilka_open(file, &ro);
+    ck_assert_int_eq(*((const uint64_t *) ilka_read(r, off, sizeof(uint64_t))), value);
+    if (!ilka_close(r)) ilka_abort();
+}
+
+START_TEST(save_async_test_st)
+{
+    const char *file = "blah";
+
+    struct ilka_options options = { .open = true, .create = true };
+    struct ilka_region *r = ilka_open(file, &options);
+
+    ilka_off_t off = ilka_alloc(r, sizeof(uint64_t));
+
+    // Polled to completion.
+    struct save_async_test first = {0};
+    *((uint64_t *) ilka_write(r, off, sizeof(uint64_t))) = 1;
+    ck_assert(ilka_save_async(r, save_async_done, &first));
+    while (!ilka_save_poll(r)) ilka_nsleep(100 * 1000);
+    ck_assert_int_eq(first.calls, 1);
+    ck_assert(first.ok);
+    save_async_check(file, off, 1);
+
+    // Queued behind the save in progress instead of waiting on it and picked up
+    // by the polls which snapshot the writes made in between.
+    struct save_async_test second = {0}, third = {0};
+    *((uint64_t *) ilka_write(r, off, sizeof(uint64_t))) = 2;
+    ck_assert(ilka_save_async(r, save_async_done, &second));
+    *((uint64_t *) ilka_write(r, off, sizeof(uint64_t))) = 3;
+    ck_assert(ilka_save_async(r, save_async_done, &third));
+    while (!ilka_save_poll(r)) ilka_nsleep(100 * 1000);
+    ck_assert_int_eq(second.calls, 1);
+    ck_assert(second.ok);
+    ck_assert_int_eq(third.calls, 1);
+    ck_assert(third.ok);
+    save_async_check(file, off, 3);
+
+    // Completed by the close.
+    struct save_async_test fourth = {0};
+    *((uint64_t *) ilka_write(r, off, sizeof(uint64_t))) = 4;
+    ck_assert(ilka_save_async(r, save_async_done, &fourth));
+    if (!ilka_close(r)) ilka_abort();
+    ck_assert_int_eq(fourth.calls, 1);
+    ck_assert(fourth.ok);
+    ck_assert_int_eq(first.calls, 1);
+    save_async_check(file, off, 4);
+}
+END_TEST
+
+// Concurrent callers are batched into shared saves which must still cover the
+// writes that every caller made before calling ilka_save. Writes that race with
+// a save must be made within an epoch.
+struct save_group_test
+{
+    struct ilka_region *r;
+    ilka_off_t off;
+    size_t saves;
+};
+
+static void * save_group_run(void *data)
+{
+    struct save_group_test *t = data;
+
+    for (size_t i = 0; i < t->saves; ++i) {
+        if (!ilka_enter(t->r)) ilka_abort();
+        *((uint64_t *) ilka_write(t->r, t->off, sizeof(uint64_t))) = i + 1;
+        ilka_exit(t->r);
+
+        if (!ilka_save(t->r)) ilka_abort();
+    }
+
+    return NULL;
+}
+
+static void save_group_queued(void *data)
+{
+    pthread_barrier_wait(data);
+}
+
+static size_t save_group_round(
+        struct ilka_region *r, ilka_off_t root, size_t threads, size_t saves)
+{
+    struct ilka_persist_stats before;
+    ck_assert(ilka_persist_stats(r, &before));
+
+    struct save_group_test data[threads];
+    pthread_t tids[threads];
+    for (size_t i = 0; i < threads; ++i) {
+        data[i] = (struct save_group_test) { r, root + i * ILKA_CACHE_LINE, saves };
+        ck_assert(!pthread_create(&tids[i], NULL, save_group_run, &data[i]));
+    }
+    for (size_t i = 0; i < threads; ++i) ck_assert(!pthread_join(tids[i], NULL));
+
+    struct ilka_persist_stats after;
+    ck_assert(ilka_persist_stats(r, &after));
+    return after.saves - before.saves;
+}
+
+static void save_group_check(
+        const char *file, ilka_off_t root, size_t threads, uint64_t value)
+{
+    struct ilka_options ro = { .open = true, .read_only = true };
+    struct ilka_region *tr = ilka_open(file, &ro);
+    for (size_t i = 0; i < threads; ++i) {
+        const uint64_t *p = ilka_read(tr, root + i * ILKA_CACHE_LINE, sizeof(uint64_t));
+        ck_assert_int_eq(*p, value);
+    }
+    if (!ilka_close(tr)) ilka_abort();
+}
+
+START_TEST(save_group_test_st)
+{
+    enum { threads = 8, saves = 16 };
+    const char *file = "blah";
+
+    struct ilka_options options = { .open = true, .create = true };
+    struct ilka_region *r = ilka_open(file, &options);
+
+    ilka_off_t root = ilka_alloc(r, threads * ILKA_CACHE_LINE);
+
+    // Every caller is queued up before any of them can lead so they're all
+    // covered by the first save.
+    pthread_barrier_t barrier;
+    ck_assert(!pthread_barrier_init(&barrier, NULL, threads));
+    ilka_dbg_save_queued(r, save_group_queued, &barrier);
+    ck_assert_int_eq(save_group_round(r, root, threads, 1), 1);
+    ilka_dbg_save_queued(r, NULL, NULL);
+    pthread_barrier_destroy(&barrier);
+    save_group_check(file, root, threads, 1);
+
+    // Batching now depends on scheduling but a caller never leads more than
+    // one save per call.
+    ck_assert(save_group_round(r, root, threads, saves) <= threads * saves);
+    save_group_check(file, root, threads, saves);
+
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
 struct save_test
 {
     const char *file;
@@ -136,13 +448,17 @@ void run_save_test(size_t id, void *data)
     }
 }
 
-START_TEST(save_test_mt)
+static void save_test(bool reclaim)
 {
     enum { threads = 128 };
 
     const char *file = "blah";
 
-    struct ilka_options options = { .open = true, .create = true };
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .persist_reclaim = reclaim,
+    };
     struct ilka_region *r = ilka_open(file, &options);
 
     size_t n = threads * sizeof(ilka_off_t);
@@ -160,6 +476,546 @@ START_TEST(save_test_mt)
 
     if (!ilka_close(r)) ilka_abort();
 }
+
+START_TEST(save_test_mt)
+{
+    save_test(false);
+}
+END_TEST
+
+START_TEST(save_reclaim_test_mt)
+{
+    save_test(true);
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// reclaim
+// -----------------------------------------------------------------------------
+
+START_TEST(reclaim_test_st)
+{
+    enum { pages = 64, n = pages * ILKA_PAGE_SIZE };
+    const char *file = "blah";
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .persist_reclaim = true,
+    };
+    struct ilka_region *r = ilka_open(file, &options);
+
+    ilka_off_t root = ilka_alloc(r, n);
+    memset(ilka_write(r, root, n), 0, n);
+    if (!ilka_save(r)) ilka_abort();
+
+    for (uint8_t c = 1; c < 8; ++c) {
+
+        // Rewrite every other page such that reclaimed and unreclaimed pages
+        // are interleaved.
+        for (size_t page = c % 2; page < pages; page += 2) {
+            size_t off = root + page * ILKA_PAGE_SIZE;
+            memset(ilka_write(r, off, ILKA_PAGE_SIZE), c, ILKA_PAGE_SIZE);
+        }
+        if (!ilka_save(r)) ilka_abort();
+
+        struct ilka_options options = { .open = true, .read_only = true };
+        struct ilka_region *tr = ilka_open(file, &options);
+
+        const uint8_t *p = ilka_read(r, root, n);
+        const uint8_t *tp = ilka_read(tr, root, n);
+        for (size_t i = 0; i < n; ++i) {
+            size_t page = i / ILKA_PAGE_SIZE;
+            uint8_t exp = page % 2 == c % 2 ? c : c - 1;
+
+            ilka_assert(p[i] == exp, "unexpected value (%lu != %lu): i=%lu, c=%lu",
+                    (size_t) p[i], (size_t) exp, i, (size_t) c);
+            ilka_assert(tp[i] == exp, "unexpected saved value (%lu != %lu): i=%lu, c=%lu",
+                    (size_t) tp[i], (size_t) exp, i, (size_t) c);
+        }
+
+        if (!ilka_close(tr)) ilka_abort();
+    }
+
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+// Pinned pages are locked which MADV_DONTNEED refuses so they're left resident
+// while the pages around them are reclaimed.
+START_TEST(reclaim_pin_test_st)
+{
+    enum { pages = 16, n = pages * ILKA_PAGE_SIZE };
+    const char *file = "blah";
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .persist_reclaim = true,
+    };
+    struct ilka_region *r = ilka_open(file, &options);
+
+    ilka_off_t root = ilka_alloc(r, n);
+    ck_assert(ilka_pin(r, root + 4 * ILKA_PAGE_SIZE, 4 * ILKA_PAGE_SIZE));
+    ck_assert(ilka_pin(r, root + 10 * ILKA_PAGE_SIZE, ILKA_PAGE_SIZE));
+
+    for (uint8_t c = 1; c < 4; ++c) {
+        memset(ilka_write(r, root, n), c, n);
+        if (!ilka_save(r)) ilka_abort();
+
+        struct ilka_options options = { .open = true, .read_only = true };
+        struct ilka_region *tr = ilka_open(file, &options);
+
+        const uint8_t *p = ilka_read(r, root, n);
+        const uint8_t *tp = ilka_read(tr, root, n);
+        for (size_t i = 0; i < n; ++i) {
+            ck_assert_int_eq(p[i], c);
+            ck_assert_int_eq(tp[i], c);
+        }
+
+        if (!ilka_close(tr)) ilka_abort();
+    }
+
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
+// Writes racing with saves that reclaim their pages must be made within an
+// epoch.
+struct reclaim_writes_test
+{
+    struct ilka_region *r;
+    ilka_off_t off;
+    size_t n;
+    uint64_t done;
+};
+
+static void * reclaim_writes_run(void *data)
+{
+    struct reclaim_writes_test *t = data;
+
+    for (size_t i = 0; !ilka_atomic_load(&t->done, morder_relaxed); ++i) {
+        ilka_off_t off = t->off + (i % t->n) * sizeof(uint64_t);
+
+        if (!ilka_enter(t->r)) ilka_abort();
+        *((uint64_t *) ilka_write(t->r, off, sizeof(uint64_t))) = i + 1;
+        ilka_exit(t->r);
+    }
+
+    return NULL;
+}
+
+START_TEST(reclaim_writes_test_st)
+{
+    enum { pages = 16, n = pages * ILKA_PAGE_SIZE, saves = 64 };
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .persist_reclaim = true,
+    };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    ilka_off_t root = ilka_alloc(r, n);
+    memset(ilka_write(r, root, n), 0, n);
+
+    struct reclaim_writes_test data = { r, root, n / sizeof(uint64_t), 0 };
+    pthread_t tid;
+    ck_assert(!pthread_create(&tid, NULL, reclaim_writes_run, &data));
+
+    for (size_t i = 0; i < saves; ++i) {
+        if (!ilka_save(r)) ilka_abort();
+        ilka_nsleep(100 * 1000);
+    }
+
+    ilka_atomic_store(&data.done, 1, morder_relaxed);
+    ck_assert(!pthread_join(tid, NULL));
+
+    // The slots are written in a loop so their values only wrap around once
+    // where the writer stopped. A dropped write leaves an older value behind.
+    size_t wraps = 0;
+    const uint64_t *p = ilka_read(r, root, n);
+    for (size_t i = 1; i < data.n; ++i) {
+        if (p[i - 1] + 1 == p[i]) continue;
+        ilka_assert(p[i - 1] > p[i] && !wraps++,
+                "lost write: [%lu] %lu -> %lu", i, p[i - 1], p[i]);
+    }
+
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// undo
+// -----------------------------------------------------------------------------
+
+// Simulates a crash by exiting a child process without saving and checks that
+// the region is rolled back to the last save.
+START_TEST(undo_test_st)
+{
+    enum { pages = 64, n = pages * ILKA_PAGE_SIZE };
+    const char *file = "blah";
+
+    pid_t pid = fork();
+    if (pid == -1) ilka_abort();
+
+    if (!pid) {
+        struct ilka_options options = {
+            .open = true,
+            .create = true,
+            .persist_engine = ilka_persist_shared,
+        };
+        struct ilka_region *r = ilka_open(file, &options);
+
+        ilka_off_t root = ilka_alloc(r, n);
+        memset(ilka_write(r, root, n), 1, n);
+        ilka_set_root(r, root);
+        if (!ilka_save(r)) ilka_abort();
+
+        for (size_t page = 0; page < pages; page += 2) {
+            size_t off = root + page * ILKA_PAGE_SIZE;
+            memset(ilka_write(r, off, ILKA_PAGE_SIZE), 2, ILKA_PAGE_SIZE);
+        }
+        ilka_set_root(r, 0);
+
+        for (size_t i = 0; i < 16; ++i) {
+            ilka_off_t off = ilka_alloc(r, ILKA_PAGE_SIZE);
+            memset(ilka_write(r, off, ILKA_PAGE_SIZE), 3, ILKA_PAGE_SIZE);
+        }
+
+        _exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1) ilka_abort();
+    ck_assert(WIFEXITED(status) && !WEXITSTATUS(status));
+
+    struct ilka_options options = { .open = true };
+    struct ilka_region *r = ilka_open(file, &options);
+
+    ilka_off_t root = ilka_get_root(r);
+    ck_assert(root);
+
+    const uint8_t *p = ilka_read(r, root, n);
+    for (size_t i = 0; i < n; ++i)
+        ilka_assert(p[i] == 1, "unexpected value (%lu != 1): i=%lu", (size_t) p[i], i);
+
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// warm
+// -----------------------------------------------------------------------------
+
+START_TEST(warm_test_st)
+{
+    enum { chunk = 1 << 21, chunks = 8 };
+    const char *file = "blah";
+
+    ilka_off_t root;
+    {
+        struct ilka_options options = { .open = true, .create = true, .warm = true };
+        struct ilka_region *r = ilka_open(file, &options);
+
+        root = ilka_grow(r, chunks * chunk);
+        ilka_set_root(r, root);
+
+        for (size_t i = 0; i < 4; ++i) {
+            memset(ilka_write(r, root + 2 * chunk, chunk), i, chunk);
+            if (!ilka_save(r)) ilka_abort();
+        }
+
+        memset(ilka_write(r, root + 5 * chunk, chunk), 0xFF, chunk);
+        if (!ilka_close(r)) ilka_abort();
+    }
+
+    {
+        FILE *f = fopen("blah.warm", "r");
+        ck_assert(f);
+
+        uint64_t header[2];
+        ck_assert_int_eq(fread(header, sizeof(header), 1, f), 1);
+
+        uint32_t heat[header[1]];
+        ck_assert_int_eq(fread(heat, sizeof(uint32_t), header[1], f), header[1]);
+        fclose(f);
+
+        size_t first = root / chunk;
+        ck_assert(header[1] > first + 5);
+        ck_assert(heat[first + 2] > heat[first + 5]);
+        ck_assert(heat[first + 5] > 0);
+        ck_assert_int_eq(heat[first + 3], 0);
+    }
+
+    // A profile with more chunks than the region can hold is discarded.
+    {
+        FILE *f = fopen("blah.warm", "r+");
+        ck_assert(f);
+
+        uint64_t header[2];
+        ck_assert_int_eq(fread(header, sizeof(header), 1, f), 1);
+        header[1] = 1UL << 48;
+        ck_assert(!fseek(f, 0, SEEK_SET));
+        ck_assert_int_eq(fwrite(header, sizeof(header), 1, f), 1);
+        fclose(f);
+
+        struct ilka_options options = { .open = true, .warm = true };
+        struct ilka_region *r = ilka_open(file, &options);
+        ck_assert_int_eq(ilka_get_root(r), root);
+        if (!ilka_close(r)) ilka_abort();
+    }
+
+    {
+        struct ilka_options options = {
+            .open = true,
+            .warm = true,
+            .warm_threads = 2,
+        };
+        struct ilka_region *r = ilka_open(file, &options);
+        ck_assert_int_eq(ilka_get_root(r), root);
+
+        const uint8_t *p = ilka_read(r, root + 5 * chunk, chunk);
+        for (size_t i = 0; i < chunk; ++i) ck_assert_int_eq(p[i], 0xFF);
+
+        if (!ilka_rm(r)) ilka_abort();
+        ck_assert(access("blah.warm", F_OK) == -1);
+    }
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// tier
+// -----------------------------------------------------------------------------
+
+static void tier_wait(struct ilka_region *r, struct ilka_tier_stats *stats, size_t passes)
+{
+    ck_assert(ilka_tier_stats(r, stats));
+    size_t target = stats->passes + passes;
+
+    while (stats->passes < target) {
+        ilka_nsleep(1000 * 1000);
+        ck_assert(ilka_tier_stats(r, stats));
+    }
+}
+
+START_TEST(tier_test_st)
+{
+    enum { chunk = 1 << 21, chunks = 4 };
+    const char *file = "blah";
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .persist_reclaim = true,
+        .tier = true,
+        .tier_pageout = true,
+        .tier_cold_passes = 2,
+        .tier_freq_usec = 1000,
+    };
+    struct ilka_region *r = ilka_open(file, &options);
+
+    // The meta page is written by every save which keeps its chunk hot.
+    ilka_off_t root = ilka_grow(r, (chunks + 1) * chunk);
+    root = ceil_div(root, chunk) * chunk;
+    memset(ilka_write(r, root, chunks * chunk), 0xFF, chunks * chunk);
+    if (!ilka_save(r)) ilka_abort();
+
+    struct ilka_tier_stats stats;
+    tier_wait(r, &stats, 4);
+    ck_assert(stats.cold_len >= chunks * chunk);
+    ck_assert(stats.advised_len >= chunks * chunk);
+
+    // Writes keep a chunk hot.
+    for (size_t i = 0; i < 4; ++i) {
+        memset(ilka_write(r, root, chunk), i, chunk);
+        tier_wait(r, &stats, 1);
+    }
+    ck_assert(stats.hot_len >= chunk);
+
+    // Reading a paged out chunk faults it back in.
+    const uint8_t *p = ilka_read(r, root + chunk, chunk);
+    for (size_t i = 0; i < chunk; ++i) ck_assert_int_eq(p[i], 0xFF);
+    tier_wait(r, &stats, 2);
+    ck_assert(stats.refault_len >= chunk);
+
+    if (!ilka_close(r)) ilka_abort();
+
+    options = (struct ilka_options) { .open = true };
+    r = ilka_open(file, &options);
+    ck_assert(!ilka_tier_stats(r, &stats));
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// in-memory
+// -----------------------------------------------------------------------------
+
+START_TEST(in_memory_test_st)
+{
+    enum { n = 1 << 24 };
+    const char *file = "blah";
+
+    struct ilka_options options = { .in_memory = true };
+    struct ilka_region *r = ilka_open(file, &options);
+    ck_assert(r);
+
+    ilka_off_t root = ilka_alloc(r, n);
+    memset(ilka_write(r, root, n), 1, n);
+    ilka_set_root(r, root);
+
+    if (!ilka_save(r)) ilka_abort();
+    ck_assert(access(file, F_OK) == -1);
+    ck_assert(access("blah.journal", F_OK) == -1);
+
+    ck_assert_int_eq(ilka_get_root(r), root);
+    const uint8_t *p = ilka_read(r, root, n);
+    for (size_t i = 0; i < n; ++i)
+        ilka_assert(p[i] == 1, "unexpected value (%lu != 1): i=%lu", (size_t) p[i], i);
+
+    if (!ilka_rm(r)) ilka_abort();
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// attach
+// -----------------------------------------------------------------------------
+
+START_TEST(attach_test_st)
+{
+    enum { n = 1 << 22 };
+    const char *file = "blah";
+
+    struct ilka_options options = { .open = true, .create = true };
+    struct ilka_region *r = ilka_open(file, &options);
+
+    ilka_off_t root = ilka_alloc(r, sizeof(uint64_t));
+    *((uint64_t *) ilka_write(r, root, sizeof(uint64_t))) = 1;
+    ilka_set_root(r, root);
+    if (!ilka_save(r)) ilka_abort();
+
+    struct ilka_options attach_options = { .open = true, .attach = true };
+    struct ilka_region *a = ilka_open(file, &attach_options);
+
+    uint64_t gen;
+    if (!ilka_follow(a, &gen)) ilka_abort();
+    ck_assert_int_eq(gen % 2, 0);
+    ck_assert_int_eq(ilka_get_root(a), root);
+    ck_assert_int_eq(*((const uint64_t *) ilka_read(a, root, sizeof(uint64_t))), 1);
+
+    // Unsaved writes are private to the owner.
+    *((uint64_t *) ilka_write(r, root, sizeof(uint64_t))) = 2;
+    ck_assert(!ilka_changed(a, gen));
+    ck_assert_int_eq(*((const uint64_t *) ilka_read(a, root, sizeof(uint64_t))), 1);
+
+    ilka_off_t off = ilka_alloc(r, n);
+    memset(ilka_write(r, off, n), 3, n);
+    if (!ilka_save(r)) ilka_abort();
+    ck_assert(ilka_changed(a, gen));
+
+    uint64_t next;
+    if (!ilka_follow(a, &next)) ilka_abort();
+    ck_assert_int_eq(next, gen + 2);
+    ck_assert_int_eq(ilka_len(a), ilka_len(r));
+    ck_assert_int_eq(*((const uint64_t *) ilka_read(a, root, sizeof(uint64_t))), 2);
+
+    const uint8_t *p = ilka_read(a, off, n);
+    for (size_t i = 0; i < n; ++i)
+        ilka_assert(p[i] == 3, "unexpected value (%lu != 3): i=%lu", (size_t) p[i], i);
+    ck_assert(!ilka_changed(a, next));
+
+    if (!ilka_close(a)) ilka_abort();
+    if (!ilka_rm(r)) ilka_abort();
+}
+END_TEST
+
+
+// -----------------------------------------------------------------------------
+// stripes
+// -----------------------------------------------------------------------------
+
+// Mirrors the layout of the journal written by a save.
+static void stripes_journal(const char *file, ilka_off_t off, size_t len, uint8_t c)
+{
+    int fd = open(file, O_CREAT | O_WRONLY, 0764);
+    ck_assert(fd != -1);
+
+    uint64_t node[2] = { off, len };
+    ck_assert(write(fd, node, sizeof(node)) == sizeof(node));
+
+    uint8_t *buf = malloc(len);
+    memset(buf, c, len);
+    ck_assert(write(fd, buf, len) == (ssize_t) len);
+    free(buf);
+
+    const uint64_t eof[2] = { 0, 0 };
+    const uint64_t magic = 0xB0E9C4032E414824;
+    ck_assert(write(fd, eof, sizeof(eof)) == sizeof(eof));
+    ck_assert(write(fd, &magic, sizeof(magic)) == sizeof(magic));
+
+    close(fd);
+}
+
+START_TEST(stripes_test_st)
+{
+    enum { n = 1 << 24 };
+    const char *file = "blah";
+    const char *stripes[] = { "blah.1", "blah.2" };
+
+    struct ilka_options options = {
+        .open = true,
+        .create = true,
+        .max_len = 1UL << 26,
+        .stripe_files = stripes,
+        .stripe_files_len = 2,
+        .stripe_len = ILKA_HUGE_PAGE_SIZE,
+    };
+    struct ilka_region *r = ilka_open(file, &options);
+    ck_assert(r);
+
+    ilka_off_t root = ilka_alloc(r, n);
+    uint8_t *p = ilka_write(r, root, n);
+    for (size_t i = 0; i < n; ++i) p[i] = i % 251;
+    ilka_set_root(r, root);
+
+    if (!ilka_close(r)) ilka_abort();
+
+    struct stat stat;
+    for (size_t i = 0; i < 2; ++i) {
+        ck_assert(!lstat(stripes[i], &stat));
+        ck_assert(stat.st_size >= n / 4);
+    }
+
+    // Straddles every stripe.
+    ilka_off_t off = root + ILKA_HUGE_PAGE_SIZE / 2;
+    size_t len = 3 * ILKA_HUGE_PAGE_SIZE;
+    stripes_journal("blah.journal", off, len, 0xFF);
+
+    r = ilka_open(file, &options);
+    ck_assert(r);
+    ck_assert(access("blah.journal", F_OK) == -1);
+    ck_assert_int_eq(ilka_get_root(r), root);
+
+    const uint8_t *q = ilka_read(r, root, n);
+    for (size_t i = 0; i < n; ++i) {
+        bool journaled = root + i >= off && root + i < off + len;
+        uint8_t c = journaled ? 0xFF : i % 251;
+        ilka_assert(q[i] == c, "unexpected value (%lu != %lu): i=%lu",
+                (size_t) q[i], (size_t) c, i);
+    }
+
+    if (!ilka_rm(r)) ilka_abort();
+    ck_assert(access(stripes[0], F_OK) == -1);
+    ck_assert(access(stripes[1], F_OK) == -1);
+}
 END_TEST
 
 
@@ -170,7 +1026,23 @@ END_TEST
 void make_suite(Suite *s)
 {
     ilka_tc(s, marks_test_st, true);
+    ilka_tc(s, marks_shared_test_st, true);
+    ilka_tc(s, marks_exact_test_st, true);
+    ilka_tc(s, marks_threads_test_st, true);
+    ilka_tc(s, soft_dirty_test_st, true);
     ilka_tc(s, save_test_mt, true);
+    ilka_tc(s, save_reclaim_test_mt, true);
+    ilka_tc(s, save_async_test_st, true);
+    ilka_tc(s, save_group_test_st, true);
+    ilka_tc(s, reclaim_test_st, true);
+    ilka_tc(s, reclaim_pin_test_st, true);
+    ilka_tc(s, reclaim_writes_test_st, true);
+    ilka_tc(s, undo_test_st, true);
+    ilka_tc(s, in_memory_test_st, true);
+    ilka_tc(s, warm_test_st, true);
+    ilka_tc(s, tier_test_st, true);
+    ilka_tc(s, attach_test_st, true);
+    ilka_tc(s, stripes_test_st, true);
 }
 
 int main(void)
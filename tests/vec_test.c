@@ -94,6 +94,38 @@ START_TEST(basics_test)
 END_TEST
 
 
+// -----------------------------------------------------------------------------
+// compact
+// -----------------------------------------------------------------------------
+
+START_TEST(compact_test)
+{
+    struct ilka_options options = { .open = true, .create = true, .compact = true };
+    struct ilka_region *r = ilka_open("blah", &options);
+
+    struct ilka_vec *v0 = ilka_vec_alloc_compact(r, sizeof(uint64_t));
+    struct ilka_vec *v1 = ilka_vec_open(r, ilka_vec_off(v0));
+
+    enum { n = 1000 };
+    for (uint64_t i = 0; i < n; ++i)
+        if (!ilka_vec_append(v0, &i, 1)) ilka_abort();
+
+    ck_assert_int_eq(ilka_vec_len(v1), n);
+    ck_assert(ilka_vec_cap(v1) >= n);
+    for (size_t i = 0; i < n; ++i)
+        ck_assert_int_eq(*((uint64_t *) ilka_vec_read(v1, i, 1)), i);
+
+    if (!ilka_vec_remove(v1, 0, n - 1)) ilka_abort();
+    ck_assert_int_eq(ilka_vec_len(v0), 1);
+    ck_assert_int_eq(*((uint64_t *) ilka_vec_read(v0, 0, 1)), n - 1);
+
+    if (!ilka_vec_close(v1)) ilka_abort();
+    if (!ilka_vec_free(v0)) ilka_abort();
+    if (!ilka_close(r)) ilka_abort();
+}
+END_TEST
+
+
 // -----------------------------------------------------------------------------
 // resize
 // -----------------------------------------------------------------------------
@@ -272,6 +304,7 @@ END_TEST
 void make_suite(Suite *s)
 {
     ilka_tc(s, basics_test, true);
+    ilka_tc(s, compact_test, true);
     ilka_tc(s, resize_test, true);
     ilka_tc(s, append_test, true);
     ilka_tc(s, insert_test, true);